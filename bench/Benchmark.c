@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Headless renderer benchmark. Tilesets, tilemaps and sprites are generated procedurally, so it needs no
+ * loaders, assets or window. Each case renders a number of frames into a memory framebuffer and reports
+ * Mpixels/s, ns/scanline and frames/s as JSON, to the file given with -o or to stdout. The engine writes its
+ * banner and messages to stderr, so stdout only holds the JSON.
+ *
+ * With -k, nothing is timed: every frame of each case is drawn with a single thread and again with the given
+ * number of threads, and the frames whose pixels or sprite collision pairs differ are reported. The exit code
+ * is 1 if any does, so the check runs as a test.
+ *
+ * usage: tiledjinn_bench [-o output.json] [-f frames] [-s sprites] [-t threads] [-w width] [-h height]
+ *                       [-c tile cache bytes] [-k threads to check]
+ */
+
+#if !defined _WIN32
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tiledjinn.h"
+
+#if defined _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define TILE_SIZE    16
+#define MAP_SIZE    64
+#define NUM_TILES    32
+#define SPRITE_SIZE    32
+#define NUM_PICTURES  8
+#define CROWD_SPRITES  4096
+#define CROWD_SIZE    8
+#define PARTICLES    2048
+#define PARTICLES_SPAWN  256
+#define NUM_LAYERS    4
+#define PIXEL_TILE_SIZE  16
+
+/* benchmark options */
+static int width = 400;
+static int height = 240;
+static int frames = 1000;
+static int numsprites = 250;
+static int threads = 1;
+static int tilecache = 0;
+static int check = 0;  /* threads compared against a single one, 0 = time the cases */
+static int maxsprites;  /* numsprites, or more for the crowd and particle cases */
+
+static uint8_t *framebuffer;
+static TLN_PixelMap *pixel_map;
+static TLN_PixelMap *pixel_rows;
+static TLN_PixelMap *pixel_columns;
+static TLN_PixelMap pixel_tile[PIXEL_TILE_SIZE * PIXEL_TILE_SIZE];
+static TLN_Tilemap tilemaps[2];
+static TLN_Tilemap planes[NUM_LAYERS];
+static TLN_Tilemap sparse;
+static TLN_Tileset pictures;
+static TLN_Tileset crowd;
+static int column_offsets[MAP_SIZE];
+static int *line_hstart;
+static TLN_Blend *line_blend;
+static TLN_PaletteId *line_palettes;
+static int *sprite_ids;
+static int *sprite_x;
+static int *sprite_y;
+static int particles[PARTICLES];
+static int particle_head;
+static uint32_t seed = 1;
+
+/* deterministic generator so every run draws the same scene */
+static int Random(int max) {
+  seed = seed * 1103515245 + 12345;
+  return (int) ((seed >> 16) & 0x7FFF) % max;
+}
+
+/* monotonic wall clock in seconds */
+static double GetSeconds(void) {
+#if defined _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double) counter.QuadPart / frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+/* tiles with noise and optionally some transparent holes, so color key paths are exercised */
+static TLN_Tileset CreateTileset(int numtiles, int size, bool holes) {
+  TLN_TileAttributes *attributes = (TLN_TileAttributes *) calloc(numtiles + 1, sizeof(TLN_TileAttributes));
+  uint8_t *pixels = (uint8_t *) malloc(size * size);
+  TLN_Tileset tileset = TLN_CreateTileset(numtiles, size, size, attributes);
+  int c, x, y;
+
+  for (c = 1; c <= numtiles; c++) {
+    for (y = 0; y < size; y++) {
+      for (x = 0; x < size; x++) {
+        const bool hole = holes && (c & 1) && ((x + y + c) % 5) == 0;
+        pixels[y * size + x] = hole ? 0 : (uint8_t) (1 + Random(255));
+      }
+    }
+    TLN_SetTilesetPixels(tileset, c, pixels, size);
+  }
+  free(pixels);
+  free(attributes);
+  return tileset;
+}
+
+static TLN_Tilemap CreateTilemap(TLN_Tileset tileset) {
+  Tile *tiles = (Tile *) calloc(MAP_SIZE * MAP_SIZE, sizeof(Tile));
+  TLN_Tilemap tilemap;
+  int c;
+
+  for (c = 0; c < MAP_SIZE * MAP_SIZE; c++) {
+    tiles[c].index = (uint16_t) (1 + Random(NUM_TILES));
+    switch (Random(4)) {
+      case 1:
+        tiles[c].flags = FLAG_FLIPX;
+        break;
+      case 2:
+        tiles[c].flags = FLAG_FLIPY;
+        break;
+      case 3:
+        tiles[c].flags = FLAG_FLIPX | FLAG_FLIPY;
+        break;
+    }
+  }
+  tilemap = TLN_CreateTilemap(MAP_SIZE, MAP_SIZE, tiles, 0x000000, tileset);
+  free(tiles);
+  return tilemap;
+}
+
+/* parallax plane: empty above the horizon row, which has tiles with holes, and opaque tiles below it */
+static TLN_Tilemap CreatePlane(TLN_Tileset tileset, int horizon) {
+  Tile *tiles = (Tile *) calloc(MAP_SIZE * MAP_SIZE, sizeof(Tile));
+  TLN_Tilemap tilemap;
+  int c;
+
+  for (c = horizon * MAP_SIZE; c < MAP_SIZE * MAP_SIZE; c++) {
+    if (c < (horizon + 1) * MAP_SIZE) {
+      tiles[c].index = (uint16_t) (1 + Random(NUM_TILES));
+    }
+    else {
+      tiles[c].index = (uint16_t) (2 + 2 * Random(NUM_TILES / 2));
+    }
+  }
+  tilemap = TLN_CreateTilemap(MAP_SIZE, MAP_SIZE, tiles, 0x000000, tileset);
+  free(tiles);
+  return tilemap;
+}
+
+/* foreground decoration: about one tile in ten is set, in short horizontal clusters */
+static TLN_Tilemap CreateSparseTilemap(TLN_Tileset tileset) {
+  Tile *tiles = (Tile *) calloc(MAP_SIZE * MAP_SIZE, sizeof(Tile));
+  TLN_Tilemap tilemap;
+  int c, x;
+
+  for (c = 0; c < MAP_SIZE * MAP_SIZE / 30; c++) {
+    const int start = Random(MAP_SIZE * MAP_SIZE - 3);
+    for (x = 0; x < 3; x++) {
+      tiles[start + x].index = (uint16_t) (1 + Random(NUM_TILES));
+    }
+  }
+  tilemap = TLN_CreateTilemap(MAP_SIZE, MAP_SIZE, tiles, 0x000000, tileset);
+  free(tiles);
+  return tilemap;
+}
+
+/* a case configures the scene before timing, and moves it every frame */
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void (*step)(int frame);
+} Case;
+
+static void ScrollLayer(int frame) {
+  TLN_SetLayerPosition(0, frame * 3, frame);
+}
+
+static void MoveSprites(int frame) {
+  int c;
+
+  for (c = 0; c < numsprites; c++) {
+    const int x = (c * 37 + frame * (1 + c % 3)) % (width + SPRITE_SIZE) - SPRITE_SIZE;
+    const int y = (c * 23 + frame * (1 + c % 2)) % (height + SPRITE_SIZE) - SPRITE_SIZE;
+    TLN_SetSpritePosition(c, x, y);
+  }
+}
+
+/* the same motion as MoveSprites(), for count sprites of the given size in a single batch */
+static void MoveBatch(int count, int size, int frame) {
+  TLN_SpriteBatch batch = {NULL};
+  int c;
+
+  for (c = 0; c < count; c++) {
+    sprite_x[c] = (c * 37 + frame * (1 + c % 3)) % (width + size) - size;
+    sprite_y[c] = (c * 23 + frame * (1 + c % 2)) % (height + size) - size;
+  }
+  batch.x = sprite_x;
+  batch.y = sprite_y;
+  TLN_UpdateSprites(sprite_ids, count, &batch);
+}
+
+static void MoveSpritesBatch(int frame) {
+  MoveBatch(numsprites, SPRITE_SIZE, frame);
+}
+
+static void MoveCrowd(int frame) {
+  MoveBatch(CROWD_SPRITES, CROWD_SIZE, frame);
+}
+
+static void SetupNormal(void) {
+  TLN_EnableLayer(0);
+}
+
+static void SetupScaling(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerScaling(0, 1.5f, 1.25f);
+}
+
+static void SetupAffine(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerTransform(0, 30.0f, width / 2.0f, height / 2.0f, 1.2f, 1.2f);
+}
+
+static void StepAffine(int frame) {
+  TLN_SetLayerTransform(0, frame * 0.5f, width / 2.0f, height / 2.0f, 1.2f, 1.2f);
+}
+
+static void StepPerspective(int frame) {
+  TLN_Perspective camera;
+
+  camera.x = frame * 2.0f;
+  camera.y = frame * -3.0f;
+  camera.height = 32.0f;
+  camera.angle = frame * 0.5f;
+  camera.focal = width / 2.0f;
+  camera.horizon = height / 4;
+  TLN_SetLayerPerspective(0, &camera);
+}
+
+static void SetupPerspective(void) {
+  TLN_EnableLayer(0);
+  StepPerspective(0);
+}
+
+static void SetupPixelMap(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerPixelMapping(0, pixel_map);
+}
+
+static void SetupPixelMapSeparable(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerPixelMappingSeparable(0, pixel_rows, pixel_columns);
+}
+
+static void SetupPixelMapTiled(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerPixelMappingTiled(0, pixel_tile, PIXEL_TILE_SIZE, PIXEL_TILE_SIZE);
+}
+
+/* the normal case, with flipped tiles drawn from mirrored rows */
+static void SetupMirrored(void) {
+  TLN_EnableLayer(0);
+  TLN_SetTilesetMirror(TLN_GetLayerTileset(0), true);
+}
+
+static void SetupSparse(void) {
+  TLN_SetLayerTilemap(0, sparse);
+  TLN_EnableLayer(0);
+}
+
+static void SetupBlend(void) {
+  TLN_EnableLayer(0);
+  TLN_EnableLayer(1);
+  TLN_SetLayerBlendMode(0, BLEND_MIX50);
+}
+
+static void StepBlend(int frame) {
+  TLN_SetLayerPosition(0, frame * 3, frame);
+  TLN_SetLayerPosition(1, frame, frame * 2);
+}
+
+static void SetupParallax(void) {
+  int c;
+
+  for (c = 0; c < NUM_LAYERS; c++) {
+    TLN_SetLayerTilemap(c, planes[c]);
+    TLN_EnableLayer(c);
+  }
+}
+
+/* horizontal scroll only, so the planes keep overlapping below their horizons */
+static void StepParallax(int frame) {
+  int c;
+
+  for (c = 0; c < NUM_LAYERS; c++) {
+    TLN_SetLayerPosition(c, frame * (NUM_LAYERS - c), 0);
+  }
+}
+
+static void SetupParallaxCulled(void) {
+  SetupParallax();
+  TLN_EnableOcclusionCulling(true);
+}
+
+static void SetupMosaic(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerMosaic(0, 4, 4);
+}
+
+static void SetupColumn(void) {
+  TLN_EnableLayer(0);
+  TLN_SetLayerColumnOffset(0, column_offsets);
+}
+
+/* wavy line scroll, a blended band and swapped palettes, some to one that doesn't exist */
+static void StepLineTables(int frame) {
+  int y;
+
+  for (y = 0; y < height; y++) {
+    line_hstart[y] = frame * 3 + (int) (8 * sin((y + frame) * 0.1));
+  }
+}
+
+static void SetupLineTables(void) {
+  TLN_LayerLines tables = {NULL};
+  int y;
+
+  for (y = 0; y < height; y++) {
+    line_blend[y] = (y / 16) % 3 == 1 ? BLEND_MIX50 : BLEND_NONE;
+    line_palettes[y] = (TLN_PaletteId) ((y / 8) % 3 == 0 ? 0 : (y / 8) % 3 == 1 ? 1 : 7);
+  }
+  StepLineTables(0);
+  tables.hstart = line_hstart;
+  tables.blend = line_blend;
+  TLN_EnableLayer(0);
+  TLN_EnableLayer(1);
+  TLN_SetLayerLineTables(0, &tables);
+  TLN_SetPaletteLineTable(0, line_palettes);
+}
+
+static void SetupSprites(void) {
+  int c;
+
+  for (c = 0; c < numsprites; c++) {
+    TLN_EnableSprite(c);
+  }
+}
+
+/* many small sprites, where walking the sprites costs as much as drawing them */
+static void SetupCrowd(void) {
+  int c;
+
+  for (c = 0; c < CROWD_SPRITES; c++) {
+    TLN_SetSpritePicture(c, crowd, 1 + c % NUM_PICTURES);
+    TLN_SetSpritePalette(c, 0);
+  }
+}
+
+static void SetupScaledSprites(void) {
+  int c;
+
+  for (c = 0; c < numsprites; c++) {
+    TLN_EnableSprite(c);
+    TLN_SetSpriteScaling(c, 0.5f + (c % 4) * 0.5f, 0.5f + (c % 3) * 0.5f);
+  }
+}
+
+static void SetupCollidingSprites(void) {
+  int c;
+
+  for (c = 0; c < numsprites; c++) {
+    TLN_EnableSprite(c);
+    TLN_EnableSpriteCollision(c, true);
+  }
+}
+
+/* takes an unused sprite for a crowd-sized particle, placed by its slot */
+static int SpawnParticle(int slot, int frame) {
+  const int nsprite = TLN_GetAvailableSprite();
+  const int x = (slot * 37 + frame * 3) % (width + CROWD_SIZE) - CROWD_SIZE;
+  const int y = (slot * 23 + frame * 2) % (height + CROWD_SIZE) - CROWD_SIZE;
+
+  TLN_SetSpritePicture(nsprite, crowd, 1 + slot % NUM_PICTURES);
+  TLN_SetSpritePalette(nsprite, 0);
+  TLN_SetSpritePosition(nsprite, x, y);
+  return nsprite;
+}
+
+static void SetupParticles(void) {
+  int c;
+
+  for (c = 0; c < PARTICLES; c++) {
+    particles[c] = SpawnParticle(c, 0);
+  }
+  particle_head = 0;
+}
+
+/* retires the oldest particles and spawns as many new ones */
+static void StepParticles(int frame) {
+  int c;
+
+  for (c = 0; c < PARTICLES_SPAWN; c++) {
+    TLN_DisableSprite(particles[(particle_head + c) % PARTICLES]);
+  }
+  for (c = 0; c < PARTICLES_SPAWN; c++) {
+    const int slot = (particle_head + c) % PARTICLES;
+    particles[slot] = SpawnParticle(slot, frame);
+  }
+  particle_head = (particle_head + PARTICLES_SPAWN) % PARTICLES;
+}
+
+/* particles as bullets checked against the first layer, as a bullet-hell stage would */
+static void SetupBullets(void) {
+  int c;
+
+  TLN_EnableLayer(0);
+  SetupParticles();
+  for (c = 0; c < PARTICLES; c++) {
+    TLN_EnableSpriteLayerCollision(particles[c], 1);
+  }
+}
+
+static void StepBullets(int frame) {
+  const int head = particle_head;
+  int c;
+
+  StepParticles(frame);
+  for (c = 0; c < PARTICLES_SPAWN; c++) {
+    TLN_EnableSpriteLayerCollision(particles[(head + c) % PARTICLES], 1);
+  }
+}
+
+static const Case cases[] = {
+        {"normal",            SetupNormal,           ScrollLayer},
+        {"scaling",           SetupScaling,          ScrollLayer},
+        {"affine",            SetupAffine,           StepAffine},
+        {"perspective",       SetupPerspective,      StepPerspective},
+        {"pixel_map",         SetupPixelMap,         ScrollLayer},
+        {"pixel_map_rowcol",  SetupPixelMapSeparable, ScrollLayer},
+        {"pixel_map_tiled",   SetupPixelMapTiled,    ScrollLayer},
+        {"mirrored",          SetupMirrored,         ScrollLayer},
+        {"sparse",            SetupSparse,           ScrollLayer},
+        {"blend",             SetupBlend,            StepBlend},
+        {"parallax",          SetupParallax,         StepParallax},
+        {"parallax_culled",   SetupParallaxCulled,   StepParallax},
+        {"mosaic",            SetupMosaic,           ScrollLayer},
+        {"column_offset",     SetupColumn,           ScrollLayer},
+        {"line_tables",       SetupLineTables,       StepLineTables},
+        {"sprites",           SetupSprites,          MoveSprites},
+        {"sprites_batch",     SetupSprites,          MoveSpritesBatch},
+        {"sprites_scaled",    SetupScaledSprites,    MoveSprites},
+        {"sprites_collision", SetupCollidingSprites, MoveSprites},
+        {"sprites_4096",      SetupCrowd,            MoveCrowd},
+        {"particles",         SetupParticles,        StepParticles},
+        {"bullets",           SetupBullets,          StepBullets},
+};
+
+/* returns layers and sprites to their initial, disabled state */
+static void ResetScene(void) {
+  int c;
+
+  for (c = 0; c < NUM_LAYERS; c++) {
+    TLN_SetLayerTilemap(c, c < 2 ? tilemaps[c] : planes[c]);
+    TLN_ResetLayerMode(c);
+    TLN_SetLayerBlendMode(c, BLEND_NONE);
+    TLN_SetLayerColumnOffset(c, NULL);
+    TLN_SetLayerLineTables(c, NULL);
+    TLN_DisableLayerMosaic(c);
+    TLN_SetLayerPosition(c, 0, 0);
+    TLN_DisableLayer(c);
+  }
+  TLN_EnableOcclusionCulling(false);
+  TLN_SetPaletteLineTable(0, NULL);
+  TLN_SetTilesetMirror(TLN_GetTilemapTileset(tilemaps[0]), false);
+  for (c = 0; c < maxsprites; c++) {
+    if (c < numsprites) {
+      TLN_SetSpritePicture(c, pictures, 1 + c % NUM_PICTURES);
+    }
+    TLN_ResetSpriteScaling(c);
+    TLN_EnableSpriteCollision(c, false);
+    TLN_EnableSpriteLayerCollision(c, 0);
+    TLN_DisableSprite(c);
+  }
+}
+
+/* times one case, returns elapsed seconds. Tile cache statistics are those of the timed frames */
+static double RunCase(const Case *item, TLN_TileCacheStats *stats) {
+  const int warmup = frames / 10;
+  double t0, seconds;
+  int c;
+
+  ResetScene();
+  item->setup();
+  for (c = 0; c < warmup; c++) {
+    item->step(c);
+    TLN_UpdateFrame(c);
+  }
+
+  TLN_GetTileCacheStats(stats);
+  t0 = GetSeconds();
+  for (c = 0; c < frames; c++) {
+    item->step(warmup + c);
+    TLN_UpdateFrame(warmup + c);
+  }
+  seconds = GetSeconds() - t0;
+  TLN_GetTileCacheStats(stats);
+  return seconds;
+}
+
+/* returns the sprite collision pairs of the last frame, and their number in count */
+static TLN_SpriteCollision *GetCollisions(int *count) {
+  TLN_SpriteCollision *pairs;
+
+  *count = TLN_GetSpriteCollisions(NULL, 0);
+  pairs = (TLN_SpriteCollision *) malloc((*count + 1) * sizeof(TLN_SpriteCollision));
+  TLN_GetSpriteCollisions(pairs, *count);
+  return pairs;
+}
+
+/* draws each frame of a case with one thread and with check threads, returns the frames that differ */
+static int CheckCase(const Case *item) {
+  const int size = width * height * 4;
+  uint8_t *single = (uint8_t *) malloc(size);
+  int differ = 0;
+  int c;
+
+  ResetScene();
+  item->setup();
+  for (c = 0; c < frames; c++) {
+    TLN_SpriteCollision *pairs, *threaded;
+    int count, threaded_count;
+
+    item->step(c);
+    TLN_SetRenderThreads(1);
+    TLN_UpdateFrame(c + 1);
+    memcpy(single, framebuffer, size);
+    pairs = GetCollisions(&count);
+
+    TLN_SetRenderThreads(check);
+    TLN_UpdateFrame(c + 1);
+    threaded = GetCollisions(&threaded_count);
+
+    if (memcmp(single, framebuffer, size) != 0 || count != threaded_count ||
+        memcmp(pairs, threaded, count * sizeof(TLN_SpriteCollision)) != 0) {
+      differ += 1;
+    }
+    free(pairs);
+    free(threaded);
+  }
+  free(single);
+  return differ;
+}
+
+static void CreateScene(void) {
+  TLN_Tileset tileset;
+  int c, x, y;
+
+  TLN_CreatePalette(0, 256);
+  TLN_CreatePalette(1, 256);
+  for (c = 0; c < 256; c++) {
+    TLN_SetPaletteColor(0, c, (uint8_t) (c * 7), (uint8_t) (c * 13), (uint8_t) (c * 29));
+    TLN_SetPaletteColor(1, c, (uint8_t) (c * 29), (uint8_t) (c * 7), (uint8_t) (c * 13));
+  }
+
+  tileset = CreateTileset(NUM_TILES, TILE_SIZE, true);
+  for (c = 0; c < 2; c++) {
+    tilemaps[c] = CreateTilemap(tileset);
+  }
+
+  pictures = CreateTileset(NUM_PICTURES, SPRITE_SIZE, true);
+  crowd = CreateTileset(NUM_PICTURES, CROWD_SIZE, true);
+  for (c = 0; c < numsprites; c++) {
+    TLN_SetSpritePicture(c, pictures, 1 + c % NUM_PICTURES);
+    TLN_SetSpritePalette(c, 0);
+  }
+
+  /* parallax planes, nearer planes start lower on the screen. The farthest one is fully opaque */
+  for (c = 0; c < NUM_LAYERS - 1; c++) {
+    planes[c] = CreatePlane(tileset, (height / TILE_SIZE) * (NUM_LAYERS - 1 - c) / NUM_LAYERS);
+  }
+  planes[c] = CreateTilemap(CreateTileset(NUM_TILES, TILE_SIZE, false));
+  sparse = CreateSparseTilemap(tileset);
+
+  /* wavy distortion */
+  pixel_map = (TLN_PixelMap *) malloc(width * height * sizeof(TLN_PixelMap));
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      TLN_PixelMap *item = &pixel_map[y * width + x];
+      item->dx = (int16_t) (x + 4 * sin(y * 0.1));
+      item->dy = (int16_t) (y + 4 * cos(x * 0.1));
+    }
+  }
+
+  /* the same distortion split in rows and columns, and repeated from a small tile */
+  pixel_rows = (TLN_PixelMap *) malloc(height * sizeof(TLN_PixelMap));
+  pixel_columns = (TLN_PixelMap *) malloc(width * sizeof(TLN_PixelMap));
+  for (y = 0; y < height; y++) {
+    pixel_rows[y].dx = (int16_t) (4 * sin(y * 0.1));
+    pixel_rows[y].dy = 0;
+  }
+  for (x = 0; x < width; x++) {
+    pixel_columns[x].dx = 0;
+    pixel_columns[x].dy = (int16_t) (4 * cos(x * 0.1));
+  }
+  for (y = 0; y < PIXEL_TILE_SIZE; y++) {
+    for (x = 0; x < PIXEL_TILE_SIZE; x++) {
+      TLN_PixelMap *item = &pixel_tile[y * PIXEL_TILE_SIZE + x];
+      item->dx = (int16_t) (4 * sin(y * 0.4));
+      item->dy = (int16_t) (4 * cos(x * 0.4));
+    }
+  }
+
+  for (c = 0; c < MAP_SIZE; c++) {
+    column_offsets[c] = (c * 5) % 17 - 8;
+  }
+
+  line_hstart = (int *) malloc(height * sizeof(int));
+  line_blend = (TLN_Blend *) malloc(height * sizeof(TLN_Blend));
+  line_palettes = (TLN_PaletteId *) malloc(height * sizeof(TLN_PaletteId));
+
+  /* sprite batches */
+  sprite_ids = (int *) malloc(maxsprites * sizeof(int));
+  sprite_x = (int *) malloc(maxsprites * sizeof(int));
+  sprite_y = (int *) malloc(maxsprites * sizeof(int));
+  for (c = 0; c < maxsprites; c++) {
+    sprite_ids[c] = c;
+  }
+}
+
+static bool ParseArguments(int argc, char *argv[], const char **output) {
+  int c;
+
+  for (c = 1; c < argc - 1; c += 2) {
+    const char *value = argv[c + 1];
+    if (!strcmp(argv[c], "-o")) {
+      *output = value;
+    }
+    else if (!strcmp(argv[c], "-f")) {
+      frames = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-s")) {
+      numsprites = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-t")) {
+      threads = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-w")) {
+      width = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-h")) {
+      height = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-c")) {
+      tilecache = atoi(value);
+    }
+    else if (!strcmp(argv[c], "-k")) {
+      check = atoi(value);
+    }
+    else {
+      return false;
+    }
+  }
+  return c == argc && frames > 0 && numsprites > 0 && threads > 0 && width > 0 && height > 0 && tilecache >= 0 &&
+         check >= 0;
+}
+
+int main(int argc, char *argv[]) {
+  const int numcases = sizeof(cases) / sizeof(cases[0]);
+  const char *output = NULL;
+  FILE *out = stdout;
+  int failed = 0;
+  int c;
+
+  if (!ParseArguments(argc, argv, &output)) {
+    fprintf(stderr, "usage: %s [-o output.json] [-f frames] [-s sprites] [-t threads] [-w width] [-h height]"
+                    " [-c tile cache bytes] [-k threads to check]\n", argv[0]);
+    return 1;
+  }
+
+  maxsprites = numsprites > CROWD_SPRITES ? numsprites : CROWD_SPRITES;
+  if (TLN_Init(width, height, NUM_LAYERS, maxsprites) == NULL) {
+    fprintf(stderr, "%s\n", TLN_GetErrorString(TLN_GetLastError()));
+    return 1;
+  }
+  framebuffer = (uint8_t *) malloc(width * height * 4);
+  TLN_SetRenderTarget(framebuffer, width * 4);
+  TLN_SetRenderThreads(threads);
+  TLN_SetTileCache(tilecache);
+  CreateScene();
+
+  if (output != NULL) {
+    out = fopen(output, "w");
+    if (out == NULL) {
+      perror(output);
+      return 1;
+    }
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"version\": \"%d.%d.%d\",\n", TILENGINE_VER_MAJ, TILENGINE_VER_MIN, TILENGINE_VER_REV);
+  fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n  \"sprites\": %d,\n  \"threads\": %d,\n",
+          width, height, frames, numsprites, threads);
+  fprintf(out, "  \"tilecache\": %d,\n", tilecache);
+  if (check > 0) {
+    fprintf(out, "  \"check\": %d,\n", check);
+  }
+  fprintf(out, "  \"results\": [\n");
+  for (c = 0; c < numcases; c++) {
+    const char *separator = c < numcases - 1 ? "," : "";
+    if (check > 0) {
+      const int differ = CheckCase(&cases[c]);
+      fprintf(out, "    {\"name\": \"%s\", \"frames_differ\": %d}%s\n", cases[c].name, differ, separator);
+      failed |= differ > 0;
+    }
+    else {
+      TLN_TileCacheStats stats;
+      const double seconds = RunCase(&cases[c], &stats);
+      const double pixels = (double) width * height * frames;
+      fprintf(out, "    {\"name\": \"%s\", \"mpixels_s\": %.2f, \"ns_scanline\": %.1f, \"fps\": %.1f, "
+                   "\"cache_hits\": %u, \"cache_misses\": %u}%s\n",
+              cases[c].name, pixels / seconds / 1e6, seconds * 1e9 / ((double) frames * height), frames / seconds,
+              stats.hits, stats.misses, separator);
+    }
+    fflush(out);
+  }
+  fprintf(out, "  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(pixel_map);
+  free(pixel_rows);
+  free(pixel_columns);
+  free(line_hstart);
+  free(line_blend);
+  free(line_palettes);
+  free(framebuffer);
+  TLN_Deinit();
+  return failed;
+}
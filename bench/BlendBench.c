@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Compares the two blending paths of the 8 to 32 bpp blitters: 64 KB lookup tables (the path still used by
+ * BLEND_CUSTOM) against the arithmetic blitters used by the built-in modes. Writes a JSON array with the
+ * throughput of both in Mpixels/s to the file given as first argument, or to stdout. The engine banner goes
+ * to stderr, so stdout only holds the JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tiledjinn.h"
+#include "Blitters.h"
+#include "Tables.h"
+
+#define WIDTH    4096
+#define PASSES    4000
+
+static const char *mode_names[MAX_BLEND] = {"none", "mix25", "mix50", "mix75", "add", "sub", "mod", "custom"};
+
+static uint8_t src[WIDTH];
+static uint32_t dst[WIDTH];
+static const uint32_t *color;
+
+/* runs the blitter over the test line and returns Mpixels/s */
+static double Measure(ScanBlitPtr blitter, uint8_t *table) {
+  clock_t t0, t1;
+  int c;
+
+  t0 = clock();
+  for (c = 0; c < PASSES; c++) {
+    blitter(src, color, dst, WIDTH, 1, 0, table);
+  }
+  t1 = clock();
+  if (t1 == t0) {
+    t1 = t0 + 1;
+  }
+  return (double) WIDTH * PASSES / ((double) (t1 - t0) / CLOCKS_PER_SEC) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+  FILE *out = stdout;
+  TLN_Blend mode;
+  int c, key;
+
+  if (argc > 1) {
+    out = fopen(argv[1], "w");
+    if (out == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  if (TLN_Init(WIDTH, 1, 0, 0) == NULL) {
+    return 1;
+  }
+
+  /* random palette and indexes, one out of four transparent */
+  TLN_CreatePalette(0, 256);
+  srand(1);
+  for (c = 0; c < 256; c++) {
+    TLN_SetPaletteColor(0, c, rand() & 0xFF, rand() & 0xFF, rand() & 0xFF);
+  }
+  color = (const uint32_t *) TLN_GetPaletteData(0, 0);
+  for (c = 0; c < WIDTH; c++) {
+    src[c] = (rand() & 3) ? (rand() & 0xFF) : 0;
+    dst[c] = (uint32_t) rand();
+  }
+
+  fprintf(out, "[\n");
+  for (mode = BLEND_MIX25; mode < BLEND_CUSTOM; mode++) {
+    for (key = 0; key < 2; key++) {
+      const double table = Measure(GetBlitter(32, key, false, BLEND_CUSTOM), SelectBlendTable(mode));
+      const double arithmetic = Measure(GetBlitter(32, key, false, mode), NULL);
+      fprintf(out, "  {\"mode\": \"%s\", \"key\": %s, \"table_mpixels_s\": %.1f, "
+                   "\"arithmetic_mpixels_s\": %.1f}%s\n",
+              mode_names[mode], key ? "true" : "false", table, arithmetic,
+              mode == BLEND_CUSTOM - 1 && key ? "" : ",");
+    }
+  }
+  fprintf(out, "]\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  TLN_Deinit();
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Sprite collision pairs of a small hand-made scene, checked against the pairs, first contact scanlines and
+ * pixel counts worked out by hand, with 1 and with several render threads. Sprites are enabled in reverse
+ * order, so the drawing order by index is checked too. Prints the mismatches to stderr and exits with 1 if any.
+ *
+ * usage: tiledjinn_collision_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tiledjinn.h"
+
+#define WIDTH    64
+#define HEIGHT    48
+#define SIZE    8
+#define NUM_SPRITES  8
+
+/* pictures: solid of color 1, solid of color 3, and only the left half opaque of color 2 */
+enum {
+    SOLID = 1, SOLID_TOP, LEFT_HALF
+};
+
+typedef struct {
+    int picture;
+    int x, y;
+    bool collide;
+} Placement;
+
+/*
+ * 0-1: solid squares overlapping 4x4 pixels from scanline 9, across the band boundary at 12 of 4 threads
+ * 2-3: the right half of 3 drawn over the opaque half of 2 in columns 22-23, rows 22-27
+ * 4-5: rectangles overlap but only over the transparent half of 4, so no pixels collide
+ * 6-7: overlapping, but 6 has collision disabled
+ */
+static const Placement placements[NUM_SPRITES] = {
+        {SOLID,     10, 5,  true},
+        {SOLID_TOP, 14, 9,  true},
+        {LEFT_HALF, 20, 20, true},
+        {SOLID,     22, 22, true},
+        {LEFT_HALF, 40, 5,  true},
+        {SOLID,     44, 5,  true},
+        {SOLID,     50, 30, false},
+        {SOLID,     52, 32, true},
+};
+
+static const TLN_SpriteCollision expected[] = {
+        {0, 1, 9,  16},
+        {2, 3, 22, 12},
+};
+
+static uint8_t framebuffer[WIDTH * HEIGHT * 4];
+
+static TLN_Tileset CreatePictures(void) {
+  uint8_t pixels[SIZE * SIZE];
+  TLN_Tileset tileset = TLN_CreateTileset(3, SIZE, SIZE, NULL);
+  int x, y;
+
+  memset(pixels, 1, sizeof(pixels));
+  TLN_SetTilesetPixels(tileset, SOLID, pixels, SIZE);
+  memset(pixels, 3, sizeof(pixels));
+  TLN_SetTilesetPixels(tileset, SOLID_TOP, pixels, SIZE);
+  for (y = 0; y < SIZE; y++) {
+    for (x = 0; x < SIZE; x++) {
+      pixels[y * SIZE + x] = x < SIZE / 2 ? 2 : 0;
+    }
+  }
+  TLN_SetTilesetPixels(tileset, LEFT_HALF, pixels, SIZE);
+  return tileset;
+}
+
+/* draws a frame with the given threads and compares its pairs and drawing order, returns the mismatches */
+static int CheckFrame(int threads, int frame) {
+  TLN_SpriteCollision pairs[NUM_SPRITES * NUM_SPRITES];
+  const int numexpected = sizeof(expected) / sizeof(expected[0]);
+  const uint32_t *color = (const uint32_t *) TLN_GetPaletteData(0, 0);
+  const uint32_t *overlap = (const uint32_t *) framebuffer + 10 * WIDTH + 15;
+  int failed = 0;
+  int count, c;
+
+  TLN_SetRenderThreads(threads);
+  TLN_UpdateFrame(frame);
+  count = TLN_GetSpriteCollisions(pairs, NUM_SPRITES * NUM_SPRITES);
+
+  if (count != numexpected) {
+    fprintf(stderr, "%d threads: %d pairs, expected %d\n", threads, count, numexpected);
+    failed += 1;
+  }
+  for (c = 0; c < count && c < numexpected; c++) {
+    const TLN_SpriteCollision *pair = &pairs[c];
+    if (memcmp(pair, &expected[c], sizeof(TLN_SpriteCollision)) != 0) {
+      fprintf(stderr, "%d threads: pair %d is %d-%d line %d pixels %d, expected %d-%d line %d pixels %d\n",
+              threads, c, pair->sprite1, pair->sprite2, pair->line, pair->pixels, expected[c].sprite1,
+              expected[c].sprite2, expected[c].line, expected[c].pixels);
+      failed += 1;
+    }
+  }
+
+  /* sprite 1 is drawn after sprite 0 although it was enabled first */
+  if (*overlap != color[3]) {
+    fprintf(stderr, "%d threads: sprite 0 drawn over sprite 1\n", threads);
+    failed += 1;
+  }
+  return failed;
+}
+
+int main(void) {
+  static const int threads[] = {1, 2, 3, 4, 1};
+  TLN_Tileset pictures;
+  int failed = 0;
+  int c;
+
+  if (TLN_Init(WIDTH, HEIGHT, 0, NUM_SPRITES) == NULL) {
+    fprintf(stderr, "%s\n", TLN_GetErrorString(TLN_GetLastError()));
+    return 1;
+  }
+  TLN_SetRenderTarget(framebuffer, WIDTH * 4);
+  TLN_CreatePalette(0, 256);
+  for (c = 0; c < 256; c++) {
+    TLN_SetPaletteColor(0, c, (uint8_t) (c * 7), (uint8_t) (c * 13), (uint8_t) (c * 29));
+  }
+
+  pictures = CreatePictures();
+  for (c = NUM_SPRITES - 1; c >= 0; c--) {
+    const Placement *placement = &placements[c];
+    TLN_SetSpritePicture(c, pictures, placement->picture);
+    TLN_SetSpritePalette(c, 0);
+    TLN_SetSpritePosition(c, placement->x, placement->y);
+    TLN_EnableSpriteCollision(c, placement->collide);
+  }
+
+  for (c = 0; c < (int) (sizeof(threads) / sizeof(threads[0])); c++) {
+    failed += CheckFrame(threads[c], c + 1);
+  }
+
+  TLN_DeleteTileset(pictures);
+  TLN_Deinit();
+  if (failed == 0) {
+    printf("ok\n");
+  }
+  return failed > 0;
+}
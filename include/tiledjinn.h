@@ -105,6 +105,26 @@ typedef struct {
     float sy;    /* vertical scaling */
 } TLN_Affine;
 
+/* Perspective floor parameters for TLN_SetLayerPerspective() */
+typedef struct {
+    float x;      /* camera horizontal position in the layer */
+    float y;      /* camera vertical position in the layer */
+    float height;  /* camera height above the floor */
+    float angle;  /* view direction in degrees, 0 looks towards negative y */
+    float focal;  /* focal length in pixels, larger values narrow the field of view */
+    int horizon;  /* screen line of the horizon, the floor starts below it */
+} TLN_Perspective;
+
+/* Per-scanline layer parameters for TLN_SetLayerLineTables(), one entry per screen line, NULL = unused */
+typedef struct {
+    const int *hstart;  /* horizontal position, as in TLN_SetLayerPosition() */
+    const int *vstart;  /* vertical position, as in TLN_SetLayerPosition() */
+    const float *xfactor;  /* horizontal scaling factor, for layers with TLN_SetLayerScaling() */
+    const int *clip_x1;  /* left edge of the clip rectangle */
+    const int *clip_x2;  /* right edge of the clip rectangle */
+    const TLN_Blend *blend;  /* blending mode */
+} TLN_LayerLines;
+
 /* Tile item for Tilemap access methods */
 typedef union Tile {
     uint32_t value;
@@ -143,7 +163,7 @@ typedef enum {
     TLN_MAX_OVERLAY
 } TLN_Overlay;
 
-/* pixel mapping for TLN_SetLayerPixelMapping() */
+/* pixel mapping for TLN_SetLayerPixelMapping() and its separable and tiled variants */
 typedef struct {
     int16_t dx;    /* horizontal pixel displacement */
     int16_t dy;    /* vertical pixel displacement */
@@ -167,6 +187,31 @@ typedef struct {
     bool collision;        /* per-pixel collision detection enabled or not */
 } TLN_SpriteState;
 
+/* sprite properties for TLN_UpdateSprites(), one array entry per updated sprite, NULL arrays are left unchanged */
+typedef struct {
+    const int *x;          /* screen position x, as TLN_SetSpritePosition() */
+    const int *y;          /* screen position y, as TLN_SetSpritePosition() */
+    const int *picture;      /* graphic index inside the tileset, as TLN_SetSpritePicture() */
+    const uint32_t *flags;    /* flags replacing the current ones, as TLN_EnableSpriteFlag() */
+    const TLN_PaletteId *palette;  /* palette, enables the sprite as TLN_SetSpritePalette() */
+    TLN_Tileset tileset;      /* tileset of the pictures, NULL keeps the one of each sprite */
+} TLN_SpriteBatch;
+
+/* pair of sprites that collided at pixel level in the last frame, see TLN_GetSpriteCollisions() */
+typedef struct {
+    int sprite1;    /* lower sprite index */
+    int sprite2;    /* higher sprite index */
+    int line;      /* first scanline where they touched */
+    int pixels;    /* pixels where one of them was drawn over the other */
+} TLN_SpriteCollision;
+
+/* tile cache statistics, see TLN_GetTileCacheStats() */
+typedef struct {
+    uint32_t hits;    /* tile rows drawn from the cache */
+    uint32_t misses;  /* tile rows that had to expand their tile first, or couldn't be cached */
+    int memory;       /* bytes of expanded tiles held */
+} TLN_TileCacheStats;
+
 /* callbacks */
 /* void argument here is SDL_Event. void to remove dependency and open up for other back ends */
 typedef void(*TLN_SDLCallback)(void *);
@@ -256,8 +301,8 @@ extern "C"{
 TLN_Engine TLNAPI TLN_Init(int hres, int vres, int numlayers, int numsprites);
 void TLNAPI TLN_Deinit(void);
 bool TLNAPI TLN_DeleteContext(TLN_Engine context);
-bool TLNAPI TLN_SetContex(TLN_Engine context);
-TLN_Engine TLNAPI TLN_GetContex(void);
+bool TLNAPI TLN_SetContext(TLN_Engine context);
+TLN_Engine TLNAPI TLN_GetContext(void);
 int TLNAPI TLN_GetWidth(void);
 int TLNAPI TLN_GetHeight(void);
 uint32_t TLNAPI TLN_GetNumObjects(void);
@@ -267,11 +312,17 @@ int TLNAPI TLN_GetNumLayers(void);
 int TLNAPI TLN_GetNumSprites(void);
 void TLNAPI TLN_SetBGColor(uint8_t r, uint8_t g, uint8_t b);
 bool TLNAPI TLN_SetBGColorFromTilemap(TLN_Tilemap tilemap);
+void TLNAPI TLN_SetBGColorTable(const uint32_t *colors);
 void TLNAPI TLN_DisableBGColor(void);
 void TLNAPI TLN_SetRasterCallback(TLN_VideoCallback);
 void TLNAPI TLN_SetFrameCallback(TLN_VideoCallback);
 void TLNAPI TLN_SetRenderTarget(uint8_t *data, int pitch);
 void TLNAPI TLN_UpdateFrame(int frame);
+bool TLNAPI TLN_UpdateFrameContext(TLN_Engine context, int frame);
+bool TLNAPI TLN_SetRenderThreads(int count);
+bool TLNAPI TLN_SetTileCache(int size);
+bool TLNAPI TLN_GetTileCacheStats(TLN_TileCacheStats *stats);
+void TLNAPI TLN_EnableOcclusionCulling(bool enable);
 void TLNAPI TLN_SetCustomBlendFunction(TLN_BlendFunction);
 void TLNAPI TLN_SetLogLevel(TLN_LogLevel log_level);
 
@@ -312,6 +363,7 @@ TLN_Tileset TLNAPI TLN_CreateTileset(int numtiles, int width, int height, TLN_Ti
 TLN_Tileset TLNAPI TLN_CloneTileset(TLN_Tileset src);
 bool TLNAPI TLN_SetTilesetPixels(TLN_Tileset tileset, int entry, uint8_t *srcdata, int srcpitch);
 const uint8_t * TLN_GetTilesetPixels(TLN_Tileset tileset, int entry);
+bool TLNAPI TLN_SetTilesetMirror(TLN_Tileset tileset, bool enable);
 int TLNAPI TLN_GetTileWidth(TLN_Tileset tileset);
 int TLNAPI TLN_GetTileHeight(TLN_Tileset tileset);
 int TLNAPI TLN_GetTilesetNumTiles(TLN_Tileset tileset);
@@ -337,6 +389,7 @@ bool TLNAPI TLN_SubPaletteColor(TLN_PaletteId palette, uint8_t r, uint8_t g, uin
 bool TLNAPI TLN_ModPaletteColor(TLN_PaletteId palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num);
 const uint8_t *TLNAPI TLN_GetPaletteData(TLN_PaletteId palette_id, int index);
 bool TLNAPI TLN_DeletePalette(TLN_PaletteId palette);
+bool TLNAPI TLN_SetPaletteLineTable(TLN_PaletteId palette, const TLN_PaletteId *table);
 
 /* Background layers management */
 bool TLNAPI TLN_SetLayerTilemap(int nlayer, TLN_Tilemap tilemap);
@@ -344,7 +397,11 @@ bool TLNAPI TLN_SetLayerPosition(int nlayer, int hstart, int vstart);
 bool TLNAPI TLN_SetLayerScaling(int nlayer, float xfactor, float yfactor);
 bool TLNAPI TLN_SetLayerAffineTransform(int nlayer, TLN_Affine *affine);
 bool TLNAPI TLN_SetLayerTransform(int layer, float angle, float dx, float dy, float sx, float sy);
+bool TLNAPI TLN_SetLayerPerspective(int nlayer, TLN_Perspective *perspective);
+bool TLNAPI TLN_SetLayerLineTables(int nlayer, const TLN_LayerLines *tables);
 bool TLNAPI TLN_SetLayerPixelMapping(int nlayer, TLN_PixelMap *table);
+bool TLNAPI TLN_SetLayerPixelMappingSeparable(int nlayer, const TLN_PixelMap *rows, const TLN_PixelMap *columns);
+bool TLNAPI TLN_SetLayerPixelMappingTiled(int nlayer, const TLN_PixelMap *table, int width, int height);
 bool TLNAPI TLN_SetLayerBlendMode(int nlayer, TLN_Blend mode);
 bool TLNAPI TLN_SetLayerColumnOffset(int nlayer, int *offset);
 bool TLNAPI TLN_SetLayerClip(int nlayer, int x1, int y1, int x2, int y2);
@@ -375,10 +432,17 @@ int TLNAPI TLN_GetSpritePicture(int nsprite);
 int TLNAPI TLN_GetAvailableSprite(void);
 bool TLNAPI TLN_EnableSpriteCollision(int nsprite, bool enable);
 bool TLNAPI TLN_GetSpriteCollision(int nsprite);
+int TLNAPI TLN_GetSpriteCollisions(TLN_SpriteCollision *pairs, int max);
+bool TLNAPI TLN_EnableSpriteLayerCollision(int nsprite, uint32_t layers);
+uint32_t TLNAPI TLN_GetSpriteLayerCollision(int nsprite);
 bool TLNAPI TLN_GetSpriteState(int nsprite, TLN_SpriteState *state);
+bool TLNAPI TLN_UpdateSprites(const int *sprites, int count, const TLN_SpriteBatch *batch);
 void TLNAPI TLN_SetSpritesMaskRegion(int top_line, int bottom_line);
 bool TLNAPI TLN_DisableSprite(int nsprite);
 bool TLNAPI TLN_EnableSprite(int nsprite);
+bool TLNAPI TLN_SetFirstSprite(int nsprite);
+bool TLNAPI TLN_SetNextSprite(int nsprite, int next);
+bool TLNAPI TLN_SetLastSprite(int nsprite);
 TLN_PaletteId TLNAPI TLN_GetSpritePalette(int nsprite);
 
 /* World management */
@@ -10,8 +10,8 @@
  * */
 
 #include "tiledjinn.h"
-#include "Palette.h"
 #include "Blitters.h"
+#include "BlittersSIMD.h"
 #include "Tables.h"
 #include "Engine.h"
 
@@ -21,12 +21,10 @@
 #define BLIT_KEY    2
 #define BLIT_BPP    3
 
-extern struct Palette **indexed_palettes;  /* Palette.c */
-
 /* 8 to 8 BPP blitters ----------------------------------------------------- */
 
 static void
-blitFast_8_8(const uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitFast_8_8(const uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
              uint8_t *blend) {
   uint8_t *dstpixel = (uint8_t *) dstptr;
   while (width) {
@@ -37,11 +35,11 @@ blitFast_8_8(const uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, in
 }
 
 static void
-blitFastScaling_8_8(const uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitFastScaling_8_8(const uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                     uint8_t *blend) {
   uint8_t *dstpixel = (uint8_t *) dstptr;
   while (width) {
-    uint32_t src = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
     *dstpixel++ = src;
     offset += dx;
     width--;
@@ -49,7 +47,7 @@ blitFastScaling_8_8(const uint8_t *srcpixel, TLN_PaletteId palette_id, void *dst
 }
 
 static void
-blitKey_8_8(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset, uint8_t *blend) {
+blitKey_8_8(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset, uint8_t *blend) {
   uint8_t *dstpixel = (uint8_t *) dstptr;
   while (width) {
     if (*srcpixel) {
@@ -61,11 +59,11 @@ blitKey_8_8(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width
   }
 }
 
-static void blitKeyScaling_8_8(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+static void blitKeyScaling_8_8(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                                uint8_t *blend) {
   uint8_t *dstpixel = (uint8_t *) dstptr;
   while (width) {
-    uint32_t src = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
     if (src) {
       *dstpixel = src;
     }
@@ -86,11 +84,21 @@ static void blitColor_8_32(void *dstptr, uint32_t color, int width) {
   }
 }
 
+static void blitOverlay_32(const uint32_t *srcpixel, uint32_t *dstpixel, int width) {
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = *srcpixel;
+    }
+    srcpixel++;
+    dstpixel++;
+    width--;
+  }
+}
+
 static void
-blitFast_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitFast_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
               uint8_t *blend) {
   uint32_t *dstpixel = (uint32_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   while (width) {
     *dstpixel++ = color[*srcpixel];
     srcpixel += dx;
@@ -98,10 +106,9 @@ blitFast_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int wid
   }
 }
 
-static void blitFastBlend_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+static void blitFastBlend_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                                const uint8_t *blend) {
   uint8_t *src, *dst;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   dst = (uint8_t *) dstptr;
   while (width) {
     src = (uint8_t *) &color[*srcpixel];
@@ -115,12 +122,11 @@ static void blitFastBlend_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void
 }
 
 static void
-blitFastScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitFastScaling_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                      uint8_t *blend) {
   uint32_t *dstpixel = (uint32_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   while (width) {
-    uint32_t src = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
     *dstpixel++ = color[src];
     offset += dx;
     width--;
@@ -128,13 +134,12 @@ blitFastScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr,
 }
 
 static void
-blitFastBlendScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitFastBlendScaling_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                           uint8_t *blend) {
   uint8_t *src, *dst;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   dst = (uint8_t *) dstptr;
   while (width) {
-    uint32_t item = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t item = *(srcpixel + (offset >> FIXED_BITS));
     src = (uint8_t *) &color[item];
     dst[0] = blendfunc(blend, src[0], dst[0]);
     dst[1] = blendfunc(blend, src[1], dst[1]);
@@ -146,9 +151,8 @@ blitFastBlendScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dst
 }
 
 static void
-blitKey_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset, uint8_t *blend) {
+blitKey_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset, uint8_t *blend) {
   uint32_t *dstpixel = (uint32_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   while (width) {
     if (*srcpixel) {
       *dstpixel = color[*srcpixel];
@@ -160,10 +164,9 @@ blitKey_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int widt
 }
 
 static void
-blitKeyBlend_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitKeyBlend_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                   uint8_t *blend) {
   uint8_t *src, *dst;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   dst = (uint8_t *) dstptr;
   while (width) {
     if (*srcpixel) {
@@ -179,12 +182,11 @@ blitKeyBlend_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int
 }
 
 static void
-blitKeyScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitKeyScaling_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                     uint8_t *blend) {
   uint32_t *dstpixel = (uint32_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   while (width) {
-    uint32_t src = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
     if (src) {
       *dstpixel = color[src];
     }
@@ -196,13 +198,12 @@ blitKeyScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, i
 }
 
 static void
-blitKeyBlendScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset,
+blitKeyBlendScaling_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
                          uint8_t *blend) {
   uint8_t *src, *dst;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
   dst = (uint8_t *) dstptr;
   while (width) {
-    uint32_t item = *(srcpixel + offset / (1 << FIXED_BITS));
+    uint32_t item = *(srcpixel + (offset >> FIXED_BITS));
     if (item) {
       src = (uint8_t *) &color[item];
       dst[0] = blendfunc(blend, src[0], dst[0]);
@@ -215,7 +216,90 @@ blitKeyBlendScaling_8_32(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstp
   }
 }
 
-static const ScanBlitPtr blitters[] =
+/* 8 to 32 BPP arithmetic blend blitters ---------------------------------- */
+
+/*
+ * Built-in blend modes are computed with BlendPixel() instead of the 64 KB lookup tables, which are
+ * left for BLEND_CUSTOM. Each mode gets its own set of blitters so the blend operation is inlined.
+ */
+#define DEFINE_BLEND_BLITTERS(name, mode) \
+static void \
+blitFast##name##_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset, \
+                      uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width) { \
+    *dstpixel = BlendPixel(mode, color[*srcpixel], *dstpixel); \
+    srcpixel += dx; \
+    dstpixel++; \
+    width--; \
+  } \
+} \
+\
+static void \
+blitFastScaling##name##_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                             int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width) { \
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS)); \
+    *dstpixel = BlendPixel(mode, color[src], *dstpixel); \
+    offset += dx; \
+    dstpixel++; \
+    width--; \
+  } \
+} \
+\
+static void \
+blitKey##name##_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset, \
+                     uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width) { \
+    if (*srcpixel) { \
+      *dstpixel = BlendPixel(mode, color[*srcpixel], *dstpixel); \
+    } \
+    srcpixel += dx; \
+    dstpixel++; \
+    width--; \
+  } \
+} \
+\
+static void \
+blitKeyScaling##name##_8_32(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                            int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width) { \
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS)); \
+    if (src) { \
+      *dstpixel = BlendPixel(mode, color[src], *dstpixel); \
+    } \
+    offset += dx; \
+    dstpixel++; \
+    width--; \
+  } \
+}
+
+DEFINE_BLEND_BLITTERS(Mix25, BLEND_MIX25)
+DEFINE_BLEND_BLITTERS(Mix50, BLEND_MIX50)
+DEFINE_BLEND_BLITTERS(Mix75, BLEND_MIX75)
+DEFINE_BLEND_BLITTERS(Add, BLEND_ADD)
+DEFINE_BLEND_BLITTERS(Sub, BLEND_SUB)
+DEFINE_BLEND_BLITTERS(Mod, BLEND_MOD)
+
+/* arithmetic blend blitters by mode, indexed by (key << 1) + scaling */
+static ScanBlitPtr blend_blitters[MAX_BLEND][4] =
+        {
+                {NULL, NULL, NULL, NULL},
+                {blitFastMix25_8_32, blitFastScalingMix25_8_32, blitKeyMix25_8_32, blitKeyScalingMix25_8_32},
+                {blitFastMix50_8_32, blitFastScalingMix50_8_32, blitKeyMix50_8_32, blitKeyScalingMix50_8_32},
+                {blitFastMix75_8_32, blitFastScalingMix75_8_32, blitKeyMix75_8_32, blitKeyScalingMix75_8_32},
+                {blitFastAdd_8_32,   blitFastScalingAdd_8_32,   blitKeyAdd_8_32,   blitKeyScalingAdd_8_32},
+                {blitFastSub_8_32,   blitFastScalingSub_8_32,   blitKeySub_8_32,   blitKeyScalingSub_8_32},
+                {blitFastMod_8_32,   blitFastScalingMod_8_32,   blitKeyMod_8_32,   blitKeyScalingMod_8_32},
+                {NULL, NULL, NULL, NULL},
+        };
+
+/* blend entries use the lookup table passed in blend (BLEND_CUSTOM), 8 to 32 bpp entries without blending
+ * get replaced by SIMD variants in InitBlitters() */
+static ScanBlitPtr blitters[] =
         {
                 blitFast_8_8,
                 NULL,
@@ -236,9 +320,60 @@ static const ScanBlitPtr blitters[] =
                 blitKeyBlendScaling_8_32
         };
 
-ScanBlitPtr GetBlitter(int bpp, bool key, bool scaling, bool blend) {
+static OverlayBlitPtr blit_overlay = blitOverlay_32;
+
+static OverlayBlendBlitPtr blit_overlay_blend = NULL;
+
+static AffineBlitPtr blit_affine = NULL;
+
+static MapBlitPtr blit_pixel_map = NULL;
+
+static CollisionBlitPtr blit_collision = NULL;
+
+/* selects the fastest blitters supported by the running CPU */
+static void SelectSIMDBlitters(void) {
+  const simd_t simd = DetectSIMD();
+  int key, scaling, mode;
+
+  if (GetSIMDOverlayBlitter(simd) != NULL) {
+    blit_overlay = GetSIMDOverlayBlitter(simd);
+  }
+  blit_overlay_blend = GetSIMDOverlayBlendBlitter(simd);
+  blit_affine = GetSIMDAffineBlitter(simd);
+  blit_pixel_map = GetSIMDPixelMapBlitter(simd);
+  blit_collision = GetSIMDCollisionBlitter(simd);
+
+  for (key = 0; key < 2; key++) {
+    for (scaling = 0; scaling < 2; scaling++) {
+      ScanBlitPtr blitter = GetSIMDBlitter(simd, key, scaling, BLEND_NONE);
+      if (blitter != NULL) {
+        blitters[(1 << BLIT_BPP) + (key << BLIT_KEY) + (scaling << BLIT_SCALING)] = blitter;
+      }
+      for (mode = BLEND_MIX25; mode < BLEND_CUSTOM; mode++) {
+        blitter = GetSIMDBlitter(simd, key, scaling, (TLN_Blend) mode);
+        if (blitter != NULL) {
+          blend_blitters[mode][(key << 1) + scaling] = blitter;
+        }
+      }
+    }
+  }
+}
+
+/* the tables are shared by all contexts, filled by the first TLN_Init() even when called from several threads */
+void InitBlitters(void) {
+  static once_t once = ONCE_INIT;
+  CallOnce(&once, SelectSIMDBlitters);
+}
+
+ScanBlitPtr GetBlitter(int bpp, bool key, bool scaling, TLN_Blend mode) {
+  const bool blend = mode != BLEND_NONE;
   int index;
 
+  /* built-in blend modes are arithmetic */
+  if (bpp == 32 && blend && mode != BLEND_CUSTOM) {
+    return blend_blitters[mode][(key << 1) + scaling];
+  }
+
   if (bpp == 32) {
     bpp = 1;
   }
@@ -254,51 +389,164 @@ void BlitColor(void *dstptr, uint32_t color, int width) {
   blitColor_8_32(dstptr, color, width);
 }
 
-void BlitMosaicSolid(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int size) {
-  uint32_t *dstpixel = (uint32_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
-  while (width) {
-    if (size > width) {
-      size = width;
+void BlitOverlay(const uint32_t *srcptr, uint32_t *dstptr, int width) {
+  blit_overlay(srcptr, dstptr, width);
+}
+
+/* SIMD blitters stop at groups of pixels, the scalar one draws the rest */
+void BlitAffine(AffineSpan *span, uint32_t *dstptr, int width) {
+  if (blit_affine != NULL) {
+    const int done = blit_affine(span, dstptr, width);
+    dstptr += done;
+    width -= done;
+  }
+  BlitAffineScalar(span, dstptr, width);
+}
+
+/* draws the pixel of the span at a layer position */
+static inline void DrawSpanPixel(const AffineSpan *span, int xpos, int ypos, uint32_t *dstpixel) {
+  const int hmask = (1 << span->hshift) - 1;
+  const int vmask = (1 << span->vshift) - 1;
+  const Tile tile = span->tiles[(ypos >> span->vshift) * span->cols + (xpos >> span->hshift)];
+
+  if (tile.index) {
+    const int srcx = (tile.flags & FLAG_FLIPX) ? hmask - (xpos & hmask) : xpos & hmask;
+    const int srcy = (tile.flags & FLAG_FLIPY) ? vmask - (ypos & vmask) : ypos & vmask;
+    const uint8_t index = span->pixels[(((span->indexes[tile.index] << span->vshift) + srcy) << span->hshift) + srcx];
+    if (index) {
+      const uint32_t color = ((const uint32_t *) span->palettes[tile.flags & FLAG_PALETTES]->data)[index];
+      if (span->blend_mode == BLEND_NONE) {
+        *dstpixel = color;
+      }
+      else if (span->blend_mode == BLEND_CUSTOM) {
+        const uint8_t *src = (const uint8_t *) &color;
+        uint8_t *dst = (uint8_t *) dstpixel;
+        dst[0] = blendfunc(span->blend, src[0], dst[0]);
+        dst[1] = blendfunc(span->blend, src[1], dst[1]);
+        dst[2] = blendfunc(span->blend, src[2], dst[2]);
+      }
+      else {
+        *dstpixel = BlendPixel(span->blend_mode, color, *dstpixel);
+      }
     }
+  }
+}
+
+void BlitAffineScalar(AffineSpan *span, uint32_t *dstptr, int width) {
+  uint32_t *dstpixel = dstptr;
+
+  while (width) {
+    DrawSpanPixel(span, fix2int(span->x), fix2int(span->y), dstpixel);
+    span->x = WrapAffine(span->x + span->dx, span->width, span->xmask);
+    span->y = WrapAffine(span->y + span->dy, span->height, span->ymask);
+    dstpixel++;
+    width--;
+  }
+}
+
+void BlitPixelMap(const AffineSpan *span, const int *xpos, const int *ypos, uint32_t *dstptr, int width) {
+  if (blit_pixel_map != NULL) {
+    const int done = blit_pixel_map(span, xpos, ypos, dstptr, width);
+    xpos += done;
+    ypos += done;
+    dstptr += done;
+    width -= done;
+  }
+  BlitPixelMapScalar(span, xpos, ypos, dstptr, width);
+}
+
+void BlitPixelMapScalar(const AffineSpan *span, const int *xpos, const int *ypos, uint32_t *dstptr, int width) {
+  int x;
+
+  for (x = 0; x < width; x++) {
+    DrawSpanPixel(span, xpos[x], ypos[x], &dstptr[x]);
+  }
+}
 
+/*
+ * pixels over the same sprite are counted in runs, so the counts are only touched where the sprite below
+ * changes. SIMD blitters only step forwards
+ */
+void BlitCollision(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int nsprite,
+                   OverlapCounts *overlap) {
+  int other = 0xFFFF;
+  int run = 0;
+
+  if (dx == 1 && blit_collision != NULL) {
+    const int done = blit_collision(srcpixel, dstpixel, width, nsprite, overlap);
+    srcpixel += done;
+    dstpixel += done;
+    width -= done;
+  }
+  while (width) {
     if (*srcpixel) {
-      const uint32_t value = color[*srcpixel];
-      int c;
-      for (c = 0; c < size; c++) {
-        *dstpixel++ = value;
+      if (*dstpixel != other) {
+        AddOverlap(overlap, other, run);
+        other = *dstpixel;
+        run = 0;
       }
+      run++;
+      *dstpixel = (uint16_t) nsprite;
     }
-    else {
-      dstpixel += size;
-    }
-    srcpixel += size;
-    width -= size;
+    srcpixel += dx;
+    dstpixel++;
+    width--;
   }
+  AddOverlap(overlap, other, run);
 }
 
-void BlitMosaicBlend(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int size, uint8_t *blend) {
-  uint8_t *dstpixel = (uint8_t *) dstptr;
-  uint32_t *color = (uint32_t *) indexed_palettes[palette_id]->data;
+void BlitCollisionScaling(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int offset, int nsprite,
+                          OverlapCounts *overlap) {
+  int other = 0xFFFF;
+  int run = 0;
+
   while (width) {
-    if (size > width) {
-      size = width;
+    if (srcpixel[fix2int(offset)]) {
+      if (*dstpixel != other) {
+        AddOverlap(overlap, other, run);
+        other = *dstpixel;
+        run = 0;
+      }
+      run++;
+      *dstpixel = (uint16_t) nsprite;
     }
+    offset += dx;
+    dstpixel++;
+    width--;
+  }
+  AddOverlap(overlap, other, run);
+}
 
-    if (*srcpixel) {
-      const uint8_t *value = (uint8_t *) &color[*srcpixel];
-      int c;
-      for (c = 0; c < size; c++) {
-        dstpixel[0] = blendfunc(blend, value[0], dstpixel[0]);
-        dstpixel[1] = blendfunc(blend, value[1], dstpixel[1]);
-        dstpixel[2] = blendfunc(blend, value[2], dstpixel[2]);
-        dstpixel += sizeof(uint32_t);
+/* BLEND_CUSTOM uses the lookup table in blend */
+void BlitOverlayBlend(const uint32_t *srcptr, uint32_t *dstptr, int width, TLN_Blend mode, const uint8_t *blend) {
+  if (mode != BLEND_CUSTOM) {
+    if (blit_overlay_blend != NULL) {
+      const int done = blit_overlay_blend(srcptr, dstptr, width, mode);
+      srcptr += done;
+      dstptr += done;
+      width -= done;
+    }
+    while (width) {
+      if (*srcptr) {
+        *dstptr = BlendPixel(mode, *srcptr, *dstptr);
       }
+      srcptr++;
+      dstptr++;
+      width--;
     }
-    else {
-      dstpixel += (sizeof(uint32_t) * size);
+  }
+  else {
+    while (width) {
+      if (*srcptr) {
+        const uint8_t *src = (const uint8_t *) srcptr;
+        uint8_t *dst = (uint8_t *) dstptr;
+        dst[0] = blendfunc(blend, src[0], dst[0]);
+        dst[1] = blendfunc(blend, src[1], dst[1]);
+        dst[2] = blendfunc(blend, src[2], dst[2]);
+      }
+      srcptr++;
+      dstptr++;
+      width--;
     }
-    srcpixel += size;
-    width -= size;
   }
 }
@@ -13,16 +13,109 @@
 #define BLITTERS_H
 
 #include "tiledjinn.h"
+#include "Math2D.h"
 
+struct Palette;
+
+/*
+ * draws a scanline of palette indexes. Regular blitters step srcpixel by dx, scaling blitters read
+ * srcpixel at offset >> FIXED_BITS and step offset by dx: offset must stay non negative
+ */
 typedef void (*ScanBlitPtr) \
-(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int dx, int offset, uint8_t *blend);
+(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset, uint8_t *blend);
+
+/* copies the non-zero pixels of a 32 bpp scanline over another */
+typedef void (*OverlayBlitPtr)(const uint32_t *srcptr, uint32_t *dstptr, int width);
 
-ScanBlitPtr GetBlitter(int bpp, bool key, bool scaling, bool blend);
+void InitBlitters(void);
+
+ScanBlitPtr GetBlitter(int bpp, bool key, bool scaling, TLN_Blend mode);
 
 void BlitColor(void *dstptr, uint32_t color, int width);
 
-void BlitMosaicSolid(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int size);
+void BlitOverlay(const uint32_t *srcptr, uint32_t *dstptr, int width);
+
+/* blends the non-zero pixels of a 32 bpp scanline over another with a built-in mode, returns how many */
+typedef int (*OverlayBlendBlitPtr)(const uint32_t *srcptr, uint32_t *dstptr, int width, TLN_Blend mode);
+
+void BlitOverlayBlend(const uint32_t *srcptr, uint32_t *dstptr, int width, TLN_Blend mode, const uint8_t *blend);
+
+/*
+ * tiled layer sampled at transformed positions: along a straight line in fixed point for affine and
+ * perspective layers, or at the positions listed in arrays for pixel mapping (x, y and steps unused)
+ */
+typedef struct {
+    const Tile *tiles;    /* tilemap entries */
+    int cols;        /* tilemap columns */
+    const uint16_t *indexes;  /* tileset entry of each tile index (animations) */
+    const uint8_t *pixels;  /* tileset pixels */
+    int hshift;        /* tile width as a power of two */
+    int vshift;        /* tile height as a power of two */
+    fix_t x, y;        /* source position of the next pixel, inside the layer */
+    fix_t dx, dy;      /* source step per pixel */
+    fix_t width, height;  /* layer size */
+    fix_t xmask, ymask;    /* layer size - 1 for power of two sizes, 0 otherwise */
+    struct Palette *const *palettes;  /* palettes by the tile palette id */
+    TLN_Blend blend_mode;
+    const uint8_t *blend;  /* lookup table for BLEND_CUSTOM */
+} AffineSpan;
+
+/* draws up to width pixels of the span and returns how many, advancing its position */
+typedef int (*AffineBlitPtr)(AffineSpan *span, uint32_t *dstptr, int width);
+
+void BlitAffine(AffineSpan *span, uint32_t *dstptr, int width);
+
+void BlitAffineScalar(AffineSpan *span, uint32_t *dstptr, int width);
+
+/* draws up to width pixels sampled at the given layer positions and returns how many */
+typedef int (*MapBlitPtr)(const AffineSpan *span, const int *xpos, const int *ypos, uint32_t *dstptr, int width);
+
+void BlitPixelMap(const AffineSpan *span, const int *xpos, const int *ypos, uint32_t *dstptr, int width);
+
+void BlitPixelMapScalar(const AffineSpan *span, const int *xpos, const int *ypos, uint32_t *dstptr, int width);
+
+/* pixels a sprite covers of each other sprite in the collision buffer */
+typedef struct {
+    int *pixels;    /* by sprite, zero for the ones not covered */
+    int *sprites;    /* sprites with pixels, in the order they were covered */
+    int count;
+} OverlapCounts;
+
+/* adds pixels covered of another sprite, 0xFFFF for none, listing the sprite the first time */
+static inline void AddOverlap(OverlapCounts *overlap, int other, int pixels) {
+  if (other != 0xFFFF && pixels > 0) {
+    if (overlap->pixels[other] == 0) {
+      overlap->sprites[overlap->count++] = other;
+    }
+    overlap->pixels[other] += pixels;
+  }
+}
+
+/*
+ * writes a sprite id to the collision buffer under the opaque pixels of a scanline, adding the pixels it
+ * covers of other sprites. Returns how many pixels were done
+ */
+typedef int (*CollisionBlitPtr)(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int nsprite,
+                                OverlapCounts *overlap);
+
+void BlitCollision(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int nsprite,
+                   OverlapCounts *overlap);
+
+void BlitCollisionScaling(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int offset, int nsprite,
+                          OverlapCounts *overlap);
 
-void BlitMosaicBlend(uint8_t *srcpixel, TLN_PaletteId palette_id, void *dstptr, int width, int size, uint8_t *blend);
+/* wraps a fixed point coordinate inside [0, size), with a mask when size is a power of two */
+static inline fix_t WrapAffine(fix_t value, fix_t size, fix_t mask) {
+  if (mask != 0) {
+    return value & mask;
+  }
+  if (value >= size || value < 0) {
+    value %= size;
+    if (value < 0) {
+      value += size;
+    }
+  }
+  return value;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1160 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Vectorized 8 to 32 bpp palette lookup blitters. Each one renders groups of pixels with SIMD
+ * instructions and finishes the remainder with the same code as its scalar counterpart in Blitters.c,
+ * so output is identical. Built-in blend modes are computed with packed integer arithmetic that matches
+ * BlendPixel() exactly. Functions are compiled for their instruction set with per-function target
+ * attributes and only selected after checking the CPU at runtime. Define TLN_NO_SIMD to build the
+ * scalar blitters only.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include "tiledjinn.h"
+#include "BlittersSIMD.h"
+#include "Tables.h"
+#include "Palette.h"
+#include "Math2D.h"
+
+#if defined TLN_NO_SIMD
+/* scalar only */
+#elif defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define SIMD_X86
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+#define SIMD_X86
+#define TARGET_SSE41
+#define TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM64
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined SIMD_X86
+
+/* SSE4.1 blitters: 4 pixels per iteration -------------------------------- */
+
+TARGET_SSE41 static void
+blitFast_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                    uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  while (width >= 4) {
+    const __m128i value = _mm_setr_epi32(color[srcpixel[0]], color[srcpixel[dx]], color[srcpixel[dx * 2]],
+                                         color[srcpixel[dx * 3]]);
+    _mm_storeu_si128((__m128i *) dstpixel, value);
+    srcpixel += dx * 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    *dstpixel++ = color[*srcpixel];
+    srcpixel += dx;
+    width--;
+  }
+}
+
+TARGET_SSE41 static void
+blitKey_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                   uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  while (width >= 4) {
+    const __m128i index = _mm_setr_epi32(srcpixel[0], srcpixel[dx], srcpixel[dx * 2], srcpixel[dx * 3]);
+    const __m128i mask = _mm_cmpgt_epi32(index, _mm_setzero_si128());
+    if (!_mm_testz_si128(mask, mask)) {
+      const __m128i value = _mm_setr_epi32(color[srcpixel[0]], color[srcpixel[dx]], color[srcpixel[dx * 2]],
+                                           color[srcpixel[dx * 3]]);
+      const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel);
+      _mm_storeu_si128((__m128i *) dstpixel, _mm_blendv_epi8(dst, value, mask));
+    }
+    srcpixel += dx * 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = color[*srcpixel];
+    }
+    srcpixel += dx;
+    dstpixel++;
+    width--;
+  }
+}
+
+TARGET_SSE41 static void
+blitFastScaling_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                           uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  while (width >= 4) {
+    const __m128i value = _mm_setr_epi32(color[srcpixel[offset >> FIXED_BITS]],
+                                         color[srcpixel[(offset + dx) >> FIXED_BITS]],
+                                         color[srcpixel[(offset + dx * 2) >> FIXED_BITS]],
+                                         color[srcpixel[(offset + dx * 3) >> FIXED_BITS]]);
+    _mm_storeu_si128((__m128i *) dstpixel, value);
+    offset += dx * 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
+    *dstpixel++ = color[src];
+    offset += dx;
+    width--;
+  }
+}
+
+TARGET_SSE41 static void
+blitKeyScaling_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                          uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  while (width >= 4) {
+    const __m128i index = _mm_setr_epi32(srcpixel[offset >> FIXED_BITS],
+                                         srcpixel[(offset + dx) >> FIXED_BITS],
+                                         srcpixel[(offset + dx * 2) >> FIXED_BITS],
+                                         srcpixel[(offset + dx * 3) >> FIXED_BITS]);
+    const __m128i mask = _mm_cmpgt_epi32(index, _mm_setzero_si128());
+    if (!_mm_testz_si128(mask, mask)) {
+      const __m128i value = _mm_setr_epi32(color[_mm_extract_epi32(index, 0)], color[_mm_extract_epi32(index, 1)],
+                                           color[_mm_extract_epi32(index, 2)], color[_mm_extract_epi32(index, 3)]);
+      const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel);
+      _mm_storeu_si128((__m128i *) dstpixel, _mm_blendv_epi8(dst, value, mask));
+    }
+    offset += dx * 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
+    if (src) {
+      *dstpixel = color[src];
+    }
+    offset += dx;
+    dstpixel++;
+    width--;
+  }
+}
+
+/* AVX2 blitters: 8 pixels per iteration with palette gathers ------------- */
+
+/* loads 8 consecutive palette indexes, walking backwards when dx is negative */
+TARGET_AVX2 static inline __m256i LoadIndexes8(const uint8_t *srcpixel, int dx) {
+  __m128i bytes;
+  if (dx > 0) {
+    bytes = _mm_loadl_epi64((const __m128i *) srcpixel);
+  }
+  else {
+    const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 8, 9, 10, 11, 12, 13, 14, 15);
+    bytes = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *) (srcpixel - 7)), reverse);
+  }
+  return _mm256_cvtepu8_epi32(bytes);
+}
+
+/* loads 8 palette indexes at fixed point offsets, which are never negative, walking in either direction */
+TARGET_AVX2 static inline __m256i LoadScaledIndexes8(const uint8_t *srcpixel, int offset, int dx) {
+  const __m256i steps = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i offsets = _mm256_add_epi32(_mm256_set1_epi32(offset),
+                                           _mm256_mullo_epi32(_mm256_set1_epi32(dx), steps));
+
+  /* the first pixels of a buffer have no 3 bytes before them to gather with, load those groups one by one */
+  if ((offset >> FIXED_BITS) < 3 || ((offset + dx * 7) >> FIXED_BITS) < 3) {
+    return _mm256_setr_epi32(srcpixel[offset >> FIXED_BITS], srcpixel[(offset + dx) >> FIXED_BITS],
+                             srcpixel[(offset + dx * 2) >> FIXED_BITS], srcpixel[(offset + dx * 3) >> FIXED_BITS],
+                             srcpixel[(offset + dx * 4) >> FIXED_BITS], srcpixel[(offset + dx * 5) >> FIXED_BITS],
+                             srcpixel[(offset + dx * 6) >> FIXED_BITS], srcpixel[(offset + dx * 7) >> FIXED_BITS]);
+  }
+
+  /* each index is the top byte of the 32 bit word ending at it, so nothing past the furthest one is read */
+  return _mm256_srli_epi32(_mm256_i32gather_epi32((const int *) (srcpixel - 3),
+                                                  _mm256_srli_epi32(offsets, FIXED_BITS), 1), 24);
+}
+
+TARGET_AVX2 static void
+blitFast_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                   uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  if (dx == 1 || dx == -1) {
+    while (width >= 8) {
+      const __m256i index = LoadIndexes8(srcpixel, dx);
+      _mm256_storeu_si256((__m256i *) dstpixel, _mm256_i32gather_epi32((const int *) color, index, 4));
+      srcpixel += dx * 8;
+      dstpixel += 8;
+      width -= 8;
+    }
+  }
+  while (width) {
+    *dstpixel++ = color[*srcpixel];
+    srcpixel += dx;
+    width--;
+  }
+}
+
+TARGET_AVX2 static void
+blitKey_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                  uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  const __m256i zero = _mm256_setzero_si256();
+  if (dx == 1 || dx == -1) {
+    while (width >= 8) {
+      const __m256i index = LoadIndexes8(srcpixel, dx);
+      const __m256i mask = _mm256_cmpgt_epi32(index, zero);
+      if (!_mm256_testz_si256(mask, mask)) {
+        const __m256i value = _mm256_mask_i32gather_epi32(zero, (const int *) color, index, mask, 4);
+        _mm256_maskstore_epi32((int *) dstpixel, mask, value);
+      }
+      srcpixel += dx * 8;
+      dstpixel += 8;
+      width -= 8;
+    }
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = color[*srcpixel];
+    }
+    srcpixel += dx;
+    dstpixel++;
+    width--;
+  }
+}
+
+TARGET_AVX2 static void
+blitFastScaling_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                          uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  while (width >= 8) {
+    const __m256i index = LoadScaledIndexes8(srcpixel, offset, dx);
+    _mm256_storeu_si256((__m256i *) dstpixel, _mm256_i32gather_epi32((const int *) color, index, 4));
+    offset += dx * 8;
+    dstpixel += 8;
+    width -= 8;
+  }
+  while (width) {
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
+    *dstpixel++ = color[src];
+    offset += dx;
+    width--;
+  }
+}
+
+TARGET_AVX2 static void
+blitKeyScaling_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                         uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  const __m256i zero = _mm256_setzero_si256();
+  while (width >= 8) {
+    const __m256i index = LoadScaledIndexes8(srcpixel, offset, dx);
+    const __m256i mask = _mm256_cmpgt_epi32(index, zero);
+    if (!_mm256_testz_si256(mask, mask)) {
+      const __m256i value = _mm256_mask_i32gather_epi32(zero, (const int *) color, index, mask, 4);
+      _mm256_maskstore_epi32((int *) dstpixel, mask, value);
+    }
+    offset += dx * 8;
+    dstpixel += 8;
+    width -= 8;
+  }
+  while (width) {
+    uint32_t src = *(srcpixel + (offset >> FIXED_BITS));
+    if (src) {
+      *dstpixel = color[src];
+    }
+    offset += dx;
+    dstpixel++;
+    width--;
+  }
+}
+
+/* SSE4.1 and AVX2 arithmetic blending ------------------------------------ */
+
+/* blends 16-bit widened components for the modes that need multiplication or division */
+TARGET_SSE41 static inline __m128i BlendWords4(TLN_Blend mode, __m128i a, __m128i b) {
+  switch (mode) {
+    case BLEND_MIX25:
+      return _mm_mulhi_epu16(_mm_add_epi16(a, _mm_add_epi16(b, b)), _mm_set1_epi16(21846));  /* x/3 */
+    case BLEND_MIX75:
+      return _mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(a, a), b), _mm_set1_epi16(21846));
+    default: {
+      const __m128i p = _mm_mullo_epi16(a, b);  /* p/255 */
+      return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p, _mm_set1_epi16(1)), _mm_srli_epi16(p, 8)), 8);
+    }
+  }
+}
+
+/* blends the RGB components of 4 pixels keeping destination alpha, same results as BlendPixel() */
+TARGET_SSE41 static inline __m128i BlendPixels4(TLN_Blend mode, __m128i src, __m128i dst) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i value;
+
+  switch (mode) {
+    case BLEND_MIX50:
+      value = _mm_add_epi8(_mm_and_si128(src, dst),
+                           _mm_and_si128(_mm_srli_epi16(_mm_xor_si128(src, dst), 1), _mm_set1_epi8(0x7F)));
+      break;
+    case BLEND_ADD:
+      value = _mm_adds_epu8(src, dst);
+      break;
+    case BLEND_SUB:
+      value = _mm_subs_epu8(src, dst);
+      break;
+    default:
+      value = _mm_packus_epi16(
+              BlendWords4(mode, _mm_unpacklo_epi8(src, zero), _mm_unpacklo_epi8(dst, zero)),
+              BlendWords4(mode, _mm_unpackhi_epi8(src, zero), _mm_unpackhi_epi8(dst, zero)));
+      break;
+  }
+  return _mm_blendv_epi8(value, dst, _mm_set1_epi32((int) 0xFF000000));
+}
+
+TARGET_AVX2 static inline __m256i BlendWords8(TLN_Blend mode, __m256i a, __m256i b) {
+  switch (mode) {
+    case BLEND_MIX25:
+      return _mm256_mulhi_epu16(_mm256_add_epi16(a, _mm256_add_epi16(b, b)), _mm256_set1_epi16(21846));
+    case BLEND_MIX75:
+      return _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_add_epi16(a, a), b), _mm256_set1_epi16(21846));
+    default: {
+      const __m256i p = _mm256_mullo_epi16(a, b);
+      return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(p, _mm256_set1_epi16(1)), _mm256_srli_epi16(p, 8)),
+                               8);
+    }
+  }
+}
+
+/* blends the RGB components of 8 pixels keeping destination alpha, same results as BlendPixel() */
+TARGET_AVX2 static inline __m256i BlendPixels8(TLN_Blend mode, __m256i src, __m256i dst) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i value;
+
+  switch (mode) {
+    case BLEND_MIX50:
+      value = _mm256_add_epi8(_mm256_and_si256(src, dst),
+                              _mm256_and_si256(_mm256_srli_epi16(_mm256_xor_si256(src, dst), 1),
+                                               _mm256_set1_epi8(0x7F)));
+      break;
+    case BLEND_ADD:
+      value = _mm256_adds_epu8(src, dst);
+      break;
+    case BLEND_SUB:
+      value = _mm256_subs_epu8(src, dst);
+      break;
+    default:
+      value = _mm256_packus_epi16(
+              BlendWords8(mode, _mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero)),
+              BlendWords8(mode, _mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero)));
+      break;
+  }
+  return _mm256_blendv_epi8(value, dst, _mm256_set1_epi32((int) 0xFF000000));
+}
+
+/* scalar remainder shared by the blend blitters */
+#define BLEND_REMAINDER(mode, key, scaling) \
+  while (width) { \
+    const uint32_t src = scaling ? *(srcpixel + (offset >> FIXED_BITS)) : *srcpixel; \
+    if (!key || src) { \
+      *dstpixel = BlendPixel(mode, color[src], *dstpixel); \
+    } \
+    if (scaling) { \
+      offset += dx; \
+    } \
+    else { \
+      srcpixel += dx; \
+    } \
+    dstpixel++; \
+    width--; \
+  }
+
+#define DEFINE_BLEND_BLITTERS_X86(name, mode) \
+TARGET_SSE41 static void \
+blitFast##name##_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                            int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width >= 4) { \
+    const __m128i value = _mm_setr_epi32(color[srcpixel[0]], color[srcpixel[dx]], color[srcpixel[dx * 2]], \
+                                         color[srcpixel[dx * 3]]); \
+    const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel); \
+    _mm_storeu_si128((__m128i *) dstpixel, BlendPixels4(mode, value, dst)); \
+    srcpixel += dx * 4; \
+    dstpixel += 4; \
+    width -= 4; \
+  } \
+  BLEND_REMAINDER(mode, false, false) \
+} \
+\
+TARGET_SSE41 static void \
+blitKey##name##_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                           int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width >= 4) { \
+    const __m128i index = _mm_setr_epi32(srcpixel[0], srcpixel[dx], srcpixel[dx * 2], srcpixel[dx * 3]); \
+    const __m128i mask = _mm_cmpgt_epi32(index, _mm_setzero_si128()); \
+    if (!_mm_testz_si128(mask, mask)) { \
+      const __m128i value = _mm_setr_epi32(color[srcpixel[0]], color[srcpixel[dx]], color[srcpixel[dx * 2]], \
+                                           color[srcpixel[dx * 3]]); \
+      const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel); \
+      _mm_storeu_si128((__m128i *) dstpixel, _mm_blendv_epi8(dst, BlendPixels4(mode, value, dst), mask)); \
+    } \
+    srcpixel += dx * 4; \
+    dstpixel += 4; \
+    width -= 4; \
+  } \
+  BLEND_REMAINDER(mode, true, false) \
+} \
+\
+TARGET_SSE41 static void \
+blitFastScaling##name##_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                                   int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width >= 4) { \
+    const __m128i value = _mm_setr_epi32(color[srcpixel[offset >> FIXED_BITS]], \
+                                         color[srcpixel[(offset + dx) >> FIXED_BITS]], \
+                                         color[srcpixel[(offset + dx * 2) >> FIXED_BITS]], \
+                                         color[srcpixel[(offset + dx * 3) >> FIXED_BITS]]); \
+    const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel); \
+    _mm_storeu_si128((__m128i *) dstpixel, BlendPixels4(mode, value, dst)); \
+    offset += dx * 4; \
+    dstpixel += 4; \
+    width -= 4; \
+  } \
+  BLEND_REMAINDER(mode, false, true) \
+} \
+\
+TARGET_SSE41 static void \
+blitKeyScaling##name##_8_32_sse41(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                                  int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width >= 4) { \
+    const __m128i index = _mm_setr_epi32(srcpixel[offset >> FIXED_BITS], \
+                                         srcpixel[(offset + dx) >> FIXED_BITS], \
+                                         srcpixel[(offset + dx * 2) >> FIXED_BITS], \
+                                         srcpixel[(offset + dx * 3) >> FIXED_BITS]); \
+    const __m128i mask = _mm_cmpgt_epi32(index, _mm_setzero_si128()); \
+    if (!_mm_testz_si128(mask, mask)) { \
+      const __m128i value = _mm_setr_epi32(color[_mm_extract_epi32(index, 0)], color[_mm_extract_epi32(index, 1)], \
+                                           color[_mm_extract_epi32(index, 2)], color[_mm_extract_epi32(index, 3)]); \
+      const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel); \
+      _mm_storeu_si128((__m128i *) dstpixel, _mm_blendv_epi8(dst, BlendPixels4(mode, value, dst), mask)); \
+    } \
+    offset += dx * 4; \
+    dstpixel += 4; \
+    width -= 4; \
+  } \
+  BLEND_REMAINDER(mode, true, true) \
+} \
+\
+TARGET_AVX2 static void \
+blitFast##name##_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                           int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  if (dx == 1 || dx == -1) { \
+    while (width >= 8) { \
+      const __m256i value = _mm256_i32gather_epi32((const int *) color, LoadIndexes8(srcpixel, dx), 4); \
+      const __m256i dst = _mm256_loadu_si256((const __m256i *) dstpixel); \
+      _mm256_storeu_si256((__m256i *) dstpixel, BlendPixels8(mode, value, dst)); \
+      srcpixel += dx * 8; \
+      dstpixel += 8; \
+      width -= 8; \
+    } \
+  } \
+  BLEND_REMAINDER(mode, false, false) \
+} \
+\
+TARGET_AVX2 static void \
+blitKey##name##_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                          int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  const __m256i zero = _mm256_setzero_si256(); \
+  if (dx == 1 || dx == -1) { \
+    while (width >= 8) { \
+      const __m256i index = LoadIndexes8(srcpixel, dx); \
+      const __m256i mask = _mm256_cmpgt_epi32(index, zero); \
+      if (!_mm256_testz_si256(mask, mask)) { \
+        const __m256i value = _mm256_mask_i32gather_epi32(zero, (const int *) color, index, mask, 4); \
+        const __m256i dst = _mm256_loadu_si256((const __m256i *) dstpixel); \
+        _mm256_storeu_si256((__m256i *) dstpixel, _mm256_blendv_epi8(dst, BlendPixels8(mode, value, dst), mask)); \
+      } \
+      srcpixel += dx * 8; \
+      dstpixel += 8; \
+      width -= 8; \
+    } \
+  } \
+  BLEND_REMAINDER(mode, true, false) \
+} \
+\
+TARGET_AVX2 static void \
+blitFastScaling##name##_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                                  int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  while (width >= 8) { \
+    const __m256i value = _mm256_i32gather_epi32((const int *) color, LoadScaledIndexes8(srcpixel, offset, dx), 4); \
+    const __m256i dst = _mm256_loadu_si256((const __m256i *) dstpixel); \
+    _mm256_storeu_si256((__m256i *) dstpixel, BlendPixels8(mode, value, dst)); \
+    offset += dx * 8; \
+    dstpixel += 8; \
+    width -= 8; \
+  } \
+  BLEND_REMAINDER(mode, false, true) \
+} \
+\
+TARGET_AVX2 static void \
+blitKeyScaling##name##_8_32_avx2(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, \
+                                 int offset, uint8_t *blend) { \
+  uint32_t *dstpixel = (uint32_t *) dstptr; \
+  const __m256i zero = _mm256_setzero_si256(); \
+  while (width >= 8) { \
+    const __m256i index = LoadScaledIndexes8(srcpixel, offset, dx); \
+    const __m256i mask = _mm256_cmpgt_epi32(index, zero); \
+    if (!_mm256_testz_si256(mask, mask)) { \
+      const __m256i value = _mm256_mask_i32gather_epi32(zero, (const int *) color, index, mask, 4); \
+      const __m256i dst = _mm256_loadu_si256((const __m256i *) dstpixel); \
+      _mm256_storeu_si256((__m256i *) dstpixel, _mm256_blendv_epi8(dst, BlendPixels8(mode, value, dst), mask)); \
+    } \
+    offset += dx * 8; \
+    dstpixel += 8; \
+    width -= 8; \
+  } \
+  BLEND_REMAINDER(mode, true, true) \
+}
+
+DEFINE_BLEND_BLITTERS_X86(Mix25, BLEND_MIX25)
+DEFINE_BLEND_BLITTERS_X86(Mix50, BLEND_MIX50)
+DEFINE_BLEND_BLITTERS_X86(Mix75, BLEND_MIX75)
+DEFINE_BLEND_BLITTERS_X86(Add, BLEND_ADD)
+DEFINE_BLEND_BLITTERS_X86(Sub, BLEND_SUB)
+DEFINE_BLEND_BLITTERS_X86(Mod, BLEND_MOD)
+
+/* blend blitters by mode, indexed by (key << 1) + scaling */
+static const ScanBlitPtr blend_sse41[MAX_BLEND][4] =
+        {
+                {NULL, NULL, NULL, NULL},
+                {blitFastMix25_8_32_sse41, blitFastScalingMix25_8_32_sse41, blitKeyMix25_8_32_sse41,
+                        blitKeyScalingMix25_8_32_sse41},
+                {blitFastMix50_8_32_sse41, blitFastScalingMix50_8_32_sse41, blitKeyMix50_8_32_sse41,
+                        blitKeyScalingMix50_8_32_sse41},
+                {blitFastMix75_8_32_sse41, blitFastScalingMix75_8_32_sse41, blitKeyMix75_8_32_sse41,
+                        blitKeyScalingMix75_8_32_sse41},
+                {blitFastAdd_8_32_sse41, blitFastScalingAdd_8_32_sse41, blitKeyAdd_8_32_sse41,
+                        blitKeyScalingAdd_8_32_sse41},
+                {blitFastSub_8_32_sse41, blitFastScalingSub_8_32_sse41, blitKeySub_8_32_sse41,
+                        blitKeyScalingSub_8_32_sse41},
+                {blitFastMod_8_32_sse41, blitFastScalingMod_8_32_sse41, blitKeyMod_8_32_sse41,
+                        blitKeyScalingMod_8_32_sse41},
+                {NULL, NULL, NULL, NULL},
+        };
+
+static const ScanBlitPtr blend_avx2[MAX_BLEND][4] =
+        {
+                {NULL, NULL, NULL, NULL},
+                {blitFastMix25_8_32_avx2, blitFastScalingMix25_8_32_avx2, blitKeyMix25_8_32_avx2,
+                        blitKeyScalingMix25_8_32_avx2},
+                {blitFastMix50_8_32_avx2, blitFastScalingMix50_8_32_avx2, blitKeyMix50_8_32_avx2,
+                        blitKeyScalingMix50_8_32_avx2},
+                {blitFastMix75_8_32_avx2, blitFastScalingMix75_8_32_avx2, blitKeyMix75_8_32_avx2,
+                        blitKeyScalingMix75_8_32_avx2},
+                {blitFastAdd_8_32_avx2, blitFastScalingAdd_8_32_avx2, blitKeyAdd_8_32_avx2,
+                        blitKeyScalingAdd_8_32_avx2},
+                {blitFastSub_8_32_avx2, blitFastScalingSub_8_32_avx2, blitKeySub_8_32_avx2,
+                        blitKeyScalingSub_8_32_avx2},
+                {blitFastMod_8_32_avx2, blitFastScalingMod_8_32_avx2, blitKeyMod_8_32_avx2,
+                        blitKeyScalingMod_8_32_avx2},
+                {NULL, NULL, NULL, NULL},
+        };
+
+/* priority overlays: copy non-zero pixels through a coverage mask ------- */
+
+TARGET_SSE41 static void blitOverlay_32_sse41(const uint32_t *srcpixel, uint32_t *dstpixel, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  while (width >= 4) {
+    const __m128i src = _mm_loadu_si128((const __m128i *) srcpixel);
+    const __m128i empty = _mm_cmpeq_epi32(src, zero);
+    if (_mm_movemask_epi8(empty) != 0xFFFF) {
+      const __m128i dst = _mm_loadu_si128((const __m128i *) dstpixel);
+      _mm_storeu_si128((__m128i *) dstpixel, _mm_blendv_epi8(src, dst, empty));
+    }
+    srcpixel += 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = *srcpixel;
+    }
+    srcpixel++;
+    dstpixel++;
+    width--;
+  }
+}
+
+TARGET_AVX2 static void blitOverlay_32_avx2(const uint32_t *srcpixel, uint32_t *dstpixel, int width) {
+  const __m256i zero = _mm256_setzero_si256();
+  while (width >= 8) {
+    const __m256i src = _mm256_loadu_si256((const __m256i *) srcpixel);
+    const __m256i empty = _mm256_cmpeq_epi32(src, zero);
+    if (_mm256_movemask_epi8(empty) != -1) {
+      const __m256i dst = _mm256_loadu_si256((const __m256i *) dstpixel);
+      _mm256_storeu_si256((__m256i *) dstpixel, _mm256_blendv_epi8(src, dst, empty));
+    }
+    srcpixel += 8;
+    dstpixel += 8;
+    width -= 8;
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = *srcpixel;
+    }
+    srcpixel++;
+    dstpixel++;
+    width--;
+  }
+}
+
+/* mosaic spans: blend non-zero pixels with a built-in mode --------------- */
+
+TARGET_SSE41 static int blitOverlayBlend_32_sse41(const uint32_t *srcpixel, uint32_t *dstpixel, int width,
+                                                  TLN_Blend mode) {
+  const __m128i zero = _mm_setzero_si128();
+  int done = 0;
+
+  while (width - done >= 4) {
+    const __m128i src = _mm_loadu_si128((const __m128i *) (srcpixel + done));
+    const __m128i empty = _mm_cmpeq_epi32(src, zero);
+    if (_mm_movemask_epi8(empty) != 0xFFFF) {
+      const __m128i dst = _mm_loadu_si128((const __m128i *) (dstpixel + done));
+      _mm_storeu_si128((__m128i *) (dstpixel + done), _mm_blendv_epi8(BlendPixels4(mode, src, dst), dst, empty));
+    }
+    done += 4;
+  }
+  return done;
+}
+
+TARGET_AVX2 static int blitOverlayBlend_32_avx2(const uint32_t *srcpixel, uint32_t *dstpixel, int width,
+                                                TLN_Blend mode) {
+  const __m256i zero = _mm256_setzero_si256();
+  int done = 0;
+
+  while (width - done >= 8) {
+    const __m256i src = _mm256_loadu_si256((const __m256i *) (srcpixel + done));
+    const __m256i empty = _mm256_cmpeq_epi32(src, zero);
+    if (_mm256_movemask_epi8(empty) != -1) {
+      const __m256i dst = _mm256_loadu_si256((const __m256i *) (dstpixel + done));
+      _mm256_storeu_si256((__m256i *) (dstpixel + done),
+                          _mm256_blendv_epi8(BlendPixels8(mode, src, dst), dst, empty));
+    }
+    done += 8;
+  }
+  return done;
+}
+
+/* lowest set bit, to pick the palette of the first pending lane */
+static inline int LowestBit(unsigned int mask) {
+#if defined _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int) index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+/* wraps 8 fixed point coordinates that are at most one size out of [0, size) */
+TARGET_AVX2 static inline __m256i WrapAffine8(__m256i value, fix_t size, fix_t mask) {
+  const __m256i vsize = _mm256_set1_epi32(size);
+  if (mask != 0) {
+    return _mm256_and_si256(value, _mm256_set1_epi32(mask));
+  }
+  value = _mm256_add_epi32(value, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), value), vsize));
+  return _mm256_sub_epi32(value, _mm256_andnot_si256(_mm256_cmpgt_epi32(vsize, value), vsize));
+}
+
+/*
+ * draws 8 pixels of the span at layer positions: tiles, tileset entries and pixels are gathered per lane
+ * and resolved through the palette of each tile. Built-in blend modes only
+ */
+TARGET_AVX2 static inline void DrawSpanPixels8(const AffineSpan *span, __m256i xpos, __m256i ypos,
+                                               uint32_t *dstpixel) {
+  const __m128i hshift = _mm_cvtsi32_si128(span->hshift);
+  const __m128i vshift = _mm_cvtsi32_si128(span->vshift);
+  const __m256i hmask = _mm256_set1_epi32((1 << span->hshift) - 1);
+  const __m256i vmask = _mm256_set1_epi32((1 << span->vshift) - 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srl_epi32(ypos, vshift),
+                                                             _mm256_set1_epi32(span->cols)),
+                                          _mm256_srl_epi32(xpos, hshift));
+  const int first = _mm256_cvtsi256_si32(offset);
+  const bool single = _mm256_movemask_epi8(_mm256_cmpeq_epi32(offset, _mm256_set1_epi32(first))) == -1;
+  __m256i tile, active, entry;
+
+  /* lanes usually share a tile unless the layer is scaled down */
+  if (single) {
+    const Tile value = span->tiles[first];
+    tile = _mm256_set1_epi32((int) value.value);
+    active = _mm256_set1_epi32(value.index != 0 ? -1 : 0);
+    entry = _mm256_set1_epi32(value.index != 0 ? span->indexes[value.index] : 0);
+  }
+  else {
+    const __m256i value = _mm256_i32gather_epi32((const int *) span->tiles, offset, 4);
+    const __m256i index = _mm256_and_si256(value, _mm256_set1_epi32(0xFFFF));
+    tile = value;
+    active = _mm256_xor_si256(_mm256_cmpeq_epi32(index, zero), _mm256_set1_epi32(-1));
+    /* the entry is the high half of the 32 bit word ending at indexes[index], index is at least 1 */
+    entry = _mm256_srli_epi32(
+            _mm256_mask_i32gather_epi32(zero, (const int *) (span->indexes - 1), index, active, 2), 16);
+  }
+
+  if (!_mm256_testz_si256(active, active)) {
+    const __m256i srcx = _mm256_xor_si256(_mm256_and_si256(xpos, hmask),
+                                          _mm256_and_si256(_mm256_srai_epi32(tile, 31), hmask));
+    const __m256i srcy = _mm256_xor_si256(_mm256_and_si256(ypos, vmask),
+                                          _mm256_and_si256(_mm256_srai_epi32(_mm256_slli_epi32(tile, 1), 31),
+                                                           vmask));
+    const __m256i pixel_offset = _mm256_add_epi32(
+            _mm256_sll_epi32(_mm256_add_epi32(_mm256_sll_epi32(entry, vshift), srcy), hshift), srcx);
+    /* the pixel is the top byte of the 32 bit word ending at it */
+    const __m256i pixel = _mm256_srli_epi32(
+            _mm256_mask_i32gather_epi32(zero, (const int *) (span->pixels - 3), pixel_offset, active, 1), 24);
+    const __m256i opaque = _mm256_cmpgt_epi32(pixel, zero);
+    unsigned int pending = (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(opaque));
+
+    if (pending != 0) {
+      const __m256i palette = _mm256_and_si256(_mm256_srli_epi32(tile, 16), _mm256_set1_epi32(FLAG_PALETTES));
+      __m256i value = zero;
+
+      /* one gather per distinct palette in the group, usually just one */
+      while (pending != 0) {
+        const __m256i id = _mm256_permutevar8x32_epi32(palette, _mm256_set1_epi32(LowestBit(pending)));
+        const __m256i lanes_palette = _mm256_and_si256(_mm256_cmpeq_epi32(palette, id), opaque);
+        const int palette_id = _mm256_cvtsi256_si32(id);
+        const int *color = (const int *) span->palettes[palette_id]->data;
+
+        value = _mm256_mask_i32gather_epi32(value, color, pixel, lanes_palette, 4);
+        pending &= ~(unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(lanes_palette));
+      }
+
+      if (span->blend_mode != BLEND_NONE) {
+        value = BlendPixels8(span->blend_mode, value, _mm256_loadu_si256((const __m256i *) dstpixel));
+      }
+      _mm256_maskstore_epi32((int *) dstpixel, opaque, value);
+    }
+  }
+}
+
+/*
+ * affine span, 8 pixels per iteration. Returns 0 for BLEND_CUSTOM, and for non power of two layers
+ * stepping so fast that 8 pixels can cross the layer more than once
+ */
+TARGET_AVX2 static int blitAffine_32_avx2(AffineSpan *span, uint32_t *dstpixel, int width) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i dx = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span->dx));
+  const __m256i dy = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span->dy));
+  int done = 0;
+
+  if (span->blend_mode == BLEND_CUSTOM) {
+    return 0;
+  }
+  if (span->xmask == 0 && (abs(span->dx) >= span->width / 8 || span->width > INT_MAX / 2)) {
+    return 0;
+  }
+  if (span->ymask == 0 && (abs(span->dy) >= span->height / 8 || span->height > INT_MAX / 2)) {
+    return 0;
+  }
+
+  while (width - done >= 8) {
+    const __m256i xpos = _mm256_srai_epi32(
+            WrapAffine8(_mm256_add_epi32(_mm256_set1_epi32(span->x), dx), span->width, span->xmask), FIXED_BITS);
+    const __m256i ypos = _mm256_srai_epi32(
+            WrapAffine8(_mm256_add_epi32(_mm256_set1_epi32(span->y), dy), span->height, span->ymask), FIXED_BITS);
+
+    DrawSpanPixels8(span, xpos, ypos, dstpixel + done);
+    span->x = WrapAffine((fix_t) ((uint32_t) span->x + 8u * (uint32_t) span->dx), span->width, span->xmask);
+    span->y = WrapAffine((fix_t) ((uint32_t) span->y + 8u * (uint32_t) span->dy), span->height, span->ymask);
+    done += 8;
+  }
+  return done;
+}
+
+/* pixel mapped span, 8 pixels per iteration. Returns 0 for BLEND_CUSTOM */
+TARGET_AVX2 static int blitPixelMap_32_avx2(const AffineSpan *span, const int *xpos, const int *ypos,
+                                            uint32_t *dstpixel, int width) {
+  int done = 0;
+
+  if (span->blend_mode == BLEND_CUSTOM) {
+    return 0;
+  }
+
+  while (width - done >= 8) {
+    DrawSpanPixels8(span, _mm256_loadu_si256((const __m256i *) (xpos + done)),
+                    _mm256_loadu_si256((const __m256i *) (ypos + done)), dstpixel + done);
+    done += 8;
+  }
+  return done;
+}
+
+/* collision buffer: sprite ids under opaque pixels ------------------------ */
+
+/*
+ * Each group of pixels is compared against the sprite of the current run. Groups that only cover that
+ * sprite add to per lane counters, summed when the run ends. A group covering a single new sprite starts a
+ * run over it, and groups covering several sprites are counted pixel by pixel.
+ */
+
+/* counts the pixels of a group over other sprites one by one, returns the last sprite covered */
+static inline int CountOverlapPixels(const uint8_t *srcpixel, const uint16_t *dstpixel, int width,
+                                     OverlapCounts *overlap) {
+  int other = 0xFFFF;
+  int x;
+
+  for (x = 0; x < width; x++) {
+    if (srcpixel[x] && dstpixel[x] != 0xFFFF) {
+      other = dstpixel[x];
+      AddOverlap(overlap, other, 1);
+    }
+  }
+  return other;
+}
+
+TARGET_SSE41 static inline int SumLanes8(__m128i value) {
+  value = _mm_madd_epi16(value, _mm_set1_epi16(1));
+  value = _mm_hadd_epi32(value, value);
+  value = _mm_hadd_epi32(value, value);
+  return _mm_cvtsi128_si32(value);
+}
+
+TARGET_AVX2 static inline int SumLanes16(__m256i value) {
+  const __m256i sum = _mm256_madd_epi16(value, _mm256_set1_epi16(1));
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  half = _mm_hadd_epi32(half, half);
+  half = _mm_hadd_epi32(half, half);
+  return _mm_cvtsi128_si32(half);
+}
+
+TARGET_SSE41 static int blitCollision_sse41(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int nsprite,
+                                            OverlapCounts *overlap) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i none = _mm_set1_epi16(-1);
+  const __m128i id = _mm_set1_epi16((short) nsprite);
+  __m128i run = zero;
+  int other = 0xFFFF;
+  int done = 0;
+
+  while (width - done >= 8) {
+    const __m128i src = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (srcpixel + done)));
+    const __m128i empty = _mm_cmpeq_epi16(src, zero);
+    const __m128i dst = _mm_loadu_si128((const __m128i *) (dstpixel + done));
+    const __m128i under = _mm_or_si128(dst, empty);
+    const int covered = _mm_movemask_epi8(_mm_cmpeq_epi16(under, none)) ^ 0xFFFF;
+    if (covered != 0) {
+      __m128i same = _mm_cmpeq_epi16(under, _mm_set1_epi16((short) other));
+      if (_mm_movemask_epi8(same) != covered) {
+        AddOverlap(overlap, other, SumLanes8(run));
+        run = zero;
+        other = dstpixel[done + (LowestBit(covered) >> 1)];
+        same = _mm_cmpeq_epi16(under, _mm_set1_epi16((short) other));
+        if (_mm_movemask_epi8(same) != covered) {
+          other = CountOverlapPixels(srcpixel + done, dstpixel + done, 8, overlap);
+          same = zero;
+        }
+      }
+      run = _mm_sub_epi16(run, same);
+    }
+    _mm_storeu_si128((__m128i *) (dstpixel + done), _mm_blendv_epi8(id, dst, empty));
+    done += 8;
+  }
+  AddOverlap(overlap, other, SumLanes8(run));
+  return done;
+}
+
+TARGET_AVX2 static int blitCollision_avx2(const uint8_t *srcpixel, uint16_t *dstpixel, int width, int nsprite,
+                                          OverlapCounts *overlap) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i none = _mm256_set1_epi16(-1);
+  const __m256i id = _mm256_set1_epi16((short) nsprite);
+  __m256i run = zero;
+  int other = 0xFFFF;
+  int done = 0;
+
+  while (width - done >= 16) {
+    const __m256i src = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (srcpixel + done)));
+    const __m256i empty = _mm256_cmpeq_epi16(src, zero);
+    const __m256i dst = _mm256_loadu_si256((const __m256i *) (dstpixel + done));
+    const __m256i under = _mm256_or_si256(dst, empty);
+    const unsigned int covered = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi16(under, none));
+    if (covered != 0) {
+      __m256i same = _mm256_cmpeq_epi16(under, _mm256_set1_epi16((short) other));
+      if ((unsigned int) _mm256_movemask_epi8(same) != covered) {
+        AddOverlap(overlap, other, SumLanes16(run));
+        run = zero;
+        other = dstpixel[done + (LowestBit(covered) >> 1)];
+        same = _mm256_cmpeq_epi16(under, _mm256_set1_epi16((short) other));
+        if ((unsigned int) _mm256_movemask_epi8(same) != covered) {
+          other = CountOverlapPixels(srcpixel + done, dstpixel + done, 16, overlap);
+          same = zero;
+        }
+      }
+      run = _mm256_sub_epi16(run, same);
+    }
+    _mm256_storeu_si256((__m256i *) (dstpixel + done), _mm256_blendv_epi8(id, dst, empty));
+    done += 16;
+  }
+  AddOverlap(overlap, other, SumLanes16(run));
+  return done;
+}
+
+#endif
+
+#if defined SIMD_NEON
+
+/* NEON blitters: 8 pixels per iteration ---------------------------------- */
+
+/* loads 8 consecutive palette indexes, walking backwards when dx is negative */
+static inline uint8x8_t LoadIndexes8(const uint8_t *srcpixel, int dx) {
+  if (dx > 0) {
+    return vld1_u8(srcpixel);
+  }
+  return vrev64_u8(vld1_u8(srcpixel - 7));
+}
+
+static void
+blitFast_8_32_neon(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                   uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  if (dx == 1 || dx == -1) {
+    while (width >= 8) {
+      uint8_t index[8];
+      uint32_t value[8];
+      int c;
+
+      vst1_u8(index, LoadIndexes8(srcpixel, dx));
+      for (c = 0; c < 8; c++) {
+        value[c] = color[index[c]];
+      }
+      vst1q_u32(dstpixel, vld1q_u32(value));
+      vst1q_u32(dstpixel + 4, vld1q_u32(value + 4));
+      srcpixel += dx * 8;
+      dstpixel += 8;
+      width -= 8;
+    }
+  }
+  while (width) {
+    *dstpixel++ = color[*srcpixel];
+    srcpixel += dx;
+    width--;
+  }
+}
+
+static void
+blitKey_8_32_neon(uint8_t *srcpixel, const uint32_t *color, void *dstptr, int width, int dx, int offset,
+                  uint8_t *blend) {
+  uint32_t *dstpixel = (uint32_t *) dstptr;
+  if (dx == 1 || dx == -1) {
+    while (width >= 8) {
+      const uint8x8_t bytes = LoadIndexes8(srcpixel, dx);
+      if (vget_lane_u64(vreinterpret_u64_u8(bytes), 0) != 0) {
+        const uint16x8_t wide = vmovl_u8(bytes);
+        const uint32x4_t index_lo = vmovl_u16(vget_low_u16(wide));
+        const uint32x4_t index_hi = vmovl_u16(vget_high_u16(wide));
+        uint8_t index[8];
+        uint32_t value[8];
+        int c;
+
+        vst1_u8(index, bytes);
+        for (c = 0; c < 8; c++) {
+          value[c] = color[index[c]];
+        }
+        vst1q_u32(dstpixel, vbslq_u32(vtstq_u32(index_lo, index_lo), vld1q_u32(value), vld1q_u32(dstpixel)));
+        vst1q_u32(dstpixel + 4,
+                  vbslq_u32(vtstq_u32(index_hi, index_hi), vld1q_u32(value + 4), vld1q_u32(dstpixel + 4)));
+      }
+      srcpixel += dx * 8;
+      dstpixel += 8;
+      width -= 8;
+    }
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = color[*srcpixel];
+    }
+    srcpixel += dx;
+    dstpixel++;
+    width--;
+  }
+}
+
+static void blitOverlay_32_neon(const uint32_t *srcpixel, uint32_t *dstpixel, int width) {
+  while (width >= 4) {
+    const uint32x4_t src = vld1q_u32(srcpixel);
+    vst1q_u32(dstpixel, vbslq_u32(vtstq_u32(src, src), src, vld1q_u32(dstpixel)));
+    srcpixel += 4;
+    dstpixel += 4;
+    width -= 4;
+  }
+  while (width) {
+    if (*srcpixel) {
+      *dstpixel = *srcpixel;
+    }
+    srcpixel++;
+    dstpixel++;
+    width--;
+  }
+}
+
+#endif
+
+/* returns the best instruction set extension supported by the running CPU */
+simd_t DetectSIMD(void) {
+#if defined SIMD_X86 && defined __GNUC__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return SIMD_SSE41;
+  }
+  return SIMD_NONE;
+#elif defined SIMD_X86
+  int info[4];
+  int maxleaf;
+  bool sse41, avx;
+
+  __cpuid(info, 0);
+  maxleaf = info[0];
+  __cpuid(info, 1);
+  sse41 = (info[2] & (1 << 19)) != 0;
+  avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+  if (avx && maxleaf >= 7) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5)) {
+      return SIMD_AVX2;
+    }
+  }
+  return sse41 ? SIMD_SSE41 : SIMD_NONE;
+#elif defined SIMD_NEON
+  return SIMD_NEON;
+#else
+  return SIMD_NONE;
+#endif
+}
+
+/*
+ * returns the 8 to 32 bpp blitter for the given instruction set and blend mode, or NULL if only scalar is
+ * available. BLEND_CUSTOM always uses the scalar table blitters
+ */
+ScanBlitPtr GetSIMDBlitter(simd_t simd, bool key, bool scaling, TLN_Blend mode) {
+  if (mode == BLEND_CUSTOM) {
+    return NULL;
+  }
+
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      if (mode != BLEND_NONE) {
+        return blend_avx2[mode][(key << 1) + scaling];
+      }
+      if (scaling) {
+        return key ? blitKeyScaling_8_32_avx2 : blitFastScaling_8_32_avx2;
+      }
+      return key ? blitKey_8_32_avx2 : blitFast_8_32_avx2;
+
+    case SIMD_SSE41:
+      if (mode != BLEND_NONE) {
+        return blend_sse41[mode][(key << 1) + scaling];
+      }
+      if (scaling) {
+        return key ? blitKeyScaling_8_32_sse41 : blitFastScaling_8_32_sse41;
+      }
+      return key ? blitKey_8_32_sse41 : blitFast_8_32_sse41;
+#endif
+
+#if defined SIMD_NEON
+    case SIMD_NEON:
+      if (scaling || mode != BLEND_NONE) {
+        return NULL;
+      }
+      return key ? blitKey_8_32_neon : blitFast_8_32_neon;
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+/* returns the priority overlay blitter for the given instruction set, or NULL if only scalar is available */
+OverlayBlitPtr GetSIMDOverlayBlitter(simd_t simd) {
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      return blitOverlay_32_avx2;
+
+    case SIMD_SSE41:
+      return blitOverlay_32_sse41;
+#endif
+
+#if defined SIMD_NEON
+    case SIMD_NEON:
+      return blitOverlay_32_neon;
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+/* returns the blending overlay blitter for the given instruction set, or NULL if only scalar is available */
+OverlayBlendBlitPtr GetSIMDOverlayBlendBlitter(simd_t simd) {
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      return blitOverlayBlend_32_avx2;
+
+    case SIMD_SSE41:
+      return blitOverlayBlend_32_sse41;
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+AffineBlitPtr GetSIMDAffineBlitter(simd_t simd) {
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      return blitAffine_32_avx2;
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+MapBlitPtr GetSIMDPixelMapBlitter(simd_t simd) {
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      return blitPixelMap_32_avx2;
+#endif
+
+    default:
+      return NULL;
+  }
+}
+
+CollisionBlitPtr GetSIMDCollisionBlitter(simd_t simd) {
+  switch (simd) {
+#if defined SIMD_X86
+    case SIMD_AVX2:
+      return blitCollision_avx2;
+
+    case SIMD_SSE41:
+      return blitCollision_sse41;
+#endif
+
+    default:
+      return NULL;
+  }
+}
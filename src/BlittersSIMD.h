@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#ifndef BLITTERS_SIMD_H
+#define BLITTERS_SIMD_H
+
+#include "tiledjinn.h"
+#include "Blitters.h"
+
+/* instruction set extensions usable by the blitters */
+typedef enum {
+    SIMD_NONE,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_NEON,
+} simd_t;
+
+simd_t DetectSIMD(void);
+
+ScanBlitPtr GetSIMDBlitter(simd_t simd, bool key, bool scaling, TLN_Blend mode);
+
+OverlayBlitPtr GetSIMDOverlayBlitter(simd_t simd);
+
+OverlayBlendBlitPtr GetSIMDOverlayBlendBlitter(simd_t simd);
+
+AffineBlitPtr GetSIMDAffineBlitter(simd_t simd);
+
+MapBlitPtr GetSIMDPixelMapBlitter(simd_t simd);
+
+CollisionBlitPtr GetSIMDCollisionBlitter(simd_t simd);
+
+#endif
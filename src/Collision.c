@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Sprite vs sprite collision. Before drawing, a sweep over the sprite rectangles finds the pairs of sprites
+ * with collision that overlap, and gives each pair an index. While drawing, each render thread counts the
+ * pixels a sprite covers of each other sprite in runs, then finds the pair of every sprite covered from
+ * their positions in the sweep, and adds the pixels to its own array indexed by pair. The counts are moved
+ * to a list of unique pairs at the end of the band, or when the sweep runs again mid-frame, and the lists
+ * of all threads are merged into the one of the context.
+ * Sprite vs layer collision is kept apart, as a mask of layers per sprite merged the same way.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "Collision.h"
+#include "Engine.h"
+
+#define COLLISION_LIST_SIZE  64  /* initial capacity */
+#define BROADPHASE_SIZE    64  /* initial pairs */
+
+static int GetCollisionSlot(const CollisionList *list, int sprite1, int sprite2) {
+  uint32_t hash = ((uint32_t) sprite1 << 16 | (uint32_t) sprite2) * 0x9E3779B1u;
+  return (int) ((hash ^ hash >> 15) & (list->numslots - 1));
+}
+
+/* fills the hash with the items of the list */
+static void HashCollisionList(CollisionList *list) {
+  int c;
+
+  memset(list->slots, -1, list->numslots * sizeof(int));
+  for (c = 0; c < list->count; c++) {
+    int slot = GetCollisionSlot(list, list->items[c].sprite1, list->items[c].sprite2);
+    while (list->slots[slot] != -1) {
+      slot = (slot + 1) & (list->numslots - 1);
+    }
+    list->slots[slot] = c;
+  }
+  list->hashed = true;
+}
+
+static bool ResizeCollisionList(CollisionList *list, int capacity) {
+  TLN_SpriteCollision *items = (TLN_SpriteCollision *) realloc(list->items, capacity * sizeof(TLN_SpriteCollision));
+  int *slots;
+
+  if (items == NULL) {
+    return false;
+  }
+  list->items = items;
+  slots = (int *) malloc(capacity * 2 * sizeof(int));
+  if (slots == NULL) {
+    return false;
+  }
+
+  free(list->slots);
+  list->slots = slots;
+  list->numslots = capacity * 2;
+  list->capacity = capacity;
+  HashCollisionList(list);
+  return true;
+}
+
+bool CreateCollisionList(CollisionList *list) {
+  memset(list, 0, sizeof(CollisionList));
+  return ResizeCollisionList(list, COLLISION_LIST_SIZE);
+}
+
+void DeleteCollisionList(CollisionList *list) {
+  free(list->items);
+  free(list->slots);
+  memset(list, 0, sizeof(CollisionList));
+}
+
+void ClearCollisionList(CollisionList *list) {
+  if (list->count > 0) {
+    list->count = 0;
+    list->hashed = false;
+  }
+}
+
+/*
+ * adds pixels where two sprites touched from a given scanline. A new pair is appended, a known one keeps
+ * the first scanline and adds the pixels. Pairs found when the list can't grow are dropped
+ */
+void AddCollision(CollisionList *list, int sprite1, int sprite2, int line, int pixels) {
+  TLN_SpriteCollision *item;
+  int slot;
+
+  if (sprite1 > sprite2) {
+    const int swap = sprite1;
+    sprite1 = sprite2;
+    sprite2 = swap;
+  }
+
+  if (!list->hashed) {
+    HashCollisionList(list);
+  }
+  slot = GetCollisionSlot(list, sprite1, sprite2);
+  while (list->slots[slot] != -1) {
+    item = &list->items[list->slots[slot]];
+    if (item->sprite1 == sprite1 && item->sprite2 == sprite2) {
+      item->pixels += pixels;
+      if (line < item->line) {
+        item->line = line;
+      }
+      return;
+    }
+    slot = (slot + 1) & (list->numslots - 1);
+  }
+
+  if (list->count == list->capacity) {
+    if (!ResizeCollisionList(list, list->capacity * 2)) {
+      return;
+    }
+    slot = GetCollisionSlot(list, sprite1, sprite2);
+    while (list->slots[slot] != -1) {
+      slot = (slot + 1) & (list->numslots - 1);
+    }
+  }
+
+  item = &list->items[list->count];
+  item->sprite1 = sprite1;
+  item->sprite2 = sprite2;
+  item->line = line;
+  item->pixels = pixels;
+  list->slots[slot] = list->count;
+  list->count += 1;
+}
+
+/* adds a pair known not to be in the list yet, without looking it up. The hash is rebuilt when needed */
+void AppendCollision(CollisionList *list, int sprite1, int sprite2, int line, int pixels) {
+  TLN_SpriteCollision *item;
+
+  if (list->count == list->capacity && !ResizeCollisionList(list, list->capacity * 2)) {
+    return;
+  }
+
+  item = &list->items[list->count];
+  item->sprite1 = sprite1 < sprite2 ? sprite1 : sprite2;
+  item->sprite2 = sprite1 < sprite2 ? sprite2 : sprite1;
+  item->line = line;
+  item->pixels = pixels;
+  list->count += 1;
+  list->hashed = false;
+}
+
+void MergeCollisionList(CollisionList *list, const CollisionList *source) {
+  int c;
+
+  for (c = 0; c < source->count; c++) {
+    const TLN_SpriteCollision *item = &source->items[c];
+    AddCollision(list, item->sprite1, item->sprite2, item->line, item->pixels);
+  }
+}
+
+/* order of the pairs: by first scanline, then by sprites */
+static inline uint64_t GetCollisionOrder(const TLN_SpriteCollision *item) {
+  return (uint64_t) (uint32_t) item->line << 32 | (uint32_t) item->sprite1 << 16 | (uint32_t) item->sprite2;
+}
+
+/*
+ * sorts the pairs by first scanline, then by sprites, so the order doesn't depend on the render threads. The
+ * workers add the pairs by scanline, so only the ones that first touched on the same scanline move
+ */
+void SortCollisionList(CollisionList *list) {
+  bool moved = false;
+  int c, n;
+
+  for (c = 1; c < list->count; c++) {
+    const TLN_SpriteCollision item = list->items[c];
+    const uint64_t order = GetCollisionOrder(&item);
+    for (n = c; n > 0 && order < GetCollisionOrder(&list->items[n - 1]); n--) {
+      list->items[n] = list->items[n - 1];
+      moved = true;
+    }
+    list->items[n] = item;
+  }
+  if (moved) {
+    list->hashed = false;
+  }
+}
+
+static bool ResizeBroadphase(Broadphase *broadphase, int capacity) {
+  uint32_t *pairs = (uint32_t *) realloc(broadphase->pairs, capacity * sizeof(uint32_t));
+
+  if (pairs == NULL) {
+    return false;
+  }
+  broadphase->pairs = pairs;
+  broadphase->capacity = capacity;
+  return true;
+}
+
+static bool ResizeNeighbors(Broadphase *broadphase, int capacity) {
+  int *neighbors = (int *) realloc(broadphase->neighbors, capacity * sizeof(int));
+
+  if (neighbors == NULL) {
+    return false;
+  }
+  broadphase->neighbors = neighbors;
+  broadphase->neighbor_capacity = capacity;
+  return true;
+}
+
+bool CreateBroadphase(Broadphase *broadphase, int numsprites) {
+  memset(broadphase, 0, sizeof(Broadphase));
+  broadphase->keys = (uint32_t *) malloc((numsprites + 1) * sizeof(uint32_t));
+  broadphase->scratch = (uint32_t *) malloc((numsprites + 1) * sizeof(uint32_t));
+  broadphase->rects = (rect_t *) malloc((numsprites + 1) * sizeof(rect_t));
+  broadphase->position = (int *) calloc(numsprites + 1, sizeof(int));
+  broadphase->count = (int *) calloc(numsprites + 1, sizeof(int));
+  broadphase->first = (int *) calloc(numsprites + 2, sizeof(int));
+  if (broadphase->keys == NULL || broadphase->scratch == NULL || broadphase->rects == NULL ||
+      broadphase->position == NULL || broadphase->count == NULL || broadphase->first == NULL) {
+    return false;
+  }
+  return ResizeBroadphase(broadphase, BROADPHASE_SIZE) && ResizeNeighbors(broadphase, BROADPHASE_SIZE);
+}
+
+void DeleteBroadphase(Broadphase *broadphase) {
+  free(broadphase->keys);
+  free(broadphase->scratch);
+  free(broadphase->rects);
+  free(broadphase->position);
+  free(broadphase->count);
+  free(broadphase->first);
+  free(broadphase->neighbors);
+  free(broadphase->pairs);
+  memset(broadphase, 0, sizeof(Broadphase));
+}
+
+/* makes room in the counts of the workers for all the pairs of the broadphase */
+static bool ResizeCollisionCounts(Engine *context) {
+  const int capacity = context->broadphase.capacity;
+  int c;
+
+  for (c = 0; c < context->numworkers; c++) {
+    Worker *worker = &context->workers[c];
+    CollisionCount *counts;
+    int *touched;
+    if (worker->num_pair_counts >= capacity) {
+      continue;
+    }
+    counts = (CollisionCount *) realloc(worker->pair_counts, capacity * sizeof(CollisionCount));
+    if (counts == NULL) {
+      return false;
+    }
+    memset(counts + worker->num_pair_counts, 0, (capacity - worker->num_pair_counts) * sizeof(CollisionCount));
+    worker->pair_counts = counts;
+    touched = (int *) realloc(worker->touched_pairs, capacity * sizeof(int));
+    if (touched == NULL) {
+      return false;
+    }
+    worker->touched_pairs = touched;
+    worker->num_pair_counts = capacity;
+  }
+  return true;
+}
+
+/* stable counting sort of the keys by the byte at shift, from source to dest */
+static void SortKeysByte(const uint32_t *source, uint32_t *dest, int numkeys, int shift) {
+  int start[256] = {0};
+  int c, sum = 0;
+
+  for (c = 0; c < numkeys; c++) {
+    start[(source[c] >> shift) & 0xFF] += 1;
+  }
+  for (c = 0; c < 256; c++) {
+    const int count = start[c];
+    start[c] = sum;
+    sum += count;
+  }
+  for (c = 0; c < numkeys; c++) {
+    dest[start[(source[c] >> shift) & 0xFF]++] = source[c];
+  }
+}
+
+/* sorts the keys by left edge, a byte at a time. Sprites on the same column stay in drawing order */
+static void SortKeys(Broadphase *broadphase, int numkeys, uint32_t highest) {
+  SortKeysByte(broadphase->scratch, broadphase->keys, numkeys, 16);
+  if (highest >= 1u << 24) {
+    uint32_t *keys = broadphase->keys;
+    SortKeysByte(keys, broadphase->scratch, numkeys, 24);
+    broadphase->keys = broadphase->scratch;
+    broadphase->scratch = keys;
+  }
+}
+
+/*
+ * finds the overlapping pairs, and marks their sprites to write the collision buffer. The rectangles are read
+ * in key order, and a pair is written before knowing if it overlaps, so the inner loop doesn't branch on it.
+ * Each sprite keeps the pairs with the ones it was tested against, so the pair of two sprites is found by
+ * their positions in keys, see GetCandidatePair()
+ */
+static bool FindCandidatePairs(Engine *context, int numkeys) {
+  Broadphase *broadphase = &context->broadphase;
+  const uint32_t *keys = broadphase->keys;
+  const rect_t *rects = broadphase->rects;
+  int *count = broadphase->count;
+  int numneighbors = 0;
+  int numpairs = 0;
+  int c, n;
+
+  for (c = 0; c < numkeys; c++) {
+    const int sprite1 = keys[c] & 0xFFFF;
+    const rect_t rect = rects[c];
+    int found = 0;
+    int *neighbors;
+
+    /* room for the pair with every sprite to the right */
+    if (numpairs + numkeys > broadphase->capacity && !ResizeBroadphase(broadphase, 2 * (numpairs + numkeys))) {
+      return false;
+    }
+    if (numneighbors + numkeys > broadphase->neighbor_capacity &&
+        !ResizeNeighbors(broadphase, 2 * (numneighbors + numkeys))) {
+      return false;
+    }
+    neighbors = broadphase->neighbors;
+    broadphase->first[c] = numneighbors;
+    broadphase->position[sprite1] = c;
+    for (n = c + 1; n < numkeys && rects[n].x1 < rect.x2; n++) {
+      const int sprite2 = keys[n] & 0xFFFF;
+      const int overlap = rects[n].y1 < rect.y2 && rects[n].y2 > rect.y1;
+      broadphase->pairs[numpairs] = (uint32_t) sprite1 << 16 | (uint32_t) sprite2;
+      neighbors[numneighbors++] = overlap ? numpairs : -1;
+      numpairs += overlap;
+      count[sprite2] += overlap;
+      found += overlap;
+    }
+    count[sprite1] += found;
+  }
+  broadphase->first[numkeys] = numneighbors;
+  broadphase->numpairs = numpairs;
+
+  for (c = 0; c < numkeys; c++) {
+    n = keys[c] & 0xFFFF;
+    if (count[n] > 0) {
+      context->sprites[n].collide |= COLLIDE_SPRITES;
+    }
+  }
+  return ResizeCollisionCounts(context);
+}
+
+/*
+ * Broadphase of the pixel collision, run before drawing when sprites with collision change. Sweeps the
+ * rectangles of the sprites on screen sorted by their left edge. Without memory for the pairs, no sprite
+ * collides.
+ */
+void SweepSpriteCollisions(Engine *context) {
+  Broadphase *broadphase = &context->broadphase;
+  uint32_t *keys;
+  uint32_t highest = 0;
+  int numkeys = 0;
+  int c, n;
+
+  /* the rectangles are clipped to the framebuffer, so the left edge fits the upper half of the sort key */
+  for (n = context->sprite_order.first; n != -1; n = context->sprite_info[n].next) {
+    const SpriteInfo *info = &context->sprite_info[n];
+    context->sprites[n].collide &= ~COLLIDE_SPRITES;
+    if (info->do_collision && info->bucket1 <= info->bucket2) {
+      const uint32_t key = (uint32_t) context->sprites[n].dstrect.x1 << 16 | (uint32_t) n;
+      broadphase->scratch[numkeys++] = key;
+      highest |= key;
+      broadphase->count[n] = 0;
+    }
+  }
+  SortKeys(broadphase, numkeys, highest);
+  keys = broadphase->keys;
+  for (c = 0; c < numkeys; c++) {
+    broadphase->rects[c] = context->sprites[keys[c] & 0xFFFF].dstrect;
+  }
+
+  broadphase->numpairs = 0;
+  broadphase->dirty = false;
+  if (!FindCandidatePairs(context, numkeys)) {
+    for (c = 0; c < numkeys; c++) {
+      context->sprites[keys[c] & 0xFFFF].collide &= ~COLLIDE_SPRITES;
+    }
+    broadphase->numpairs = 0;
+  }
+}
+
+/*
+ * moves the pixels counted by the worker to its list of pairs, before the pair indices change. Pairs are added
+ * in the order they first touched, so the list is already sorted by scanline. Each pair is touched once, so
+ * they are only looked up if an earlier sweep of the frame already filled the list
+ */
+void FlushCollisions(Worker *worker) {
+  const Broadphase *broadphase = &worker->context->broadphase;
+  CollisionList *list = &worker->collisions;
+  const bool append = list->count == 0;
+  int c;
+
+  for (c = 0; c < worker->num_touched_pairs; c++) {
+    CollisionCount *count = &worker->pair_counts[worker->touched_pairs[c]];
+    const uint32_t pair = broadphase->pairs[worker->touched_pairs[c]];
+    if (append) {
+      AppendCollision(list, (int) (pair >> 16), (int) (pair & 0xFFFF), count->line, count->pixels);
+    }
+    else {
+      AddCollision(list, (int) (pair >> 16), (int) (pair & 0xFFFF), count->line, count->pixels);
+    }
+    count->pixels = 0;
+  }
+  worker->num_touched_pairs = 0;
+}
+
+bool CreateLayerHits(LayerHits *hits, int numsprites) {
+  hits->layers = (uint32_t *) calloc(numsprites + 1, sizeof(uint32_t));
+  hits->sprites = (int *) malloc((numsprites + 1) * sizeof(int));
+  hits->count = 0;
+  return hits->layers != NULL && hits->sprites != NULL;
+}
+
+void DeleteLayerHits(LayerHits *hits) {
+  free(hits->layers);
+  free(hits->sprites);
+  memset(hits, 0, sizeof(LayerHits));
+}
+
+void ClearLayerHits(LayerHits *hits) {
+  int c;
+
+  for (c = 0; c < hits->count; c++) {
+    hits->layers[hits->sprites[c]] = 0;
+  }
+  hits->count = 0;
+}
+
+/* adds layers found under a sprite, listing it the first time */
+void AddLayerHits(LayerHits *hits, int nsprite, uint32_t layers) {
+  if (layers == 0) {
+    return;
+  }
+  if (hits->layers[nsprite] == 0) {
+    hits->sprites[hits->count++] = nsprite;
+  }
+  hits->layers[nsprite] |= layers;
+}
+
+/* moves the layers found by a worker to the list of the context */
+void MergeLayerHits(LayerHits *hits, LayerHits *source) {
+  int c;
+
+  for (c = 0; c < source->count; c++) {
+    const int nsprite = source->sprites[c];
+    AddLayerHits(hits, nsprite, source->layers[nsprite]);
+    source->layers[nsprite] = 0;
+  }
+  source->count = 0;
+}
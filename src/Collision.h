@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include "tiledjinn.h"
+#include "Sprite.h"
+
+struct Engine;
+struct Worker;
+
+/* pairs of sprites that collided in a frame, each pair once */
+typedef struct {
+    TLN_SpriteCollision *items;
+    int count;
+    int capacity;
+    int *slots;      /* hash of items by sprite pair, -1 = empty */
+    int numslots;    /* power of two, twice the capacity */
+    bool hashed;     /* slots match items, else they're rebuilt on the next AddCollision() */
+} CollisionList;
+
+/* pixels of a candidate pair counted by a worker, and the first scanline where they touched */
+typedef struct {
+    int line;
+    int pixels;
+} CollisionCount;
+
+/*
+ * sprites with collision whose rectangles overlap, the candidate pairs for the pixel collision. Only the
+ * sprites in some pair write the collision buffer
+ */
+typedef struct {
+    uint32_t *keys;    /* sprites on screen with collision, sorted by left edge */
+    uint32_t *scratch;  /* keys between the passes of the sort */
+    rect_t *rects;    /* rectangles of the sprites in keys, in the same order */
+    int *position;    /* index in keys of each sprite */
+    int *count;      /* number of pairs of each sprite */
+    int *first;      /* start of the neighbors of each key, plus the end of the last one */
+    int *neighbors;    /* pair of each key with the following ones it was tested against, -1 = none */
+    int neighbor_capacity;
+    uint32_t *pairs;    /* sprite1 << 16 | sprite2 */
+    int numpairs;
+    int capacity;    /* pairs allocated */
+    bool dirty;      /* sprites with collision changed, see SweepSpriteCollisions() */
+} Broadphase;
+
+/* layers found under the opaque pixels of each sprite, and the sprites with any, to reset only those */
+typedef struct {
+    uint32_t *layers;  /* one mask per sprite, bit n = layer n */
+    int *sprites;    /* sprites with a non-zero mask */
+    int count;
+} LayerHits;
+
+/*
+ * returns the index of the broadphase pair of two sprites, or -1 if their rectangles don't overlap. The sprite
+ * with the lower key was tested against all the ones after it up to the first one to its right
+ */
+static inline int GetCandidatePair(const Broadphase *broadphase, int sprite1, int sprite2) {
+  int left = broadphase->position[sprite1];
+  int right = broadphase->position[sprite2];
+  int offset;
+
+  if (left > right) {
+    const int swap = left;
+    left = right;
+    right = swap;
+  }
+  offset = right - left - 1;
+  if (offset < 0 || offset >= broadphase->first[left + 1] - broadphase->first[left]) {
+    return -1;
+  }
+  return broadphase->neighbors[broadphase->first[left] + offset];
+}
+
+bool CreateCollisionList(CollisionList *list);
+
+void DeleteCollisionList(CollisionList *list);
+
+void ClearCollisionList(CollisionList *list);
+
+void AddCollision(CollisionList *list, int sprite1, int sprite2, int line, int pixels);
+
+void AppendCollision(CollisionList *list, int sprite1, int sprite2, int line, int pixels);
+
+void MergeCollisionList(CollisionList *list, const CollisionList *source);
+
+void SortCollisionList(CollisionList *list);
+
+bool CreateBroadphase(Broadphase *broadphase, int numsprites);
+
+void DeleteBroadphase(Broadphase *broadphase);
+
+void SweepSpriteCollisions(struct Engine *context);
+
+void FlushCollisions(struct Worker *worker);
+
+bool CreateLayerHits(LayerHits *hits, int numsprites);
+
+void DeleteLayerHits(LayerHits *hits);
+
+void ClearLayerHits(LayerHits *hits);
+
+void AddLayerHits(LayerHits *hits, int nsprite, uint32_t layers);
+
+void MergeLayerHits(LayerHits *hits, LayerHits *source);
+
+#endif
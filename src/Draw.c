@@ -11,6 +11,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
 #include "tiledjinn.h"
 #include "Draw.h"
 #include "Engine.h"
@@ -19,382 +22,670 @@
 #include "Sprite.h"
 
 
-extern struct Palette **indexed_palettes;  /* Palette.c */
-
 /* private prototypes */
-static void DrawSpriteCollision(int nsprite, const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx);
+static void ClearCollision(Worker *worker);
 
-static void DrawSpriteCollisionScaling(int nsprite, uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int srcx);
+static void CountSpriteCollisions(Worker *worker, int nsprite);
 
-static bool check_sprite_coverage(Sprite *sprite, int nscan) {
-  /* check sprite coverage */
-  if (nscan < sprite->dstrect.y1 || nscan >= sprite->dstrect.y2) {
-    return false;
+static void CheckLayerCollision(Worker *worker, int nsprite, int nscan, const uint8_t *srcpixel, int dx, int srcx);
+
+/*
+ * Resolves world positions, parallax, sprite rectangles and drawing order changed since the last frame, and
+ * builds the list of layers to draw. Runs once per frame before any scanline is drawn, and again after each raster
+ * callback, so the scanline loop never updates shared state.
+ */
+void PrepareFrame(Engine *context) {
+  DrawList *list = &context->drawlist;
+  int c;
+
+  list->numlayers = 0;
+  list->numpriority = 0;
+  for (c = context->numlayers - 1; c >= 0; c--) {
+    Layer *layer = &context->layers[c];
+    if (!layer->ok) {
+      continue;
+    }
+    if (context->dirty || layer->dirty) {
+      UpdateLayer(c);
+      layer->dirty = false;
+    }
+    if (layer->column) {
+      UpdateLayerColumns(context, layer);
+    }
+    if (layer->priority) {
+      list->priority[list->numpriority++] = c;
+    }
+    else {
+      list->layers[list->numlayers++] = c;
+    }
   }
-  if (sprite->dstrect.x2 < 0 || sprite->srcrect.x2 < 0) {
-    return false;
+
+  if (context->dirty || context->sprites_dirty) {
+    for (c = 0; c < context->numsprites; c++) {
+      SpriteInfo *sprite = &context->sprite_info[c];
+      if (sprite->ok && (sprite->dirty || (context->dirty && sprite->world_space))) {
+        if (sprite->world_space) {
+          sprite->x = sprite->xworld - context->xworld;
+          sprite->y = sprite->yworld - context->yworld;
+        }
+        UpdateSprite(c);
+        sprite->dirty = false;
+      }
+    }
   }
-  if ((sprite->flags & FLAG_MASKED) && nscan >= engine->sprite_mask_top && nscan <= engine->sprite_mask_bottom) {
-    return false;
+
+  if (context->sprite_order_dirty) {
+    SortSpriteBuckets(context);
   }
-  return true;
+  if (context->broadphase.dirty) {
+    for (c = 0; c < context->numworkers; c++) {
+      FlushCollisions(&context->workers[c]);
+    }
+    SweepSpriteCollisions(context);
+  }
+
+  context->dirty = false;
+  context->sprites_dirty = false;
 }
 
-/* Draws the next scanline of the frame started with TLN_BeginFrame() or TLN_BeginWindowFrame() */
-bool DrawScanline(void) {
-  int line = engine->line;
-  uint8_t *scan = GetFramebufferLine(line);
-  int size = engine->framebuffer.width;
-  int c;
-  bool background_priority = false;  /* at least one tile in priority layer */
-  bool sprite_priority = false;    /* at least one sprite in priority layer */
+bool CreateDrawList(Engine *context) {
+  DrawList *list = &context->drawlist;
+
+  list->numlayers = list->numpriority = 0;
+  list->layers = (int *) malloc((context->numlayers + 1) * sizeof(int));
+  list->priority = (int *) malloc((context->numlayers + 1) * sizeof(int));
+  return list->layers != NULL && list->priority != NULL;
+}
+
+void DeleteDrawList(Engine *context) {
+  free(context->drawlist.layers);
+  free(context->drawlist.priority);
+  context->drawlist.layers = NULL;
+  context->drawlist.priority = NULL;
+}
 
-  /* call raster effect callback */
-  if (engine->cb_raster) {
-    engine->cb_raster(line);
+/* wrapped offset of a screen column, columns past the table take the last one. 0 before the table is filled */
+static inline int GetColumnOffset(const Layer *layer, int column) {
+  if (layer->num_columns == 0) {
+    return 0;
   }
+  return layer->column_offset[column < layer->num_columns ? column : layer->num_columns - 1];
+}
 
-  /* background is solid color */
-  BlitColor(scan, engine->bgcolor, size);
+/*
+ * vertical position in the layer of a column, from the position of the scanline. Both the position and
+ * the offset are in [0, height), so a single subtraction wraps the sum
+ */
+static inline int GetColumnYPos(const Layer *layer, int ypos, int column) {
+  ypos += GetColumnOffset(layer, column);
+  return ypos < layer->height ? ypos : ypos - layer->height;
+}
 
-  background_priority = false;
-  memset(engine->priority, 0, engine->framebuffer.pitch);
-  memset(engine->collision, -1, engine->framebuffer.width * sizeof(uint16_t));
+/* screen column of the tile that contains screen pixel x, columns follow the tile grid of the layer */
+static inline int GetLayerColumn(const Layer *layer, int x) {
+  return (x + (layer->hstart & layer->tileset->hmask)) >> layer->tileset->hshift;
+}
 
-  /* draw background layers */
-  for (c = engine->numlayers - 1; c >= 0; c--) {
-    Layer *layer = &engine->layers[c];
+/* index of the lowest set bit of a non-zero word */
+static inline int LowestBit(uint32_t word) {
+#if defined _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, word);
+  return (int) index;
+#elif defined __GNUC__
+  return __builtin_ctz(word);
+#else
+  int index = 0;
+  while (!(word & 1)) {
+    word >>= 1;
+    index++;
+  }
+  return index;
+#endif
+}
+
+/* marks pixels [x, end) as covered in a per-scanline bitmask, one bit per pixel */
+static void SetCoverage(uint32_t *mask, int x, int end) {
+  while (x < end) {
+    const int bit = x & 31;
+    const int count = end - x < 32 - bit ? end - x : 32 - bit;
+    mask[x >> 5] |= (count == 32 ? 0xFFFFFFFF : (1u << count) - 1) << bit;
+    x += count;
+  }
+}
+
+/* first pixel in [x, end) with the given coverage, or end if none */
+static int NextCoverage(const uint32_t *mask, int x, int end, bool covered) {
+  const uint32_t invert = covered ? 0 : 0xFFFFFFFF;
+
+  while (x < end) {
+    const uint32_t word = (mask[x >> 5] ^ invert) >> (x & 31);
+    if (word != 0) {
+      x += LowestBit(word);
+      return x < end ? x : end;
+    }
+    x = (x | 31) + 1;
+  }
+  return end;
+}
+
+/* layers whose opaque tile rows fully replace what's below them */
+static bool IsOccluder(const Layer *layer) {
+  return layer->mode == MODE_NORMAL && layer->mosaic.h == 0 && layer->blend_mode == BLEND_NONE;
+}
 
-    if (layer->ok) {
-      /* update if dirty */
-      if (engine->dirty || layer->dirty) {
-        UpdateLayer(c);
-        layer->dirty = false;
+/* adds the opaque tile rows of a normal layer on the scanline to the coverage mask */
+static void AddLayerCoverage(const Layer *layer, int nscan, uint32_t *mask) {
+  const TLN_Tileset tileset = layer->tileset;
+  const TLN_Tilemap tilemap = layer->tilemap;
+  int x = layer->clip.x1;
+  const int xpos = (layer->hstart + x) % layer->width;
+  int xtile = xpos >> tileset->hshift;
+  int x1 = x + tileset->width - (xpos & tileset->hmask);
+  const int line_ypos = (layer->vstart + nscan) % layer->height;
+  int column = GetLayerColumn(layer, x);
+
+  /* same tile walk as DrawLayerScanline() */
+  if (layer->column == NULL && IsTilemapRowEmpty(tilemap, line_ypos >> tileset->vshift)) {
+    return;
+  }
+  while (x < layer->clip.x2) {
+    const int ypos = layer->column ? GetColumnYPos(layer, line_ypos, column) : line_ypos;
+    int numtiles = 1;
+    const Tile *tile;
+
+    tile = &tilemap->tiles[(ypos >> tileset->vshift) * tilemap->cols + xtile];
+    if (tile->index == 0 && layer->column == NULL) {
+      numtiles = GetTilemapRun(tilemap, ypos >> tileset->vshift, xtile);
+      x1 += (numtiles - 1) << tileset->hshift;
+    }
+
+    /* a row with a single opaque run covers it, mirrored with the tile */
+    if (tile->index && !(tile->flags & FLAG_PRIORITY)) {
+      const bool flipx = (tile->flags & FLAG_FLIPX) != 0;
+      const TileLine *row;
+      int srcy = ypos & tileset->vmask;
+      int start, end;
+
+      if (tile->flags & FLAG_FLIPY) {
+        srcy = tileset->height - srcy - 1;
+      }
+      row = &tileset->lines[GetTilesetLine(tileset, tileset->tiles[tile->index], srcy)];
+      start = x1 - tileset->width + (flipx ? row->right : row->left);
+      end = x1 - (flipx ? row->left : row->right);
+      if (start < x) {
+        start = x;
       }
+      if (end > layer->clip.x2) {
+        end = layer->clip.x2;
+      }
+      if (row->runs == 1 && start < end) {
+        SetCoverage(mask, start, end);
+      }
+    }
+    if (x1 > layer->clip.x2) {
+      x1 = layer->clip.x2;
+    }
+    x = x1;
+    x1 += tileset->width;
+    xtile += numtiles;
+    if (xtile == tilemap->cols) {
+      xtile = 0;
+    }
+    column += numtiles;
+  }
+}
 
-      /* draw */
-      if (!layer->priority && line >= layer->clip.y1 && line <= layer->clip.y2) {
-        if (layer->draw(c, line) == true) {
-          background_priority = true;
-        }
+/*
+ * Occlusion culling: walks the layers front to back accumulating the pixels covered by opaque tile rows,
+ * and stores in worker->coverage the mask of what's hidden in front of each regular layer. The last slot
+ * receives the mask in front of the farthest layer, where the background color isn't needed either. The
+ * farthest layer itself isn't walked: it would only save background fill, which is cheaper than the walk
+ */
+static void ComputeCoverage(Worker *worker, int line) {
+  const Engine *context = worker->context;
+  const DrawList *list = &context->drawlist;
+  const int words = (context->framebuffer.width + 31) >> 5;
+  uint32_t *front = worker->coverage + context->numlayers * words;
+  int c;
+
+  memset(front, 0, words * sizeof(uint32_t));
+
+  /* priority layers are drawn over everything else */
+  for (c = 0; c < list->numpriority; c++) {
+    const Layer *layer = worker->layers[list->priority[c]];
+    if (line >= layer->clip.y1 && line <= layer->clip.y2 && IsOccluder(layer)) {
+      AddLayerCoverage(layer, line, front);
+    }
+  }
+
+  for (c = list->numlayers - 1; c >= 0; c--) {
+    const int nlayer = list->layers[c];
+    const Layer *layer = worker->layers[nlayer];
+    memcpy(worker->coverage + nlayer * words, front, words * sizeof(uint32_t));
+    if (c > 0 && line >= layer->clip.y1 && line <= layer->clip.y2 && IsOccluder(layer)) {
+      AddLayerCoverage(layer, line, front);
+    }
+  }
+}
+
+/* points the worker to the layers and palettes of the scanline, copying those changed by line tables */
+static void SetupLineTables(Worker *worker, int line) {
+  const Engine *context = worker->context;
+  int c;
+
+  for (c = 0; c < context->numlayers; c++) {
+    Layer *layer = &context->layers[c];
+    if (layer->line_tables) {
+      worker->line_layers[c] = *layer;
+      layer = &worker->line_layers[c];
+      SetLayerLine(context, layer, line);
+    }
+    worker->layers[c] = layer;
+  }
+
+  if (context->numpalette_tables > 0) {
+    memcpy(worker->line_palettes, context->palettes, sizeof(worker->line_palettes));
+    for (c = 0; c < 256; c++) {
+      /* entries naming an empty palette slot keep the original palette */
+      if (context->palette_tables[c] != NULL && context->palettes[context->palette_tables[c][line]] != NULL) {
+        worker->line_palettes[c] = context->palettes[context->palette_tables[c][line]];
       }
     }
+    worker->palettes = worker->line_palettes;
   }
+  else {
+    worker->palettes = (struct Palette **) context->palettes;
+  }
+}
 
-  /* draw regular sprites */
-  for (int index = 0; index < engine->numsprites; ++index) {
-    Sprite *sprite = &engine->sprites[index];
+static bool check_sprite_coverage(const Engine *context, const Sprite *sprite, int nscan) {
+  /* check sprite coverage, sprites in the bucket aren't clipped out horizontally */
+  if (nscan < sprite->dstrect.y1 || nscan >= sprite->dstrect.y2) {
+    return false;
+  }
+  if ((sprite->flags & FLAG_MASKED) && nscan >= context->sprite_mask_top && nscan <= context->sprite_mask_bottom) {
+    return false;
+  }
+  return true;
+}
 
-    if (!sprite->ok) {
-      continue;
+/* Draws the next scanline of the band assigned to the worker */
+bool DrawScanline(Worker *worker) {
+  Engine *context = worker->context;
+  int line = worker->line;
+  uint8_t *scan = GetFramebufferLine(context, line);
+  int size = context->framebuffer.width;
+  int c;
+  const DrawList *list = &context->drawlist;
+  const SpriteBucket *bucket;
+  bool background_priority = false;  /* at least one tile in priority layer */
+  int numpriority = 0;    /* sprites in front of priority tiles */
+  uint32_t bgcolor;
+
+  /* call raster effect callback, it may change any state */
+  if (context->cb_raster) {
+    context->cb_raster(line);
+    PrepareFrame(context);
+  }
+  SetupLineTables(worker, line);
+  bgcolor = context->bgcolor_table != NULL ? context->bgcolor_table[line] | 0xFF000000 : context->bgcolor;
+
+  /* background is solid color, only in the holes left by opaque layers when culling */
+  if (context->occlusion) {
+    const uint32_t *covered;
+    int x = 0;
+
+    ComputeCoverage(worker, line);
+    covered = worker->coverage + context->numlayers * ((size + 31) >> 5);
+    while ((x = NextCoverage(covered, x, size, false)) < size) {
+      const int end = NextCoverage(covered, x, size, true);
+      BlitColor(scan + (x << 2), bgcolor, end - x);
+      x = end;
     }
+  }
+  else {
+    BlitColor(scan, bgcolor, size);
+  }
+
+  background_priority = false;
+  worker->scan = scan;
+  memset(worker->priority, 0, context->framebuffer.width * sizeof(uint32_t));
+  worker->collision_clear = false;
 
-    /* update if dirty */
-    if (sprite->world_space && (sprite->dirty || engine->dirty)) {
-      sprite->x = sprite->xworld - engine->xworld;
-      sprite->y = sprite->yworld - engine->yworld;
-      UpdateSprite(sprite);
-      sprite->dirty = false;
+  /* draw background layers */
+  for (c = 0; c < list->numlayers; c++) {
+    const int nlayer = list->layers[c];
+    const Layer *layer = worker->layers[nlayer];
+    if (line >= layer->clip.y1 && line <= layer->clip.y2) {
+      if (context->occlusion) {
+        worker->cull = worker->coverage + nlayer * ((size + 31) >> 5);
+      }
+      if (layer->draw(worker, nlayer, line) == true) {
+        background_priority = true;
+      }
     }
+  }
+  worker->cull = NULL;
+
+  /* draw regular sprites overlapping the scanline */
+  bucket = &context->buckets[line >> SPRITE_BUCKET_SHIFT];
+  for (c = 0; c < bucket->count; c++) {
+    const int index = bucket->items[c];
+    Sprite *sprite = &context->sprites[index];
 
-    if (check_sprite_coverage(sprite, line)) {
+    if (check_sprite_coverage(context, sprite, line)) {
       if (!(sprite->flags & FLAG_PRIORITY)) {
-        sprite->draw(index, line);
+        sprite->draw(worker, index, line);
       }
       else {
-        sprite_priority = true;
+        worker->priority_sprites[numpriority++] = (uint16_t) index;
       }
     }
   }
 
   /* draw background layers with priority */
-  for (c = engine->numlayers - 1; c >= 0; c--) {
-    const Layer *layer = &engine->layers[c];
-    if (layer->ok && layer->priority && line >= layer->clip.y1 && line <= layer->clip.y2) {
-      layer->draw(c, line);
+  for (c = 0; c < list->numpriority; c++) {
+    const int nlayer = list->priority[c];
+    const Layer *layer = worker->layers[nlayer];
+    if (line >= layer->clip.y1 && line <= layer->clip.y2) {
+      layer->draw(worker, nlayer, line);
     }
   }
 
   /* overlay background tiles with priority */
   if (background_priority == true) {
-    uint32_t *src = (uint32_t *) engine->priority;
-    uint32_t *dst = (uint32_t *) scan;
-    for (c = 0; c < engine->framebuffer.width; c++) {
-      if (*src) {
-        *dst = *src;
-      }
-      src++;
-      dst++;
-    }
+    BlitOverlay((uint32_t *) worker->priority, (uint32_t *) scan, context->framebuffer.width);
   }
 
-  // TODO: draw sprites with priority
-  /* draw sprites with priority */
-//  if (sprite_priority == true) {
-//    index = list->first;
-//    while (index != -1) {
-//      Sprite *sprite = &engine->sprites[index];
-//      if (check_sprite_coverage(sprite, line) && (sprite->flags & FLAG_PRIORITY))
-//        sprite->draw(index, line);
-//      index = sprite->list_node.next;
-//    }
-//  }
+  /* draw sprites with priority, collected in the regular sprite pass */
+  for (c = 0; c < numpriority; c++) {
+    const int index = worker->priority_sprites[c];
+    context->sprites[index].draw(worker, index, line);
+  }
 
   /* next scanline */
-  engine->dirty = false;
-  engine->line++;
-  return engine->line < engine->framebuffer.height;
+  worker->line++;
+  return worker->line < worker->end;
 }
 
 /* draw scanline of tiled background */
-static bool DrawLayerScanline(int nlayer, int nscan) {
-  const Layer *layer = &engine->layers[nlayer];
+static bool DrawLayerScanline(Worker *worker, int nlayer, int nscan) {
+  const Layer *layer = worker->layers[nlayer];
   const TLN_Tileset tileset = layer->tileset;
   const TLN_Tilemap tilemap = layer->tilemap;
-  int shift;
-  TLN_Tile tile;
+  TLN_Tile tile = NULL;
   uint8_t *srcpixel;
   int x, x1;
   int xpos, ypos;
   int xtile, ytile;
   int srcx, srcy;
-  int direction, width;
+  int direction, width, count;
   int column;
-  int line;
+  int line, line_ypos;
   uint8_t *dstpixel;
   uint8_t *dstpixel_pri;
   uint8_t *dst;
   bool color_key;
   bool priority = false;
+  TileCache *cache = NULL;  /* expanded tiles, only for unblended 32 bpp output */
+  const uint32_t *cull = NULL;  /* pixels covered by opaque layers in front, see DrawScanline() */
+  int visible_start, visible_end;  /* current run of pixels not covered */
 
-  /* mosaic effect */
-  if (layer->mosaic.h != 0) {
-    shift = 0;
-    dstpixel = layer->mosaic.buffer;
-    if (nscan % layer->mosaic.h == 0) {
-      memset(dstpixel, 0, engine->framebuffer.width);
-    }
-    else {
-      goto draw_end;
-    }
-  }
-  else {
-    shift = 2;
-    dstpixel = GetFramebufferLine (nscan);
+  if (worker->tilecache.entries != NULL && layer->blend_mode == BLEND_NONE) {
+    cache = &worker->tilecache;
   }
+  cull = worker->cull;
 
   /* target lines */
   x = layer->clip.x1;
-  dstpixel += (x << shift);
-  dstpixel_pri = engine->priority;
+  dstpixel = worker->scan + (x << 2);
+  dstpixel_pri = worker->priority + (x << 2);
 
   xpos = (layer->hstart + x) % layer->width;
   xtile = xpos >> tileset->hshift;
   srcx = xpos & tileset->hmask;
 
   /* fill whole scanline */
-  column = x % tileset->width;
+  column = GetLayerColumn(layer, x);
+  visible_start = visible_end = x;
+  line_ypos = (layer->vstart + nscan) % layer->height;
+
+  /* nothing to draw in an empty row, unless column offset takes each column from a different one */
+  if (layer->column == NULL && IsTilemapRowEmpty(tilemap, line_ypos >> tileset->vshift)) {
+    return false;
+  }
+  ytile = line_ypos >> tileset->vshift;
+  srcy = line_ypos & tileset->vmask;
+
   while (x < layer->clip.x2) {
     int tilewidth;
-
-    /* column offset: update ypos */
-    if (layer->column) {
-      ypos = (layer->vstart + nscan + layer->column[column]) % layer->height;
-      if (ypos < 0) {
-        ypos = layer->height + ypos;
-      }
-    }
-    else {
-      ypos = (layer->vstart + nscan) % layer->height;
+    int numtiles = 1;  /* tiles covered in this step, more than one for a run of empty tiles */
+    int skip = 0;  /* leading pixels hidden by opaque layers in front */
+
+    /* column offset: displace ypos */
+    if (layer->column != NULL) {
+      ypos = GetColumnYPos(layer, line_ypos, column);
+      ytile = ypos >> tileset->vshift;
+      srcy = ypos & tileset->vmask;
     }
 
-    ytile = ypos >> tileset->vshift;
-    srcy = ypos & tileset->vmask;
-
     tile = &tilemap->tiles[ytile * tilemap->cols + xtile];
+    if (tile->index == 0 && layer->column == NULL) {
+      numtiles = GetTilemapRun(tilemap, ytile, xtile);
+    }
 
     /* get effective tile width */
-    tilewidth = tileset->width - srcx;
+    tilewidth = (numtiles << tileset->hshift) - srcx;
     x1 = x + tilewidth;
     if (x1 > layer->clip.x2) {
       x1 = layer->clip.x2;
     }
     width = x1 - x;
+    count = width;
 
-    /* paint if not empty tile */
-    if (tile->index) {
-      const uint16_t tile_index = tileset->tiles[tile->index];
-
-      /* H/V flip */
-      if (tile->flags & FLAG_FLIPX) {
-        direction = -1;
-        srcx = tilewidth - 1;
+    /* occlusion culling: paint from the first to the last visible pixel, advancing through visible runs */
+    if (cull != NULL && tile->index && !(tile->flags & FLAG_PRIORITY)) {
+      while (visible_end <= x) {
+        visible_start = NextCoverage(cull, visible_end, layer->clip.x2, false);
+        visible_end = NextCoverage(cull, visible_start, layer->clip.x2, true);
       }
-      else {
-        direction = 1;
-      }
-      if (tile->flags & FLAG_FLIPY) {
-        srcy = tileset->height - srcy - 1;
+      skip = visible_start > x ? visible_start - x : 0;
+      count = (visible_end < x1 ? visible_end : x1) - x - skip;
+      while (visible_end < x1) {
+        visible_start = NextCoverage(cull, visible_end, layer->clip.x2, false);
+        if (visible_start >= x1) {
+          break;
+        }
+        visible_end = NextCoverage(cull, visible_start, layer->clip.x2, true);
+        count = (visible_end < x1 ? visible_end : x1) - x - skip;
       }
+    }
 
-      /* paint tile scanline */
-      srcpixel = &GetTilesetPixel(tileset, tile_index, srcx, srcy);
-      if (tile->flags & FLAG_PRIORITY) {
-        dst = dstpixel_pri;
-        priority = true;
+    /* paint if not empty tile */
+    if (tile->index && count > 0) {
+      const uint16_t tile_index = tileset->tiles[tile->index];
+      const bool flipx = (tile->flags & FLAG_FLIPX) != 0;
+      const int tiley = (tile->flags & FLAG_FLIPY) ? tileset->vmask - srcy : srcy;
+      const TileLine *row;
+      const uint32_t *cached = NULL;
+      int start, end;  /* pixels of the tile row to paint, as displayed */
+
+      line = GetTilesetLine(tileset, tile_index, tiley);
+      row = &tileset->lines[line];
+
+      /*
+       * a row with a single opaque run is trimmed to it, mirrored with the tile, and blitted without color
+       * key. Fully transparent rows vanish. Rows with holes keep the whole span for the SIMD keyed blitters
+       */
+      start = srcx + skip;
+      end = start + count;
+      if (row->runs <= 1) {
+        const int lead = flipx ? row->right : row->left;
+        const int trail = tileset->width - (flipx ? row->left : row->right);
+        start = start > lead ? start : lead;
+        end = end < trail ? end : trail;
+        count = end - start;
       }
-      else {
-        dst = dstpixel;
+
+      if (count > 0) {
+        if (tile->flags & FLAG_PRIORITY) {
+          dst = dstpixel_pri + ((start - srcx) << 2);
+          priority = true;
+        }
+        else {
+          dst = dstpixel + ((start - srcx) << 2);
+        }
+
+        color_key = row->runs > 1;
+
+        /* expanded tile row: cached tiles are stored already flipped */
+        if (cache != NULL) {
+          cached = GetCachedTile(cache, tileset, tile_index, worker->palettes[tile->flags & FLAG_PALETTES],
+                                 flipx);
+        }
+        if (cached != NULL) {
+          cached += (tiley << tileset->hshift) + start;
+          if (color_key) {
+            BlitOverlay(cached, (uint32_t *) dst, count);
+          }
+          else {
+            memcpy(dst, cached, count * sizeof(uint32_t));
+          }
+        }
+        else {
+          /* H flip: forwards through the mirrored rows if the tileset keeps them */
+          direction = 1;
+          if (!flipx) {
+            srcpixel = &GetTilesetPixel(tileset, tile_index, start, tiley);
+          }
+          else if (tileset->mirror != NULL) {
+            srcpixel = &GetTilesetMirrorPixel(tileset, tile_index, start, tiley);
+          }
+          else {
+            direction = -1;
+            srcpixel = &GetTilesetPixel(tileset, tile_index, tileset->width - 1 - start, tiley);
+          }
+
+          /* paint tile scanline */
+          layer->blitters[color_key](srcpixel, GetPaletteColors(worker, tile->flags & FLAG_PALETTES), dst, count,
+                                     direction, 0, layer->blend);
+        }
       }
-      line = GetTilesetLine(tileset, tile_index, srcy);
-      color_key = *(tileset->color_key + line);
-      layer->blitters[color_key](srcpixel, tile->flags & FLAG_PALETTES, dst, width, direction, 0,
-                                 layer->blend);
     }
 
     /* next tile */
     x += width;
-    width <<= shift;
-    dstpixel += width;
-    dstpixel_pri += width;
-    xtile = (xtile + 1) % tilemap->cols;
+    dstpixel += width << 2;
+    dstpixel_pri += width << 2;
+    xtile += numtiles;
+    if (xtile == tilemap->cols) {
+      xtile = 0;
+    }
     srcx = 0;
-    column++;
+    column += numtiles;
   }
 
-  draw_end:
-  if (layer->mosaic.h != 0) {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = layer->mosaic.buffer + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
+  return priority;
+}
 
-    /* TODO: i broke mosaics when i did indexed palettes.. this shouldn't be on the layer anyway though.... */
-    if (layer->blend != NULL) {
-      BlitMosaicBlend(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w,
-                      layer->blend);
-    }
-    else {
-      BlitMosaicSolid(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w);
-    }
+/* wraps a layer coordinate to [0, size), mask is size - 1 for power of two sizes or 0 */
+static inline int WrapLayerPixel(int value, int size, int mask) {
+  if (mask != 0) {
+    return value & mask;
   }
-
-  return priority;
+  value %= size;
+  return value < 0 ? value + size : value;
 }
 
 /* draw scanline of tiled background with scaling */
-static bool DrawLayerScanlineScaling(int nlayer, int nscan) {
-  const Layer *layer = &engine->layers[nlayer];
+static bool DrawLayerScanlineScaling(Worker *worker, int nlayer, int nscan) {
+  const Layer *layer = worker->layers[nlayer];
   const TLN_Tileset tileset = layer->tileset;
   const TLN_Tilemap tilemap = layer->tilemap;
-  int shift;
-  TLN_Tile tile;
+  const fix_t step = layer->dx > 0 ? layer->dx : 1;
+  const fix_t layer_width = int2fix(layer->width);
+  const fix_t xmask = (layer->width & (layer->width - 1)) == 0 ? layer_width - 1 : 0;
+  const int ymask = (layer->height & (layer->height - 1)) == 0 ? layer->height - 1 : 0;
+  const fix_t tile_width = int2fix(tileset->width);
+  TLN_Tile tile = NULL;
   uint8_t *srcpixel;
-  int x, x1;
-  int xpos, ypos;
-  int xtile, ytile;
-  int srcx, srcy;
-  int direction, width;
+  int x;
+  int ypos, line_ypos;
+  int ytile;
+  int srcy;
   int column;
   int line;
   uint8_t *dstpixel;
   uint8_t *dstpixel_pri;
   uint8_t *dst;
-  fix_t fix_tilewidth;
   fix_t fix_x;
-  fix_t dx;
+  uint32_t inverse;
   bool color_key;
   bool priority = false;
 
-  /* mosaic effect */
-  if (layer->mosaic.h != 0) {
-    shift = 0;
-    dstpixel = layer->mosaic.buffer;
-    if (nscan % layer->mosaic.h == 0) {
-      memset(dstpixel, 0, engine->framebuffer.width);
-    }
-    else {
-      goto draw_end;
-    }
-  }
-  else {
-    shift = 2;
-    dstpixel = GetFramebufferLine (nscan);
-  }
-
   /* target lines */
   x = layer->clip.x1;
-  dstpixel += (x << shift);
-  dstpixel_pri = engine->priority;
-
-  xpos = (layer->hstart + fix2int(x * layer->dx)) % layer->width;
-  xtile = xpos >> tileset->hshift;
-  srcx = xpos & tileset->hmask;
+  dstpixel = worker->scan + (x << 2);
+  dstpixel_pri = worker->priority + (x << 2);
 
-  /* fill whole scanline */
-  fix_x = int2fix (x);
-  column = x % tileset->width;
+  /*
+   * source x is a single fixed point accumulator for the whole line. The number of pixels that fall
+   * inside each tile is estimated with the reciprocal of the step, so there is one division per line
+   */
+  fix_x = WrapAffine((fix_t) (int2fix(layer->hstart) + (int64_t) x * step), layer_width, xmask);
+  inverse = (uint32_t) (UINT32_MAX / (uint32_t) step);
+  line_ypos = WrapLayerPixel(layer->vstart + fix2int(nscan * layer->dy), layer->height, ymask);
+  column = (int) ((int2fix(layer->hstart & tileset->hmask) + (int64_t) x * step) >> (FIXED_BITS + tileset->hshift));
+  if (layer->column == NULL && IsTilemapRowEmpty(tilemap, line_ypos >> tileset->vshift)) {
+    return false;
+  }
   while (x < layer->clip.x2) {
-    int tilewidth;
-    int tilescalewidth;
-
-    /* column offset: update ypos */
-    ypos = nscan;
-    if (layer->column) {
-      ypos += layer->column[column];
-    }
-
-    ypos = layer->vstart + fix2int(ypos * layer->dy);
-    if (ypos < 0) {
-      ypos = layer->height + ypos;
-    }
-    else {
-      ypos = ypos % layer->height;
-    }
+    const int xtile = fix2int(fix_x) >> tileset->hshift;
+    const fix_t offset = fix_x - (xtile << (tileset->hshift + FIXED_BITS));
+    int numtiles = 1;
+    int width;
 
+    /* column offset: displace ypos, offsets are in layer pixels */
+    ypos = layer->column ? GetColumnYPos(layer, line_ypos, column) : line_ypos;
     ytile = ypos >> tileset->vshift;
     srcy = ypos & tileset->vmask;
 
     tile = &tilemap->tiles[ytile * tilemap->cols + xtile];
+    if (tile->index == 0 && layer->column == NULL) {
+      numtiles = GetTilemapRun(tilemap, ytile, xtile);
+    }
 
-    /* get effective tile width */
-    tilewidth = tileset->width - srcx;
-    dx = int2fix(tilewidth);
-    fix_tilewidth = tilewidth * layer->xfactor;
-    fix_x += fix_tilewidth;
-    x1 = fix2int (fix_x);
-    tilescalewidth = x1 - x;
-    if (tilescalewidth) {
-      dx /= tilescalewidth;
+    if (numtiles == 1) {
+      const uint32_t remaining = (uint32_t) (tile_width - offset);
+
+      /* the estimate falls short by at most two pixels */
+      width = (int) (((uint64_t) remaining * inverse) >> 32);
+      while ((uint32_t) width * (uint32_t) step < remaining) {
+        width++;
+      }
     }
     else {
-      dx = 0;
+      /* a run of empty tiles may not fit the estimate, it's skipped with a single division */
+      const int64_t remaining = ((int64_t) numtiles << (tileset->hshift + FIXED_BITS)) - offset;
+      const int64_t pixels = (remaining + step - 1) / step;
+      width = pixels < layer->clip.x2 - x ? (int) pixels : layer->clip.x2 - x;
     }
-
-    /* right clip */
-    if (x1 > layer->clip.x2) {
-      x1 = layer->clip.x2;
+    if (width > layer->clip.x2 - x) {
+      width = layer->clip.x2 - x;
     }
-    width = x1 - x;
 
-    /* paint if tile is not empty */
+    /* paint if tile is not empty, skipping fully transparent rows */
     if (tile->index) {
-      const uint16_t tile_index = tileset->tiles[tile->index];
-
-      /* volteado H/V */
-      if (tile->flags & FLAG_FLIPX) {
-        direction = -dx;
-        srcx = tilewidth - 1;
-      }
-      else {
-        direction = dx;
-      }
       if (tile->flags & FLAG_FLIPY) {
         srcy = tileset->height - srcy - 1;
       }
+      line = GetTilesetLine (tileset, tileset->tiles[tile->index], srcy);
+    }
+    if (tile->index && tileset->lines[line].runs != 0) {
+      const bool mirror = (tile->flags & FLAG_FLIPX) && tileset->mirror != NULL;
 
-      /* pinta tile scanline */
-      srcpixel = &GetTilesetPixel (tileset, tile_index, srcx, srcy);
+      srcpixel = mirror ? &tileset->mirror[line << tileset->hshift] : &tileset->data[line << tileset->hshift];
       if (tile->flags & FLAG_PRIORITY) {
         dst = dstpixel_pri;
         priority = true;
@@ -402,373 +693,506 @@ static bool DrawLayerScanlineScaling(int nlayer, int nscan) {
       else {
         dst = dstpixel;
       }
-      line = GetTilesetLine (tileset, tile_index, srcy);
-      color_key = *(tileset->color_key + line);
-      layer->blitters[color_key](srcpixel, tile->flags & FLAG_PALETTES, dst, width, direction, 0, layer->blend);
+      color_key = tileset->lines[line].color_key;
+
+      /* flipped tiles walk backwards from the mirrored offset, which stays positive, or forwards if mirrored */
+      if ((tile->flags & FLAG_FLIPX) && !mirror) {
+        layer->blitters[color_key](srcpixel, GetPaletteColors(worker, tile->flags & FLAG_PALETTES), dst, width,
+                                   -step, tile_width - 1 - offset, layer->blend);
+      }
+      else {
+        layer->blitters[color_key](srcpixel, GetPaletteColors(worker, tile->flags & FLAG_PALETTES), dst, width,
+                                   step, offset, layer->blend);
+      }
     }
 
     /* next tile */
-    width <<= shift;
-    dstpixel += width;
-    dstpixel_pri += width;
-    x = x1;
-    xtile = (xtile + 1) % tilemap->cols;
-    srcx = 0;
-    column++;
+    fix_x = WrapAffine(fix_x + width * step, layer_width, xmask);
+    x += width;
+    dstpixel += width << 2;
+    dstpixel_pri += width << 2;
+    column += numtiles;
   }
 
-  draw_end:
-  if (layer->mosaic.h != 0) {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = layer->mosaic.buffer + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
+  return priority;
+}
 
-    /* TODO: this is a copy paste block?? broken mosaic with indexed palettes */
-    if (layer->blend != NULL) {
-      BlitMosaicBlend(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w,
-                      layer->blend);
-    }
-    else {
-      BlitMosaicSolid(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w);
+/*
+ * source position of a screen column and step per pixel along a line of a transformed layer, in fixed
+ * point. The position is wrapped to the layer size. Returns false for lines without floor in perspective
+ */
+static bool GetTransformedLine(const Engine *context, Layer *layer, int nscan, int column, fix_t *x, fix_t *y,
+                               fix_t *dx, fix_t *dy) {
+  int64_t xpos, ypos;
+
+  if (layer->mode == MODE_PERSPECTIVE) {
+    const int distance = nscan - layer->perspective.horizon;
+    const int center = context->framebuffer.width >> 1;
+    fix_t scale;
+    int64_t depth;
+
+    if (distance <= 0) {
+      return false;
     }
+
+    /* layer pixels per screen pixel along this line, and how far the line is from the camera */
+    scale = layer->perspective.height / distance;
+    depth = ((int64_t) layer->perspective.focal * scale) >> FIXED_BITS;
+    *dx = (fix_t) (((int64_t) layer->perspective.cos * scale) >> FIXED_BITS);
+    *dy = (fix_t) (((int64_t) layer->perspective.sin * scale) >> FIXED_BITS);
+    xpos = layer->perspective.x + ((layer->perspective.sin * depth) >> FIXED_BITS);
+    ypos = layer->perspective.y - ((layer->perspective.cos * depth) >> FIXED_BITS);
+    column -= center;
+  }
+  else {
+    Point2D p1, p2;
+
+    Point2DSet(&p1, (math2d_t) layer->hstart, (math2d_t) layer->vstart + nscan);
+    Point2DSet(&p2, (math2d_t) layer->hstart + layer->clip.x2, (math2d_t) layer->vstart + nscan);
+    Point2DMultiply(&p1, &layer->transform);
+    Point2DMultiply(&p2, &layer->transform);
+    *dx = (float2fix(p2.x) - float2fix(p1.x)) / layer->clip.x2;
+    *dy = (float2fix(p2.y) - float2fix(p1.y)) / layer->clip.x2;
+    xpos = float2fix(p1.x);
+    ypos = float2fix(p1.y);
   }
 
-  return priority;
+  *x = (fix_t) ((xpos + (int64_t) *dx * column) % int2fix(layer->width));
+  *y = (fix_t) ((ypos + (int64_t) *dy * column) % int2fix(layer->height));
+  return true;
 }
 
-/* draw scanline of tiled background with affine transform */
-static bool DrawLayerScanlineAffine(int nlayer, int nscan) {
-  Layer *layer = &engine->layers[nlayer];
+/* draw scanline of tiled background with affine transform or perspective */
+static bool DrawLayerScanlineAffine(Worker *worker, int nlayer, int nscan) {
+  Layer *layer = worker->layers[nlayer];
   const TLN_Tileset tileset = layer->tileset;
   const TLN_Tilemap tilemap = layer->tilemap;
-  int shift;
-  TLN_Tile tile;
-  int x, width;
-  int x1, y1, x2, y2;
-  fix_t dx, dy;
-  int xpos, ypos;
-  int xtile, ytile;
-  int srcx, srcy;
-  uint8_t *dstpixel;
-  Point2D p1, p2;
+  const int width = layer->clip.x2 - layer->clip.x1;
+  AffineSpan span;
 
-  /* mosaic effect */
-  if (layer->mosaic.h != 0) {
-    shift = 0;
-    dstpixel = layer->mosaic.buffer;
-    if (nscan % layer->mosaic.h == 0) {
-      memset(dstpixel, 0, engine->framebuffer.width);
-    }
-    else {
-      goto draw_end;
-    }
+  if (width <= 0) {
+    return false;
   }
-  else {
-    shift = 2;
-    dstpixel = engine->tmpindex;
-    memset(dstpixel, 0, engine->framebuffer.width);
+  if (!GetTransformedLine(worker->context, layer, nscan, layer->clip.x1, &span.x, &span.y, &span.dx, &span.dy)) {
+    return false;
   }
 
-  /* target lines */
-  x = layer->clip.x1;
-  width = layer->clip.x2;
-
-  xpos = layer->hstart;
-  ypos = layer->vstart + nscan;
-
-  Point2DSet(&p1, (math2d_t) xpos, (math2d_t) ypos);
-  Point2DSet(&p2, (math2d_t) xpos + width, (math2d_t) ypos);
-  Point2DMultiply(&p1, &layer->transform);
-  Point2DMultiply(&p2, &layer->transform);
-
-  x1 = float2fix(p1.x);
-  y1 = float2fix(p1.y);
-  x2 = float2fix(p2.x);
-  y2 = float2fix(p2.y);
-
-  dx = (x2 - x1) / width;
-  dy = (y2 - y1) / width;
-
-  while (x < width) {
-    xpos = abs((fix2int(x1) + layer->width)) % layer->width;
-    ypos = abs((fix2int(y1) + layer->height)) % layer->height;
-
-    xtile = xpos >> tileset->hshift;
-    ytile = ypos >> tileset->vshift;
-
-    srcx = xpos & tileset->hmask;
-    srcy = ypos & tileset->vmask;
-
-    tile = &tilemap->tiles[ytile * tilemap->cols + xtile];
-
-    /* paint if not empty tile */
-    if (tile->index) {
-      const uint16_t tile_index = tileset->tiles[tile->index];
-
-      /* H/V flip */
-      if (tile->flags & FLAG_FLIPX) {
-        srcx = tileset->width - srcx - 1;
-      }
-      if (tile->flags & FLAG_FLIPY) {
-        srcy = tileset->height - srcy - 1;
-      }
-
-      /* pinta scanline tile */
-      *dstpixel = GetTilesetPixel (tileset, tile_index, srcx, srcy);
-    }
-
-    /* next pixel */
-    x++;
-    x1 += dx;
-    y1 += dy;
-    dstpixel++;
+  span.tiles = tilemap->tiles;
+  span.cols = tilemap->cols;
+  span.indexes = tileset->tiles;
+  span.pixels = tileset->data;
+  span.hshift = tileset->hshift;
+  span.vshift = tileset->vshift;
+  span.width = int2fix(layer->width);
+  span.height = int2fix(layer->height);
+  span.xmask = (layer->width & (layer->width - 1)) == 0 ? span.width - 1 : 0;
+  span.ymask = (layer->height & (layer->height - 1)) == 0 ? span.height - 1 : 0;
+  span.x = WrapAffine(span.x, span.width, span.xmask);
+  span.y = WrapAffine(span.y, span.height, span.ymask);
+  span.palettes = worker->palettes;
+  span.blend_mode = layer->blend_mode;
+  span.blend = layer->blend;
+  if (layer->column == NULL) {
+    BlitAffine(&span, (uint32_t *) worker->scan + layer->clip.x1, width);
+    return false;
   }
 
-  draw_end:
-  if (layer->mosaic.h != 0) {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = layer->mosaic.buffer + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
+  /* column offset: each screen column samples the layer displaced along its vertical axis */
+  {
+    fix_t ypos = span.y;
+    int x = layer->clip.x1;
+    int column = GetLayerColumn(layer, x);
 
-    if (layer->blend != NULL) {
-      BlitMosaicBlend(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w, layer->blend);
-    }
-    else {
-      BlitMosaicSolid(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w);
+    while (x < layer->clip.x2) {
+      int x1 = ((column + 1) << tileset->hshift) - (layer->hstart & tileset->hmask);
+      if (x1 > layer->clip.x2) {
+        x1 = layer->clip.x2;
+      }
+      /* the blitter advances the span, only the undisplaced vertical position is kept apart */
+      span.y = WrapAffine(ypos + int2fix(GetColumnOffset(layer, column)), span.height, span.ymask);
+      BlitAffine(&span, (uint32_t *) worker->scan + x, x1 - x);
+      ypos = WrapAffine(ypos + (x1 - x) * span.dy, span.height, span.ymask);
+      x = x1;
+      column++;
     }
   }
-  else {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = engine->tmpindex + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
-
-    layer->blitters[1](srcptr, tile->flags & FLAG_PALETTES, dstptr, width, 1, 0, layer->blend);
-  }
   return false;
 }
 
-/* draw scanline of tiled background with per-pixel mapping */
-static bool DrawLayerScanlinePixelMapping(int nlayer, int nscan) {
-  Layer *layer = &engine->layers[nlayer];
-  const TLN_Tileset tileset = layer->tileset;
-  const TLN_Tilemap tilemap = layer->tilemap;
-  const int hstart = layer->hstart + layer->width;
-  const int vstart = layer->vstart + layer->height;
-  int shift;
-  TLN_Tile tile;
-  int x, width;
-  int xpos, ypos;
-  int xtile, ytile;
-  int srcx, srcy;
-  uint8_t *dstpixel;
-  TLN_PixelMap *pixel_map;
-
-  /* mosaic effect */
-  if (layer->mosaic.h != 0) {
-    shift = 0;
-    dstpixel = layer->mosaic.buffer;
-    if (nscan % layer->mosaic.h == 0) {
-      memset(dstpixel, 0, engine->framebuffer.width);
-    }
-    else {
-      goto draw_end;
+/*
+ * fills the worker sample buffers with the layer position of each pixel in [start, start + width) of a
+ * scanline, from the full, separable or tiled displacement table
+ */
+static void GetPixelMapLine(Worker *worker, const Layer *layer, int nscan, int start, int width) {
+  const Engine *context = worker->context;
+  const int xmask = (layer->width & (layer->width - 1)) == 0 ? layer->width - 1 : 0;
+  const int ymask = (layer->height & (layer->height - 1)) == 0 ? layer->height - 1 : 0;
+  int *xpos = worker->sample_x;
+  int *ypos = worker->sample_y;
+  int x;
+
+  switch (layer->pixel_map_type) {
+    case PIXEL_MAP_FULL: {
+      const TLN_PixelMap *pixel_map = &layer->pixel_map[nscan * context->framebuffer.width + start];
+      for (x = 0; x < width; x++) {
+        xpos[x] = WrapLayerPixel(layer->hstart + pixel_map[x].dx, layer->width, xmask);
+        ypos[x] = WrapLayerPixel(layer->vstart + pixel_map[x].dy, layer->height, ymask);
+      }
+      break;
     }
-  }
-  else {
-    shift = 2;
-    dstpixel = engine->tmpindex;
-    memset(dstpixel, 0, engine->framebuffer.width);
-  }
-
-  /* target lines */
-  x = layer->clip.x1;
-  width = layer->clip.x2 - layer->clip.x1;
-
-  pixel_map = &layer->pixel_map[nscan * engine->framebuffer.width + x];
-  while (x < width) {
-    xpos = abs(hstart + pixel_map->dx) % layer->width;
-    ypos = abs(vstart + pixel_map->dy) % layer->height;
 
-    xtile = xpos >> tileset->hshift;
-    ytile = ypos >> tileset->vshift;
+    case PIXEL_MAP_SEPARABLE: {
+      const TLN_PixelMap *column = layer->pixel_map_columns;
+      int xstart = layer->hstart + start;
+      int ystart = layer->vstart + nscan;
 
-    srcx = xpos & tileset->hmask;
-    srcy = ypos & tileset->vmask;
-
-    tile = &tilemap->tiles[ytile * tilemap->cols + xtile];
-
-    /* paint if not empty tile */
-    if (tile->index) {
-      const uint16_t tile_index = tileset->tiles[tile->index];
-
-      /* H/V flip */
-      if (tile->flags & FLAG_FLIPX) {
-        srcx = tileset->width - srcx - 1;
+      if (layer->pixel_map_rows != NULL) {
+        xstart += layer->pixel_map_rows[nscan].dx;
+        ystart += layer->pixel_map_rows[nscan].dy;
       }
-      if (tile->flags & FLAG_FLIPY) {
-        srcy = tileset->height - srcy - 1;
+      if (column != NULL) {
+        column += start;
+        for (x = 0; x < width; x++) {
+          xpos[x] = WrapLayerPixel(xstart + x + column[x].dx, layer->width, xmask);
+          ypos[x] = WrapLayerPixel(ystart + column[x].dy, layer->height, ymask);
+        }
       }
-
-      /* paint tile scanline */
-      *dstpixel = GetTilesetPixel (tileset, tile_index, srcx, srcy);
+      else {
+        ystart = WrapLayerPixel(ystart, layer->height, ymask);
+        for (x = 0; x < width; x++) {
+          xpos[x] = WrapLayerPixel(xstart + x, layer->width, xmask);
+          ypos[x] = ystart;
+        }
+      }
+      break;
     }
 
-    /* next pixel */
-    x++;
-    dstpixel++;
-    pixel_map++;
+    case PIXEL_MAP_TILED: {
+      const int map_width = layer->pixel_map_width;
+      const TLN_PixelMap *row = &layer->pixel_map[(nscan % layer->pixel_map_height) * map_width];
+      const int xstart = layer->hstart + start;
+      const int ystart = layer->vstart + nscan;
+      int column = start % map_width;
+
+      /* one run per repetition of the table row, so the inner loop has no wrap test */
+      for (x = 0; x < width; column = 0) {
+        const int end = x + map_width - column < width ? x + map_width - column : width;
+        const TLN_PixelMap *item = row + column - x;
+
+        for (; x < end; x++) {
+          xpos[x] = WrapLayerPixel(xstart + x + item[x].dx, layer->width, xmask);
+          ypos[x] = WrapLayerPixel(ystart + item[x].dy, layer->height, ymask);
+        }
+      }
+      break;
+    }
   }
+}
 
-  draw_end:
-  if (layer->mosaic.h != 0) {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = layer->mosaic.buffer + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
+/* draw scanline of tiled background with per-pixel mapping */
+static bool DrawLayerScanlinePixelMapping(Worker *worker, int nlayer, int nscan) {
+  const Layer *layer = worker->layers[nlayer];
+  const TLN_Tileset tileset = layer->tileset;
+  const TLN_Tilemap tilemap = layer->tilemap;
+  const int width = layer->clip.x2 - layer->clip.x1;
+  AffineSpan span;
 
-    if (layer->blend != NULL) {
-      BlitMosaicBlend(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w, layer->blend);
-    }
-    else {
-      BlitMosaicSolid(srcptr, tile->flags & FLAG_PALETTES, dstptr, width, layer->mosaic.w);
-    }
+  if (width <= 0) {
+    return false;
   }
-  else {
-    int offset = (layer->clip.x1 << shift);
-    uint8_t *srcptr = engine->tmpindex + offset;
-    uint8_t *dstptr = GetFramebufferLine (nscan) + offset;
-    int width = layer->clip.x2 - layer->clip.x1;
 
-    layer->blitters[1](srcptr, tile->flags & FLAG_PALETTES, dstptr, width, 1, 0, layer->blend);
-  }
-  return true;
+  GetPixelMapLine(worker, layer, nscan, layer->clip.x1, width);
+  span.tiles = tilemap->tiles;
+  span.cols = tilemap->cols;
+  span.indexes = tileset->tiles;
+  span.pixels = tileset->data;
+  span.hshift = tileset->hshift;
+  span.vshift = tileset->vshift;
+  span.palettes = worker->palettes;
+  span.blend_mode = layer->blend_mode;
+  span.blend = layer->blend;
+  BlitPixelMap(&span, worker->sample_x, worker->sample_y, (uint32_t *) worker->scan + layer->clip.x1, width);
+  return false;
 }
 
 /* draw sprite scanline */
-static bool DrawSpriteScanline(int nsprite, int nscan) {
+static bool DrawSpriteScanline(Worker *worker, int nsprite, int nscan) {
+  const Engine *context = worker->context;
   int w;
-  Sprite *sprite;
+  const Sprite *sprite;
   uint8_t *srcpixel;
   uint8_t *dstscan;
   uint32_t *dstpixel;
   int srcx, srcy;
   int direction;
 
-  sprite = &engine->sprites[nsprite];
-  dstscan = GetFramebufferLine(nscan);
+  sprite = &context->sprites[nsprite];
+  dstscan = GetFramebufferLine(context, nscan);
 
-  srcx = sprite->srcrect.x1;
-  srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1);
+  srcx = sprite->srcx;
+  srcy = sprite->srcy + (nscan - sprite->dstrect.y1);
   w = sprite->dstrect.x2 - sprite->dstrect.x1;
 
-  /* H/V flip */
-  if (sprite->flags & FLAG_FLIPX) {
-    direction = -1;
-    srcx = sprite->info.w - srcx - 1;
-  }
-  else {
-    direction = 1;
-  }
+  /* V flip */
   if (sprite->flags & FLAG_FLIPY) {
-    srcy = sprite->info.h - srcy - 1;
+    srcy = sprite->tileset->height - srcy - 1;
   }
 
-  /*
-#define GetTilesetPixel(tileset, index, x, y) \
-  tileset->data[(((index << tileset->vshift) + y) << tileset->hshift) + x]
-   */
-
-  //srcpixel = sprite->pixels + (srcy * sprite->pitch) + srcx;
-  srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, srcx, srcy);
+  /* H flip: forwards through the mirrored rows if the tileset keeps them */
+  direction = 1;
+  if (!(sprite->flags & FLAG_FLIPX)) {
+    srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, srcx, srcy);
+  }
+  else if (sprite->tileset->mirror != NULL) {
+    srcpixel = &GetTilesetMirrorPixel(sprite->tileset, sprite->tileset_entry, srcx, srcy);
+  }
+  else {
+    direction = -1;
+    srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, sprite->tileset->width - srcx - 1, srcy);
+  }
 
   dstpixel = (uint32_t *) (dstscan + (sprite->dstrect.x1 << 2));
-  sprite->blitter(srcpixel, sprite->palette_id, dstpixel, w, direction, 0, sprite->blend);
-
-  if (sprite->do_collision) {
-    uint16_t *dstpixel = engine->collision + sprite->dstrect.x1;
-    DrawSpriteCollision(nsprite, srcpixel, dstpixel, w, direction);
+  sprite->blitter(srcpixel, GetPaletteColors(worker, sprite->palette_id), dstpixel, w, direction, 0, sprite->blend);
+
+  if (sprite->collide & COLLIDE_SPRITES) {
+    uint16_t *dstpixel = worker->collision + sprite->dstrect.x1;
+    ClearCollision(worker);
+    BlitCollision(srcpixel, dstpixel, w, direction, nsprite, &worker->overlap);
+    if (worker->overlap.count > 0) {
+      CountSpriteCollisions(worker, nsprite);
+    }
+  }
+  if (sprite->collide & COLLIDE_LAYERS) {
+    CheckLayerCollision(worker, nsprite, nscan, srcpixel, direction * int2fix(1), 0);
   }
   return true;
 }
 
 /* draw sprite scanline with scaling */
-static bool DrawScalingSpriteScanline(int nsprite, int nscan) {
-  Sprite *sprite;
+static bool DrawScalingSpriteScanline(Worker *worker, int nsprite, int nscan) {
+  const Engine *context = worker->context;
+  const Sprite *sprite;
+  const SpriteInfo *info;
   uint8_t *srcpixel;
   uint8_t *dstscan;
   uint32_t *dstpixel;
   int srcx, srcy;
-  int dstw, dstx, dx;
+  int dstw, dx;
 
-  sprite = &engine->sprites[nsprite];
+  /* the scaling step isn't part of the draw record */
+  sprite = &context->sprites[nsprite];
+  info = &context->sprite_info[nsprite];
 
-  dstscan = GetFramebufferLine(nscan);
-  srcx = sprite->srcrect.x1;
-  srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1) * sprite->dy;
+  /* source coordinates are fixed point: srcy selects the row, srcx is passed as blitter offset */
+  dstscan = GetFramebufferLine(context, nscan);
+  srcx = sprite->srcx;
+  srcy = sprite->srcy + (nscan - sprite->dstrect.y1) * info->dy;
   dstw = sprite->dstrect.x2 - sprite->dstrect.x1;
 
-  /* H/V flip */
-  if (sprite->flags & FLAG_FLIPX) {
-    srcx = int2fix(sprite->info.w) - srcx;
-    dstx = sprite->dstrect.x2;
-    dx = -sprite->dx;
-  }
-  else {
-    dstx = sprite->dstrect.x1;
-    dx = sprite->dx;
-  }
+  /* V flip */
   if (sprite->flags & FLAG_FLIPY) {
-    srcy = int2fix(sprite->info.h) - srcy;
+    srcy = int2fix(sprite->tileset->height) - srcy - 1;
   }
 
-  srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, srcx, srcy);
+  /* H flip: forwards through the mirrored rows if the tileset keeps them */
+  dx = info->dx;
+  if (!(sprite->flags & FLAG_FLIPX)) {
+    srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, 0, fix2int(srcy));
+  }
+  else if (sprite->tileset->mirror != NULL) {
+    srcpixel = &GetTilesetMirrorPixel(sprite->tileset, sprite->tileset_entry, 0, fix2int(srcy));
+  }
+  else {
+    srcx = int2fix(sprite->tileset->width) - srcx - 1;
+    dx = -info->dx;
+    srcpixel = &GetTilesetPixel(sprite->tileset, sprite->tileset_entry, 0, fix2int(srcy));
+  }
   dstpixel = (uint32_t *) (dstscan + (sprite->dstrect.x1 << 2));
-  sprite->blitter(srcpixel, sprite->palette_id, dstpixel, dstw, dx, srcx, sprite->blend);
-
-  if (sprite->do_collision) {
-    uint16_t *dstpixel = engine->collision + sprite->dstrect.x1;
-    DrawSpriteCollisionScaling(nsprite, srcpixel, dstpixel, dstw, dx, srcx);
+  sprite->blitter(srcpixel, GetPaletteColors(worker, sprite->palette_id), dstpixel, dstw, dx, srcx,
+                  sprite->blend);
+
+  if (sprite->collide & COLLIDE_SPRITES) {
+    uint16_t *dstpixel = worker->collision + sprite->dstrect.x1;
+    ClearCollision(worker);
+    BlitCollisionScaling(srcpixel, dstpixel, dstw, dx, srcx, nsprite, &worker->overlap);
+    if (worker->overlap.count > 0) {
+      CountSpriteCollisions(worker, nsprite);
+    }
+  }
+  if (sprite->collide & COLLIDE_LAYERS) {
+    CheckLayerCollision(worker, nsprite, nscan, srcpixel, dx, srcx);
   }
   return true;
 }
 
-/* updates per-pixel sprite collision buffer */
-static void DrawSpriteCollision(int nsprite, const uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx) {
-  while (width) {
-    if (*srcpixel) {
-      if (*dstpixel != 0xFFFF) {
-        engine->sprites[nsprite].collision = true;
-        engine->sprites[*dstpixel].collision = true;
+/*
+ * the collision buffer is only cleared on scanlines where colliding sprites are drawn, once for the whole
+ * scanline: a memset per sprite costs more than clearing the parts no sprite covers
+ */
+static void ClearCollision(Worker *worker) {
+  if (!worker->collision_clear) {
+    memset(worker->collision, -1, worker->context->framebuffer.width * sizeof(uint16_t));
+    worker->collision_clear = true;
+  }
+}
+
+/*
+ * moves the pixels the sprite was drawn over other sprites on the scanline to the counts of their pairs. The
+ * pairs are looked up once per sprite covered, not per pixel
+ */
+static void CountSpriteCollisions(Worker *worker, int nsprite) {
+  const Broadphase *broadphase = &worker->context->broadphase;
+  OverlapCounts *overlap = &worker->overlap;
+  int c;
+
+  for (c = 0; c < overlap->count; c++) {
+    const int other = overlap->sprites[c];
+    const int index = GetCandidatePair(broadphase, nsprite, other);
+
+    /* any sprite below is a candidate: the rectangles of both overlap */
+    if (index != -1) {
+      CollisionCount *pair = &worker->pair_counts[index];
+      if (pair->pixels == 0) {
+        pair->line = worker->line;
+        worker->touched_pairs[worker->num_touched_pairs++] = index;
       }
-      *dstpixel = (uint16_t) nsprite;
+      pair->pixels += overlap->pixels[other];
     }
-    srcpixel += dx;
-    dstpixel++;
-    width--;
+    overlap->pixels[other] = 0;
   }
+  overlap->count = 0;
 }
 
-/* updates per-pixel sprite collision buffer for scaled sprite */
-static void
-DrawSpriteCollisionScaling(int nsprite, uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int srcx) {
-  while (width) {
-    uint32_t src = *(srcpixel + srcx / (1 << FIXED_BITS));
-    if (src) {
-      if (*dstpixel != 0xFFFF) {
-        engine->sprites[nsprite].collision = true;
-        engine->sprites[*dstpixel].collision = true;
+/*
+ * fills the worker sample buffers with the layer position under pixels [x, x + width) of a scanline, as the
+ * drawer of each mode walks it. Mosaic isn't applied. Returns false if the layer has nothing on the scanline
+ */
+static bool GetLayerSamples(Worker *worker, Layer *layer, int nscan, int x, int width) {
+  const TLN_Tileset tileset = layer->tileset;
+  const fix_t layer_width = int2fix(layer->width);
+  const fix_t layer_height = int2fix(layer->height);
+  const int ymask = (layer->height & (layer->height - 1)) == 0 ? layer->height - 1 : 0;
+  const fix_t fix_xmask = (layer->width & (layer->width - 1)) == 0 ? layer_width - 1 : 0;
+  const fix_t fix_ymask = ymask != 0 ? layer_height - 1 : 0;
+  int *xpos = worker->sample_x;
+  int *ypos = worker->sample_y;
+  int c;
+
+  switch (layer->mode) {
+    case MODE_NORMAL: {
+      const int line_ypos = (layer->vstart + nscan) % layer->height;
+      int column_x = (layer->hstart + x) % layer->width;
+      for (c = 0; c < width; c++) {
+        xpos[c] = column_x;
+        ypos[c] = layer->column ? GetColumnYPos(layer, line_ypos, GetLayerColumn(layer, x + c)) : line_ypos;
+        if (++column_x == layer->width) {
+          column_x = 0;
+        }
       }
-      *dstpixel = (uint16_t) nsprite;
+      return true;
     }
 
-    /* next pixel */
-    srcx += dx;
-    dstpixel++;
-    width--;
+    case MODE_SCALING: {
+      const fix_t step = layer->dx > 0 ? layer->dx : 1;
+      const int line_ypos = WrapLayerPixel(layer->vstart + fix2int(nscan * layer->dy), layer->height, ymask);
+      fix_t fix_x = WrapAffine((fix_t) (int2fix(layer->hstart) + (int64_t) x * step), layer_width, fix_xmask);
+      for (c = 0; c < width; c++) {
+        const int column = (int) ((int2fix(layer->hstart & tileset->hmask) + (int64_t) (x + c) * step) >>
+                                  (FIXED_BITS + tileset->hshift));
+        xpos[c] = fix2int(fix_x);
+        ypos[c] = layer->column ? GetColumnYPos(layer, line_ypos, column) : line_ypos;
+        fix_x = WrapAffine(fix_x + step, layer_width, fix_xmask);
+      }
+      return true;
+    }
+
+    case MODE_TRANSFORM:
+    case MODE_PERSPECTIVE: {
+      fix_t fix_x, fix_y, dx, dy;
+      if (!GetTransformedLine(worker->context, layer, nscan, x, &fix_x, &fix_y, &dx, &dy)) {
+        return false;
+      }
+      fix_x = WrapAffine(fix_x, layer_width, fix_xmask);
+      fix_y = WrapAffine(fix_y, layer_height, fix_ymask);
+      for (c = 0; c < width; c++) {
+        xpos[c] = fix2int(fix_x);
+        ypos[c] = fix2int(fix_y);
+        if (layer->column != NULL) {
+          const fix_t offset = int2fix(GetColumnOffset(layer, GetLayerColumn(layer, x + c)));
+          ypos[c] = fix2int(WrapAffine(fix_y + offset, layer_height, fix_ymask));
+        }
+        fix_x = WrapAffine(fix_x + dx, layer_width, fix_xmask);
+        fix_y = WrapAffine(fix_y + dy, layer_height, fix_ymask);
+      }
+      return true;
+    }
+
+    case MODE_PIXEL_MAP:
+      GetPixelMapLine(worker, layer, nscan, x, width);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* checks if a layer has an opaque pixel at a layer position */
+static inline bool IsLayerPixelOpaque(const Layer *layer, int x, int y) {
+  const TLN_Tileset tileset = layer->tileset;
+  const Tile *tile = &layer->tilemap->tiles[(y >> tileset->vshift) * layer->tilemap->cols + (x >> tileset->hshift)];
+  int srcx, srcy;
+
+  if (tile->index == 0) {
+    return false;
   }
+  srcx = (tile->flags & FLAG_FLIPX) ? tileset->hmask - (x & tileset->hmask) : x & tileset->hmask;
+  srcy = (tile->flags & FLAG_FLIPY) ? tileset->vmask - (y & tileset->vmask) : y & tileset->vmask;
+  return GetTilesetPixel(tileset, tileset->tiles[tile->index], srcx, srcy) != 0;
+}
+
+/*
+ * sprite vs layer collision: looks for opaque pixels of the layers tested by the sprite under its opaque pixels
+ * on the scanline. The sprite row is read as the scaling drawer does, with fixed point step dx from srcx. Layers
+ * already found in the band aren't tested again
+ */
+static void CheckLayerCollision(Worker *worker, int nsprite, int nscan, const uint8_t *srcpixel, int dx, int srcx) {
+  const Engine *context = worker->context;
+  const Sprite *sprite = &context->sprites[nsprite];
+  uint32_t layers = context->sprite_info[nsprite].layer_mask & ~worker->layer_hits.layers[nsprite];
+  uint32_t found = 0;
+
+  while (layers != 0) {
+    const int nlayer = LowestBit(layers);
+    Layer *layer;
+    int x1, x2, c;
+    fix_t src;
+
+    layers &= layers - 1;
+    if (nlayer >= context->numlayers) {
+      break;
+    }
+    layer = worker->layers[nlayer];
+    if (!layer->ok || nscan < layer->clip.y1 || nscan > layer->clip.y2) {
+      continue;
+    }
+
+    /* part of the sprite inside the layer clip */
+    x1 = sprite->dstrect.x1 > layer->clip.x1 ? sprite->dstrect.x1 : layer->clip.x1;
+    x2 = sprite->dstrect.x2 < layer->clip.x2 ? sprite->dstrect.x2 : layer->clip.x2;
+    if (x1 >= x2 || !GetLayerSamples(worker, layer, nscan, x1, x2 - x1)) {
+      continue;
+    }
+
+    src = srcx + (x1 - sprite->dstrect.x1) * dx;
+    for (c = 0; c < x2 - x1; c++) {
+      if (srcpixel[fix2int(src)] && IsLayerPixelOpaque(layer, worker->sample_x[c], worker->sample_y[c])) {
+        found |= 1u << nlayer;
+        break;
+      }
+      src += dx;
+    }
+  }
+  AddLayerHits(&worker->layer_hits, nsprite, found);
 }
 
 /* draw modes */
@@ -781,13 +1205,69 @@ enum {
 /* table of function pointers to draw procedures */
 static const ScanDrawPtr drawers[MAX_DRAW_TYPE][MAX_DRAW_MODE] =
         {
-                {DrawSpriteScanline, DrawScalingSpriteScanline, NULL, NULL},
-                {DrawLayerScanline,  DrawLayerScanlineScaling, DrawLayerScanlineAffine, DrawLayerScanlinePixelMapping},
+                {DrawSpriteScanline, DrawScalingSpriteScanline, NULL, NULL, NULL},
+                {DrawLayerScanline,  DrawLayerScanlineScaling, DrawLayerScanlineAffine, DrawLayerScanlinePixelMapping,
+                        DrawLayerScanlineAffine},
         };
 
+/*
+ * draw scanline of a layer with mosaic. The first scanline of each block is drawn with the regular
+ * drawer of the layer into a 32 bpp span of the worker, without blending, and pixelated horizontally.
+ * Every scanline of the block then copies or blends that span
+ */
+static bool DrawLayerScanlineMosaic(Worker *worker, int nlayer, int nscan) {
+  const Engine *context = worker->context;
+  Layer *layer = worker->layers[nlayer];
+  const int sample = nscan - nscan % layer->mosaic.h;
+  uint32_t *span = worker->mosaic + nlayer * context->framebuffer.width + layer->clip.x1;
+  const int width = layer->clip.x2 - layer->clip.x1;
+
+  if (width <= 0) {
+    return false;
+  }
+
+  if (worker->mosaic_line[nlayer] != sample) {
+    uint8_t *scan = worker->scan;
+    uint8_t *priority = worker->priority;
+    const uint32_t *cull = worker->cull;
+    Layer plain = *layer;
+    int x;
+
+    /* redirect the drawer to the span. Tiles with priority are drawn in place, the span is reused later */
+    plain.blend_mode = BLEND_NONE;
+    plain.blend = NULL;
+    worker->layers[nlayer] = &plain;
+    worker->scan = (uint8_t *) (worker->mosaic + nlayer * context->framebuffer.width);
+    worker->priority = worker->scan;
+    worker->cull = NULL;
+    memset(span, 0, width * sizeof(uint32_t));
+    drawers[DRAW_TILED_LAYER][layer->mode](worker, nlayer, sample);
+    worker->layers[nlayer] = layer;
+    worker->scan = scan;
+    worker->priority = priority;
+    worker->cull = cull;
+
+    for (x = 0; x < width; x += layer->mosaic.w) {
+      BlitColor(span + x, span[x], x + layer->mosaic.w < width ? layer->mosaic.w : width - x);
+    }
+    worker->mosaic_line[nlayer] = sample;
+  }
+
+  if (layer->blend_mode == BLEND_NONE) {
+    BlitOverlay(span, (uint32_t *) worker->scan + layer->clip.x1, width);
+  }
+  else {
+    BlitOverlayBlend(span, (uint32_t *) worker->scan + layer->clip.x1, width, layer->blend_mode, layer->blend);
+  }
+  return false;
+}
+
 /* returns suitable draw procedure based on layer configuration */
 ScanDrawPtr GetLayerDraw(Layer *layer) {
-  if (layer->tilemap != NULL) {
+  if (layer->tilemap != NULL && layer->mosaic.h != 0) {
+    return DrawLayerScanlineMosaic;
+  }
+  else if (layer->tilemap != NULL) {
     return drawers[DRAW_TILED_LAYER][layer->mode];
   }
   else {
@@ -18,17 +18,36 @@ typedef enum {
     MODE_SCALING,
     MODE_TRANSFORM,
     MODE_PIXEL_MAP,
+    MODE_PERSPECTIVE,
     MAX_DRAW_MODE
 } draw_t;
 
-typedef bool (*ScanDrawPtr)(int, int);
+typedef struct Worker Worker;
+
+typedef bool (*ScanDrawPtr)(Worker *, int, int);
 
 typedef struct Layer Layer;
 
+struct Engine;
+
+/* per-frame draw list built by PrepareFrame(), only read while scanlines are drawn */
+typedef struct DrawList {
+    int numlayers;    /* enabled layers behind sprites */
+    int *layers;    /* their indexes, back to front */
+    int numpriority;    /* enabled layers in front of sprites */
+    int *priority;    /* their indexes, back to front */
+} DrawList;
+
 ScanDrawPtr GetLayerDraw(Layer *layer);
 
 ScanDrawPtr GetSpriteDraw(draw_t mode);
 
-extern bool DrawScanline(void);
+extern bool DrawScanline(Worker *worker);
+
+extern void PrepareFrame(struct Engine *context);
+
+bool CreateDrawList(struct Engine *context);
+
+void DeleteDrawList(struct Engine *context);
 
 #endif
@@ -16,15 +16,17 @@
 #include "Sprite.h"
 #include "Layer.h"
 #include "Blitters.h"
+#include "Worker.h"
+#include "Palette.h"
+#include "Threads.h"
 
 /* motor */
 typedef struct Engine {
     uint32_t header;      /* object signature to identify as engine context */
-    uint8_t *priority;    /* buffer receiving tiles with priority */
-    uint16_t *collision;    /* buffer with sprite coverage IDs for per-pixel collision */
-    uint8_t *tmpindex;    /* buffer for intermediate scanline output  */
     int numsprites;    /* number of sprites */
-    Sprite *sprites;    /* pointer to sprite buffer */
+    Sprite *sprites;    /* sprite draw records, aligned to SPRITE_RECORD_SIZE inside sprite_memory */
+    SpriteInfo *sprite_info;  /* rest of the sprite state */
+    void *sprite_memory;  /* allocation holding the sprite draw records */
     int numlayers;    /* number of layers */
     Layer *layers;      /* pointer to layer buffer */
     bool dopriority;    /* there is some data in "priority" buffer that need blitting */
@@ -33,16 +35,46 @@ typedef struct Engine {
 
     uint32_t bgcolor;    /* background color */
     ScanBlitPtr blit_fast;    /* blitter for background bitmap */
+    struct Palette *palettes[256];  /* palettes by TLN_PaletteId */
+    const uint32_t *bgcolor_table;  /* background color of each line, see TLN_SetBGColorTable() */
+    const TLN_PaletteId *palette_tables[256];  /* palette drawn instead of each one on each line */
+    int numpalette_tables;  /* palette_tables in use */
+    uint8_t *blend_tables[MAX_BLEND];  /* lookup tables by blend mode */
     uint8_t *blend_table;  /* current blending table */
     void (*cb_raster)(int);  /* raster callback */
     void (*cb_frame)(int);  /* frame callback */
     int frame;          /* current frame number */
-    int line;          /* current scanline */
 
     int sprite_mask_top;    /* top scanline for sprite masking */
     int sprite_mask_bottom;    /* bottom scanline for sprite masking */
     int xworld, yworld;      /* world coordinates with TLN_SetWorldPosition() */
     bool dirty;          /* world position updated since last draw */
+    bool sprites_dirty;    /* some sprite needs UpdateSprite() before the next draw */
+    int numbuckets;    /* number of sprite buckets */
+    SpriteBucket *buckets;  /* sprites overlapping each band of scanlines, in drawing order */
+    SpriteList sprite_order;  /* enabled sprites in drawing order, see TLN_SetFirstSprite() */
+    SpriteList sprite_free;  /* disabled sprites, the last disabled first */
+    uint32_t *sprite_enabled;  /* bit per sprite in sprite_order, places enabled sprites by index */
+    int rank_first, rank_last;  /* ranks at the ends of sprite_order */
+    bool sprite_order_dirty;  /* ranks and buckets need SortSpriteBuckets() */
+    Broadphase broadphase;  /* sprites with collision whose rectangles overlap */
+    CollisionList collisions;  /* sprite pairs that collided in the last frame, see TLN_GetSpriteCollisions() */
+    LayerHits layer_hits;  /* layers under each sprite in the last frame, see TLN_GetSpriteLayerCollision() */
+    DrawList drawlist;    /* layers to draw in the current frame */
+    bool occlusion;    /* skip pixels hidden by opaque layers, see TLN_EnableOcclusionCulling() */
+
+    int numworkers;    /* number of scanline workers (render threads) */
+    Worker *workers;    /* scanline workers, workers[0] draws on the caller's thread */
+    int tilecache_size;    /* tile cache bytes per worker, 0 = disabled */
+    struct {
+        mutex_t lock;
+        cond_t start;    /* signaled when a new frame is dispatched */
+        cond_t done;    /* signaled when the last worker finishes its band */
+        int generation;    /* frame dispatch counter */
+        int pending;    /* workers still drawing the current frame */
+        bool active;    /* sync objects created (more than one worker) */
+        bool quit;      /* render threads must exit */
+    } pool;
 
     struct {
         int width;
@@ -52,11 +84,15 @@ typedef struct Engine {
     } framebuffer;
 } Engine;
 
-extern Engine *engine;
+extern THREAD_LOCAL Engine *engine;  /* current context of the calling thread */
 
 extern void tln_trace(TLN_LogLevel log_level, const char *format, ...);
 
-#define GetFramebufferLine(line) \
-  (engine->framebuffer.data + ((line)*engine->framebuffer.pitch))
+#define GetFramebufferLine(context, line) \
+  ((context)->framebuffer.data + ((line)*(context)->framebuffer.pitch))
+
+/* colors of a palette, from the context or from a worker with the palette line tables applied */
+#define GetPaletteColors(context, palette_id) \
+  ((const uint32_t *) (context)->palettes[palette_id]->data)
 
 #endif
@@ -10,6 +10,7 @@
  * */
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include "Engine.h"
 #include "Draw.h"
@@ -20,6 +21,8 @@
 
 static void SelectBlitter(Layer *layer);
 
+static void SetLayerPosition(Layer *layer, int hstart, int vstart);
+
 /*!
  * \brief Configures a tiled background layer with the specified tilemap
  * \param nlayer Layer index [0, num_layers - 1]
@@ -165,6 +168,7 @@ bool TLN_SetLayerBlendMode(int nlayer, TLN_Blend mode) {
 
   layer = &engine->layers[nlayer];
   layer->blend = SelectBlendTable(mode);
+  layer->blend_mode = mode;
   SelectBlitter(layer);
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -243,16 +247,7 @@ bool TLN_SetLayerPosition(int nlayer, int hstart, int vstart) {
     return false;
   }
 
-  /* wrapping */
-  layer->hstart = hstart % layer->width;
-  layer->vstart = vstart % layer->height;
-  if (layer->hstart < 0) {
-    layer->hstart += layer->width;
-  }
-  if (layer->vstart < 0) {
-    layer->vstart += layer->height;
-  }
-
+  SetLayerPosition(layer, hstart, vstart);
   TLN_SetLastError(TLN_ERR_OK);
   if (layer->tilemap && layer->tilemap->visible) {
     layer->ok = true;
@@ -281,9 +276,10 @@ bool TLN_SetLayerPosition(int nlayer, int hstart, int vstart) {
  * 
  * \remarks
  * Use this function to implement collision detection between sprites and the main background layer.
+ * To check many sprites at pixel level, TLN_EnableSpriteLayerCollision() tests them while they are drawn
  * 
  * \see
- * TLN_TileInfo
+ * TLN_TileInfo, TLN_EnableSpriteLayerCollision()
  */
 bool TLN_GetLayerTile(int nlayer, int x, int y, TLN_TileInfo *info) {
 #pragma EXPORT_FUNC
@@ -321,12 +317,12 @@ bool TLN_GetLayerTile(int nlayer, int x, int y, TLN_TileInfo *info) {
   xtile = xpos >> tileset->hshift;
   srcx = xpos & tileset->hmask;
 
+  /* screen column of the pixel, as counted by the drawers. Out of the screen takes the nearest column */
   if (layer->column) {
-    column = x / tileset->width;
-    if (xpos != 0 && x > xpos) {
-      column++;
-    }
-    column_offset = layer->column[column];
+    const int numcolumns = engine->framebuffer.width / tileset->width + 2;
+    const int screenx = (xpos - layer->hstart + layer->width) % layer->width;
+    column = (screenx + (layer->hstart & tileset->hmask)) >> tileset->hshift;
+    column_offset = layer->column[column < numcolumns ? column : numcolumns - 1];
   }
 
   ypos = (y + column_offset) % layer->height;
@@ -365,11 +361,15 @@ bool TLN_GetLayerTile(int nlayer, int x, int y, TLN_TileInfo *info) {
  * Layer index [0, num_layers - 1]
  * 
  * \param offset
- * Array of offsets to set. Set NULL to disable column offset mode
+ * Array of offsets to set, one per tile column that fits in the framebuffer plus 2.
+ * Set NULL to disable column offset mode
  * 
  * Column offset is a value that is added or substracted (depeinding on the
  * sign) to the vertical position for that layer (see TLN_SetLayerPosition) for
- * each column in the tilemap assigned to that layer. 
+ * each column in the tilemap assigned to that layer. The array stays linked to the
+ * layer and is read again at the start of each frame. Offsets are in layer pixels,
+ * so they scale along with scaled layers, and displace the tiles along the layer
+ * vertical axis in affine and perspective modes
  * 
  * \remarks
  * This feature is tipically used to simulate vertical strips moving at different
@@ -379,12 +379,29 @@ bool TLN_GetLayerTile(int nlayer, int x, int y, TLN_TileInfo *info) {
  */
 bool TLN_SetLayerColumnOffset(int nlayer, int *offset) {
 #pragma EXPORT_FUNC
+  Layer *layer;
   if (nlayer >= engine->numlayers) {
     TLN_SetLastError(TLN_ERR_IDX_LAYER);
     return false;
   }
 
-  engine->layers[nlayer].column = offset;
+  layer = &engine->layers[nlayer];
+  if (offset != NULL && layer->column_offset == NULL) {
+    layer->column_offset = (int *) malloc((engine->framebuffer.width + 2) * sizeof(int));
+    if (layer->column_offset == NULL) {
+      TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+      return false;
+    }
+  }
+  else if (offset == NULL) {
+    free(layer->column_offset);
+    layer->column_offset = NULL;
+  }
+  layer->column = offset;
+  layer->num_columns = 0;
+  if (offset != NULL && layer->tileset != NULL && layer->height > 0) {
+    UpdateLayerColumns(engine, layer);
+  }
   TLN_SetLastError(TLN_ERR_OK);
   return true;
 }
@@ -545,6 +562,60 @@ bool TLN_SetLayerTransform(int layer, float angle, float dx, float dy, float sx,
   return TLN_SetLayerAffineTransform(layer, &affine);
 }
 
+/*!
+ * \brief
+ * Projects the layer as a floor seen in perspective from a camera
+ * 
+ * \param nlayer
+ * Layer index [0, num_layers - 1]
+ * 
+ * \param perspective
+ * Pointer to a TLN_Perspective with the camera parameters, or NULL to disable it
+ * 
+ * Each scanline below the horizon samples the layer along a straight line whose distance and scale
+ * depend on the camera height and focal length, like the Mode 7 floors of the Super Nintendo.
+ * The per line parameters are computed internally in fixed point, so no raster callback is needed.
+ * Lines above the horizon are left empty. The camera position replaces the layer position.
+ *
+ * \remarks
+ * Call this function once per frame to move the camera. It can also be called inside a raster
+ * callback to change the camera in the middle of the frame.
+ * 
+ * \see
+ * TLN_SetLayerAffineTransform(), TLN_ResetLayerMode()
+ */
+bool TLN_SetLayerPerspective(int nlayer, TLN_Perspective *perspective) {
+#pragma EXPORT_FUNC
+  Layer *layer;
+  if (nlayer >= engine->numlayers) {
+    TLN_SetLastError(TLN_ERR_IDX_LAYER);
+    return false;
+  }
+
+  if (perspective == NULL) {
+    return TLN_ResetLayerMode(nlayer);
+  }
+
+  layer = &engine->layers[nlayer];
+  {
+    const float angle = (float) fmod(perspective->angle, 360.0f) * 3.1415926f / 180;
+
+    layer->perspective.x = float2fix(perspective->x);
+    layer->perspective.y = float2fix(perspective->y);
+    layer->perspective.height = float2fix(perspective->height);
+    layer->perspective.focal = float2fix(perspective->focal);
+    layer->perspective.cos = float2fix((float) cos(angle));
+    layer->perspective.sin = float2fix((float) sin(angle));
+    layer->perspective.horizon = perspective->horizon;
+  }
+
+  layer->mode = MODE_PERSPECTIVE;
+  layer->draw = GetLayerDraw(layer);
+  SelectBlitter(layer);
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
 /*!
  * \brief
  * Sets simple scaling
@@ -586,6 +657,46 @@ bool TLN_SetLayerScaling(int nlayer, float sx, float sy) {
   return true;
 }
 
+/*!
+ * \brief
+ * Sets tables with the parameters of the layer on each scanline
+ * 
+ * \param nlayer
+ * Layer index [0, num_layers - 1]
+ * 
+ * \param tables
+ * Pointer to a TLN_LayerLines with arrays of one entry per line of the framebuffer, or NULL to
+ * disable them. Arrays left NULL keep the value set for the whole layer
+ * 
+ * Each scanline the layer is drawn with the position, horizontal scaling, horizontal clip and blend
+ * mode found in the tables for that line, like the HDMA channels of the Super Nintendo. This gives
+ * line scroll, wobbling and split screen effects without a raster callback, so frames are still drawn
+ * in parallel by the render threads. The arrays aren't copied, so they can be updated between frames.
+ * 
+ * \see
+ * TLN_SetBGColorTable(), TLN_SetPaletteLineTable(), TLN_SetRasterCallback()
+ */
+bool TLN_SetLayerLineTables(int nlayer, const TLN_LayerLines *tables) {
+#pragma EXPORT_FUNC
+  Layer *layer;
+  if (nlayer >= engine->numlayers) {
+    TLN_SetLastError(TLN_ERR_IDX_LAYER);
+    return false;
+  }
+
+  layer = &engine->layers[nlayer];
+  if (tables != NULL) {
+    layer->lines = *tables;
+    layer->line_tables = true;
+  }
+  else {
+    memset(&layer->lines, 0, sizeof(layer->lines));
+    layer->line_tables = false;
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
 /*!
  * \brief
  * Sets the table for pixel mapping render mode
@@ -596,7 +707,7 @@ bool TLN_SetLayerScaling(int nlayer, float sx, float sy) {
  * User-provided array of hres*vres sized TLN_PixelMap items 
  * 
  * \see
- * TLN_SetLayerScaling(), TLN_SetLayerAffineTransform()
+ * TLN_SetLayerPixelMappingSeparable(), TLN_SetLayerPixelMappingTiled()
  */
 bool TLN_SetLayerPixelMapping(int nlayer, TLN_PixelMap *table) {
 #pragma EXPORT_FUNC
@@ -608,6 +719,96 @@ bool TLN_SetLayerPixelMapping(int nlayer, TLN_PixelMap *table) {
 
   layer = &engine->layers[nlayer];
   layer->pixel_map = table;
+  layer->pixel_map_type = PIXEL_MAP_FULL;
+  if (table != NULL) {
+    layer->mode = MODE_PIXEL_MAP;
+  }
+  else {
+    layer->mode = MODE_NORMAL;
+  }
+  layer->draw = GetLayerDraw(layer);
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Sets separable tables for pixel mapping render mode
+ *
+ * \param nlayer
+ * Layer index [0, num_layers - 1]
+ * \param rows
+ * User-provided array of vres TLN_PixelMap items, displacement of each scanline. Can be NULL
+ * \param columns
+ * User-provided array of hres TLN_PixelMap items, displacement of each column. Can be NULL
+ *
+ * \remarks
+ * Each pixel samples the layer at its own screen position plus the displacement of its scanline
+ * and the displacement of its column. Setting both tables to NULL disables pixel mapping
+ *
+ * \see
+ * TLN_SetLayerPixelMapping(), TLN_SetLayerPixelMappingTiled()
+ */
+bool TLN_SetLayerPixelMappingSeparable(int nlayer, const TLN_PixelMap *rows, const TLN_PixelMap *columns) {
+#pragma EXPORT_FUNC
+  Layer *layer;
+  if (nlayer >= engine->numlayers) {
+    TLN_SetLastError(TLN_ERR_IDX_LAYER);
+    return false;
+  }
+
+  layer = &engine->layers[nlayer];
+  layer->pixel_map_rows = rows;
+  layer->pixel_map_columns = columns;
+  layer->pixel_map_type = PIXEL_MAP_SEPARABLE;
+  if (rows != NULL || columns != NULL) {
+    layer->mode = MODE_PIXEL_MAP;
+  }
+  else {
+    layer->mode = MODE_NORMAL;
+  }
+  layer->draw = GetLayerDraw(layer);
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Sets a tiled table for pixel mapping render mode
+ *
+ * \param nlayer
+ * Layer index [0, num_layers - 1]
+ * \param table
+ * User-provided array of width*height TLN_PixelMap items, or NULL to disable pixel mapping
+ * \param width
+ * Width of the table in items
+ * \param height
+ * Height of the table in items
+ *
+ * \remarks
+ * The table is repeated across the screen: each pixel samples the layer at its own screen position
+ * plus the displacement found at the pixel coordinates modulo the table size
+ *
+ * \see
+ * TLN_SetLayerPixelMapping(), TLN_SetLayerPixelMappingSeparable()
+ */
+bool TLN_SetLayerPixelMappingTiled(int nlayer, const TLN_PixelMap *table, int width, int height) {
+#pragma EXPORT_FUNC
+  Layer *layer;
+  if (nlayer >= engine->numlayers) {
+    TLN_SetLastError(TLN_ERR_IDX_LAYER);
+    return false;
+  }
+  if (table != NULL && (width <= 0 || height <= 0)) {
+    TLN_SetLastError(TLN_ERR_WRONG_SIZE);
+    return false;
+  }
+
+  layer = &engine->layers[nlayer];
+  layer->pixel_map = table;
+  layer->pixel_map_width = width;
+  layer->pixel_map_height = height;
+  layer->pixel_map_type = PIXEL_MAP_TILED;
   if (table != NULL) {
     layer->mode = MODE_PIXEL_MAP;
   }
@@ -615,12 +816,13 @@ bool TLN_SetLayerPixelMapping(int nlayer, TLN_PixelMap *table) {
     layer->mode = MODE_NORMAL;
   }
   layer->draw = GetLayerDraw(layer);
+  TLN_SetLastError(TLN_ERR_OK);
   return true;
 }
 
 /*!
  * \brief
- * Disables scaling or affine transform for the layer
+ * Disables scaling, affine transform or perspective for the layer
  * 
  * \param nlayer
  * Layer index [0, num_layers - 1]
@@ -737,8 +939,9 @@ bool TLN_SetLayerMosaic(int nlayer, int width, int height) {
   }
 
   layer = &engine->layers[nlayer];
-  layer->mosaic.w = width;
-  layer->mosaic.h = height;
+  layer->mosaic.w = width > 0 ? width : 1;
+  layer->mosaic.h = height > 0 ? height : 0;
+  layer->draw = GetLayerDraw(layer);
   SelectBlitter(layer);
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -764,6 +967,8 @@ bool TLN_DisableLayerMosaic(int nlayer) {
 
   layer = &engine->layers[nlayer];
   layer->mosaic.h = 0;
+  layer->draw = GetLayerDraw(layer);
+  SelectBlitter(layer);
   TLN_SetLastError(TLN_ERR_OK);
   return true;
 }
@@ -772,30 +977,79 @@ Layer *GetLayer(int idx) {
   return &engine->layers[idx];
 }
 
-/* updates layer from world position, accounting offset and parallax */
+/* updates layer from world position, accounting offset and parallax. The layer must have a tilemap */
 void UpdateLayer(int nlayer) {
   Layer *layer = GetLayer(nlayer);
   const int lx = (int) (engine->xworld * layer->world.xfactor) - layer->world.offsetx;
   const int ly = (int) (engine->yworld * layer->world.yfactor) - layer->world.offsety;
-  TLN_SetLayerPosition(nlayer, lx, ly);
+  SetLayerPosition(layer, lx, ly);
+}
+
+/* sets the wrapped scroll position of a layer with a valid tilemap */
+static void SetLayerPosition(Layer *layer, int hstart, int vstart) {
+  layer->hstart = hstart % layer->width;
+  layer->vstart = vstart % layer->height;
+  if (layer->hstart < 0) {
+    layer->hstart += layer->width;
+  }
+  if (layer->vstart < 0) {
+    layer->vstart += layer->height;
+  }
+}
+
+/* applies the line tables to a copy of the layer used to draw that scanline */
+void SetLayerLine(const Engine *context, Layer *layer, int line) {
+  const TLN_LayerLines *lines = &layer->lines;
+  const int width = context->framebuffer.width;
+
+  if (lines->hstart != NULL || lines->vstart != NULL) {
+    SetLayerPosition(layer, lines->hstart != NULL ? lines->hstart[line] : layer->hstart,
+                     lines->vstart != NULL ? lines->vstart[line] : layer->vstart);
+  }
+  if (lines->xfactor != NULL && layer->mode == MODE_SCALING) {
+    layer->xfactor = float2fix(lines->xfactor[line]);
+    layer->dx = float2fix((1.0f / lines->xfactor[line]));
+  }
+  if (lines->clip_x1 != NULL) {
+    layer->clip.x1 = lines->clip_x1[line] >= 0 && lines->clip_x1[line] <= width ? lines->clip_x1[line] : 0;
+  }
+  if (lines->clip_x2 != NULL) {
+    layer->clip.x2 = lines->clip_x2[line] >= 0 && lines->clip_x2[line] <= width ? lines->clip_x2[line] : width;
+  }
+  if (lines->blend != NULL && lines->blend[line] != layer->blend_mode) {
+    layer->blend_mode = lines->blend[line];
+    layer->blend = context->blend_tables[layer->blend_mode];
+    SelectBlitter(layer);
+  }
+}
+
+/*
+ * copies the column offsets linked by the user to the table read by the drawers, wrapped to the layer
+ * height. Only the columns that fit in the framebuffer plus two are read, as documented
+ */
+void UpdateLayerColumns(const Engine *context, Layer *layer) {
+  const int numcolumns = context->framebuffer.width / layer->tileset->width + 2;
+  int c;
+
+  for (c = 0; c < numcolumns; c++) {
+    const int offset = layer->column[c] % layer->height;
+    layer->column_offset[c] = offset < 0 ? offset + layer->height : offset;
+  }
+  layer->num_columns = numcolumns;
 }
 
 static void SelectBlitter(Layer *layer) {
   bool scaling = layer->mode == MODE_SCALING;
-  bool blend;
-  int bpp;
+  TLN_Blend blend;
 
-  /* without mosaic effect */
+  /* with mosaic effect the layer is drawn unblended, and blended when copying the sampled line */
   if (layer->mosaic.h == 0) {
-    blend = layer->blend != NULL;
-    bpp = 32;
+    blend = layer->blend_mode;
   }
-    /* with mosaic effect */
   else {
-    blend = false;
-    bpp = 8;
+    blend = BLEND_NONE;
   }
 
-  layer->blitters[0] = GetBlitter(bpp, false, scaling, blend);
-  layer->blitters[1] = GetBlitter(bpp, true, scaling, blend);
+  layer->blitters[0] = GetBlitter(32, false, scaling, blend);
+  layer->blitters[1] = GetBlitter(32, true, scaling, blend);
 }
@@ -17,6 +17,13 @@
 #include "Blitters.h"
 #include "Math2D.h"
 
+/* layout of the pixel mapping tables */
+typedef enum {
+    PIXEL_MAP_FULL,    /* one absolute item per framebuffer pixel */
+    PIXEL_MAP_SEPARABLE,  /* displacement per scanline plus displacement per column */
+    PIXEL_MAP_TILED,    /* small displacement map repeated across the screen */
+} pixelmap_t;
+
 typedef struct Layer {
     TLN_Tileset tileset;  /* pointer to tileset */
     TLN_Tilemap tilemap;  /* pointer to tilemap */
@@ -27,12 +34,31 @@ typedef struct Layer {
     ScanDrawPtr draw;
     ScanBlitPtr blitters[2];
     Matrix3 transform;
-    int *column;    /* column offset (optional) */
+    int *column;    /* column offset linked by the user (optional) */
+    int *column_offset;  /* column offsets of the frame wrapped to [0, height), see UpdateLayerColumns() */
+    int num_columns;  /* entries in column_offset */
     fix_t xfactor;
     fix_t dx;
     fix_t dy;
     uint8_t *blend;    /* pointer to blend table */
-    TLN_PixelMap *pixel_map;  /* pointer to pixel mapping table */
+    TLN_Blend blend_mode;  /* built-in modes blend arithmetically, BLEND_CUSTOM uses the table */
+    const TLN_PixelMap *pixel_map;  /* pointer to full or tiled pixel mapping table */
+    const TLN_PixelMap *pixel_map_rows;  /* separable mapping, displacement per scanline (optional) */
+    const TLN_PixelMap *pixel_map_columns;  /* separable mapping, displacement per column (optional) */
+    int pixel_map_width;  /* size of the tiled mapping table */
+    int pixel_map_height;
+    pixelmap_t pixel_map_type;
+    TLN_LayerLines lines;  /* per-scanline parameters, see TLN_SetLayerLineTables() */
+    bool line_tables;  /* some table in lines is set */
+
+    /* perspective floor, fixed point */
+    struct {
+        fix_t x, y;    /* camera position */
+        fix_t height;  /* camera height */
+        fix_t focal;  /* focal length */
+        fix_t cos, sin;  /* view direction */
+        int horizon;  /* screen line of the horizon */
+    } perspective;
     draw_t mode;
     bool priority;  /* whole layer in front of regular sprites */
 
@@ -55,7 +81,6 @@ typedef struct Layer {
     /* mosaic */
     struct {
         int w, h;      /* tama�o del pixel */
-        uint8_t *buffer;  /* linea temporal */
     } mosaic;
 } Layer;
 
@@ -63,4 +88,10 @@ Layer *GetLayer(int index);
 
 void UpdateLayer(int nlayer);
 
+struct Engine;
+
+void SetLayerLine(const struct Engine *context, Layer *layer, int line);
+
+void UpdateLayerColumns(const struct Engine *context, Layer *layer);
+
 #endif
\ No newline at end of file
@@ -13,9 +13,11 @@
 #include <string.h>
 #include "Object.h"
 #include "Engine.h"
+#include "Threads.h"
 
-static uint32_t numobjects = 0;
-static uint32_t numbytes = 0;
+/* shared by all contexts, objects can be created and deleted from any thread */
+static volatile uint32_t numobjects = 0;
+static volatile uint32_t numbytes = 0;
 
 static const char *object_types[] =
         {
@@ -47,11 +49,10 @@ static const TLN_Error object_errors[] =
 void *CreateBaseObject(ObjectType type, int size) {
   object_t *object = (object_t *) malloc(size);
   if (object) {
-    numobjects++;
-    numbytes += size;
     memset(object, 0, size);
     object->type = type;
-    object->guid = numobjects;
+    object->guid = AtomicAdd(&numobjects, 1);
+    AtomicAdd(&numbytes, size);
     object->size = size;
     object->owner = true;
     tln_trace(TLN_LOG_VERBOSE, "%s created at %p, %d size", object_types[type], object, size);
@@ -77,8 +78,8 @@ void *CloneBaseObject(void *object) {
 /* elimina objeto */
 void DeleteBaseObject(void *object) {
   if (object) {
-    numobjects--;
-    numbytes -= ObjectSize(object);
+    AtomicAdd(&numobjects, -1);
+    AtomicAdd(&numbytes, -ObjectSize(object));
     tln_trace(TLN_LOG_VERBOSE, "%s %p deleted", object_types[ObjectType(object)], object);
     free(object);
   }
@@ -13,13 +13,18 @@
 #include "tiledjinn.h"
 #include "Palette.h"
 #include "Tables.h"
+#include "Engine.h"
+#include "Threads.h"
 
-struct Palette **indexed_palettes;
+static volatile uint32_t palette_version;  /* last version given to a palette */
 
 /*!
  * \brief
  * Creates a new color table
  * 
+ * \param id
+ * Slot of the palette in the current context, replacing any palette already there
+ * 
  * \param entries
  * Number of color entries (typically 256)
  * 
@@ -34,13 +39,14 @@ bool TLN_CreatePalette(unsigned char id, int entries) {
   palette = (struct Palette *) CreateBaseObject(OT_PALETTE, size);
   if (palette) {
     palette->entries = entries;
+    palette->version = AtomicAdd(&palette_version, 1);
     TLN_SetLastError(TLN_ERR_OK);
 
-    if (indexed_palettes[id] != NULL) {
+    if (engine->palettes[id] != NULL) {
       TLN_DeletePalette(id);
     }
 
-    indexed_palettes[id] = palette;
+    engine->palettes[id] = palette;
     return true;
   }
 
@@ -59,10 +65,11 @@ bool TLN_CreatePalette(unsigned char id, int entries) {
  */
 bool TLN_DeletePalette(TLN_PaletteId palette_id) {
 #pragma EXPORT_FUNC
-  struct Palette *palette = indexed_palettes[palette_id];
+  struct Palette *palette = engine->palettes[palette_id];
 
   if (CheckBaseObject(palette, OT_PALETTE)) {
     DeleteBaseObject(palette);
+    engine->palettes[palette_id] = NULL;
     TLN_SetLastError(TLN_ERR_OK);
     return true;
   }
@@ -71,6 +78,37 @@ bool TLN_DeletePalette(TLN_PaletteId palette_id) {
   }
 }
 
+/*!
+ * \brief
+ * Swaps a palette for another one on each scanline
+ * 
+ * \param palette_id
+ * Id of the palette to swap, as referenced by tiles and sprites
+ * 
+ * \param table
+ * Array with the id of the palette drawn instead on each line of the framebuffer, or NULL to stop
+ * swapping this palette
+ * 
+ * Changes palette banks mid-frame without a raster callback, for example to give each band of the
+ * screen its own colors. The array isn't copied, so it can be updated between frames. Lines whose
+ * entry names a palette that doesn't exist keep drawing palette_id.
+ * 
+ * \see
+ * TLN_SetLayerLineTables(), TLN_SetBGColorTable()
+ */
+bool TLN_SetPaletteLineTable(TLN_PaletteId palette_id, const TLN_PaletteId *table) {
+#pragma EXPORT_FUNC
+  if (engine->palette_tables[palette_id] != NULL) {
+    engine->numpalette_tables -= 1;
+  }
+  if (table != NULL) {
+    engine->numpalette_tables += 1;
+  }
+  engine->palette_tables[palette_id] = table;
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
 /*!
  * \brief
  * Sets the RGB color value of a palette entry
@@ -92,11 +130,12 @@ bool TLN_DeletePalette(TLN_PaletteId palette_id) {
  */
 bool TLN_SetPaletteColor(TLN_PaletteId palette_id, int index, uint8_t r, uint8_t g, uint8_t b) {
 #pragma EXPORT_FUNC
-  struct Palette *palette = indexed_palettes[palette_id];
+  struct Palette *palette = engine->palettes[palette_id];
 
   if (palette != NULL && index < palette->entries) {
     uint32_t *data = (uint32_t *) GetPaletteData(palette, index);
     *data = PackRGB32(r, g, b);
+    palette->version = AtomicAdd(&palette_version, 1);
     TLN_SetLastError(TLN_ERR_OK);
     return true;
   }
@@ -119,7 +158,7 @@ bool TLN_SetPaletteColor(TLN_PaletteId palette_id, int index, uint8_t r, uint8_t
  */
 const uint8_t *TLN_GetPaletteData(TLN_PaletteId palette_id, int index) {
 #pragma EXPORT_FUNC
-  const struct Palette *palette = indexed_palettes[palette_id];
+  const struct Palette *palette = engine->palettes[palette_id];
   if (palette == NULL || index >= palette->entries) {
     TLN_SetLastError(TLN_ERR_IDX_PICTURE);
     return false;
@@ -134,7 +173,7 @@ EditPaletteColor(TLN_PaletteId palette_id, uint8_t *blend_table, uint8_t r, uint
   int end;
   int c;
   const uint8_t *color_ptr;
-  struct Palette *palette = indexed_palettes[palette_id];
+  struct Palette *palette = engine->palettes[palette_id];
 
   if (!CheckBaseObject(palette, OT_PALETTE)) {
     return false;
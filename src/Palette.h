@@ -17,6 +17,7 @@
 struct Palette {
     DEFINE_OBJECT;
     int entries;
+    uint32_t version;  /* changes on every color edit, checked by the tile cache */
     uint8_t data[0];
 };
 
@@ -10,6 +10,12 @@
  * */
 
 #include <math.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
 #include "tiledjinn.h"
 #include "Engine.h"
 #include "Sprite.h"
@@ -22,7 +28,14 @@
 #define inline __inline
 #endif
 
-static void SelectBlitter(Sprite *sprite);
+/* rank distance between neighbours in the drawing order when renumbered, room for sprites inserted between */
+#define SPRITE_RANK_GAP  1024
+
+static void SelectBlitter(int nsprite);
+static void ActivateSprite(int nsprite);
+static void DeactivateSprite(int nsprite);
+static void MoveSprite(int nsprite, int prev);
+static bool CheckDrawnSprite(int nsprite);
 
 /*!
  * \brief Enables or disables specified flag for a sprite
@@ -71,16 +84,16 @@ bool TLN_EnableSpriteFlag(int nsprite, uint32_t flag, bool enable) {
  */
 bool TLN_SetSpritePosition(int nsprite, int x, int y) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
+  sprite = &engine->sprite_info[nsprite];
   sprite->x = x;
   sprite->y = y;
-  UpdateSprite(sprite);
+  UpdateSprite(nsprite);
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -110,11 +123,11 @@ bool TLN_SetSpritePicture(int nsprite, TLN_Tileset tileset, int entry) {
   sprite = &engine->sprites[nsprite];
 
   sprite->tileset = tileset;
-  sprite->tileset_entry = entry;
-  sprite->info.w = TLN_GetTileWidth(tileset);
-  sprite->info.h = TLN_GetTileHeight(tileset);
+  sprite->tileset_entry = (uint16_t) entry;
+  engine->sprite_info[nsprite].size.w = TLN_GetTileWidth(tileset);
+  engine->sprite_info[nsprite].size.h = TLN_GetTileHeight(tileset);
 
-  UpdateSprite(sprite);
+  UpdateSprite(nsprite);
   tln_trace(TLN_LOG_VERBOSE, "SetSpritePicture %d -> %d\n", nsprite, entry);
 
   TLN_SetLastError(TLN_ERR_OK);
@@ -141,7 +154,8 @@ bool TLN_SetSpritePalette(int nsprite, TLN_PaletteId palette_id) {
 
   sprite = &engine->sprites[nsprite];
   sprite->palette_id = palette_id;
-  sprite->ok = true;
+  ActivateSprite(nsprite);
+  UpdateSpriteBuckets(nsprite);
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -194,7 +208,8 @@ bool TLN_SetSpriteBlendMode(int nsprite, TLN_Blend mode) {
 
   sprite = &engine->sprites[nsprite];
   sprite->blend = SelectBlendTable(mode);
-  SelectBlitter(sprite);
+  engine->sprite_info[nsprite].blend_mode = mode;
+  SelectBlitter(nsprite);
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -225,19 +240,19 @@ bool TLN_SetSpriteBlendMode(int nsprite, TLN_Blend mode) {
  */
 bool TLN_SetSpriteScaling(int nsprite, float sx, float sy) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
+  sprite = &engine->sprite_info[nsprite];
   sprite->sx = sx;
   sprite->sy = sy;
   sprite->mode = MODE_SCALING;
-  sprite->draw = GetSpriteDraw(sprite->mode);
-  UpdateSprite(sprite);
-  SelectBlitter(sprite);
+  engine->sprites[nsprite].draw = GetSpriteDraw(sprite->mode);
+  UpdateSprite(nsprite);
+  SelectBlitter(nsprite);
   return true;
 }
 
@@ -253,20 +268,20 @@ bool TLN_SetSpriteScaling(int nsprite, float sx, float sy) {
  */
 bool TLN_ResetSpriteScaling(int nsprite) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
+  sprite = &engine->sprite_info[nsprite];
   sprite->sx = sprite->sy = 1.0f;
   sprite->mode = MODE_NORMAL;
-  sprite->draw = GetSpriteDraw(sprite->mode);
-  UpdateSprite(sprite);
+  engine->sprites[nsprite].draw = GetSpriteDraw(sprite->mode);
+  UpdateSprite(nsprite);
 
   TLN_SetLastError(TLN_ERR_OK);
-  SelectBlitter(sprite);
+  SelectBlitter(nsprite);
   return true;
 }
 
@@ -456,19 +471,16 @@ int TLN_GetSpritePicture(int nsprite) {
  * Finds an available (unused) sprite
  * 
  * \returns
- * Index of the first unused sprite (starting from 0) or -1 if none found
+ * Index of an unused sprite, or -1 if none found
+ *
+ * \remarks
+ * Unused sprites are kept in a list, so this takes constant time. Sprites are returned in index order
+ * until some is disabled, then the last one disabled is returned first
  */
 int TLN_GetAvailableSprite(void) {
 #pragma EXPORT_FUNC
-  int c;
-
   TLN_SetLastError(TLN_ERR_OK);
-  for (c = 0; c < engine->numsprites; c++) {
-    if (!engine->sprites[c].ok) {
-      return c;
-    }
-  }
-  return -1;
+  return engine->sprite_free.first;
 }
 
 /*!
@@ -498,7 +510,8 @@ bool TLN_EnableSpriteCollision(int nsprite, bool enable) {
     return false;
   }
 
-  engine->sprites[nsprite].do_collision = enable;
+  engine->sprite_info[nsprite].do_collision = enable;
+  engine->broadphase.dirty = true;
   return true;
 }
 
@@ -525,7 +538,111 @@ bool TLN_GetSpriteCollision(int nsprite) {
     return false;
   }
 
-  return engine->sprites[nsprite].collision;
+  return engine->sprite_info[nsprite].collision;
+}
+
+/*!
+ * \brief
+ * Gets the pairs of sprites that collided at pixel level in the last frame
+ *
+ * \param pairs
+ * Array that receives the pairs, can be NULL to just count them
+ *
+ * \param max
+ * Number of entries in pairs
+ *
+ * \returns
+ * Number of pairs found, even if more than max. Only the first max ones are copied
+ *
+ * \remarks
+ * Each pair is listed once, in the order they first touched from the top of the screen, with the
+ * scanline of that contact and the pixels where one of them was drawn over the other in the frame.
+ * Both sprites must have collision detection enabled, and only sprites whose rectangles overlap are
+ * checked at pixel level
+ *
+ * \see
+ * TLN_EnableSpriteCollision(), TLN_GetSpriteCollision()
+ */
+int TLN_GetSpriteCollisions(TLN_SpriteCollision *pairs, int max) {
+#pragma EXPORT_FUNC
+  const CollisionList *list = &engine->collisions;
+
+  if (pairs == NULL && max > 0) {
+    TLN_SetLastError(TLN_ERR_NULL_POINTER);
+    return 0;
+  }
+
+  if (max > list->count) {
+    max = list->count;
+  }
+  if (max > 0) {
+    memcpy(pairs, list->items, max * sizeof(TLN_SpriteCollision));
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return list->count;
+}
+
+/*!
+ * \brief
+ * Enables sprite vs layer collision checking at pixel level
+ *
+ * \param nsprite
+ * Id of the sprite [0, num_sprites - 1]
+ *
+ * \param layers
+ * Mask of the layers to check, bit n for layer n. Only the first 32 layers can be checked. 0 disables (default value)
+ *
+ * \remarks
+ * While the sprite is drawn, the layers in the mask are checked for opaque pixels under the opaque pixels of the
+ * sprite, whatever their priority. Mosaic isn't taken into account. This replaces probing the layers with
+ * TLN_GetLayerTile() around the sprite
+ *
+ * \see
+ * TLN_GetSpriteLayerCollision()
+ */
+bool TLN_EnableSpriteLayerCollision(int nsprite, uint32_t layers) {
+#pragma EXPORT_FUNC
+  if (nsprite >= engine->numsprites) {
+    TLN_SetLastError(TLN_ERR_IDX_SPRITE);
+    return false;
+  }
+
+  engine->sprite_info[nsprite].layer_mask = layers;
+  if (layers != 0) {
+    engine->sprites[nsprite].collide |= COLLIDE_LAYERS;
+  }
+  else {
+    engine->sprites[nsprite].collide &= ~COLLIDE_LAYERS;
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Gets the layers that collided with a sprite at pixel level in the last frame
+ *
+ * \param nsprite
+ * Id of the sprite [0, num_sprites - 1]
+ *
+ * \returns
+ * Mask of the layers with opaque pixels under opaque pixels of the sprite, bit n for layer n
+ *
+ * \remarks
+ * Only the layers enabled with TLN_EnableSpriteLayerCollision() are checked
+ *
+ * \see
+ * TLN_EnableSpriteLayerCollision()
+ */
+uint32_t TLN_GetSpriteLayerCollision(int nsprite) {
+#pragma EXPORT_FUNC
+  if (nsprite >= engine->numsprites) {
+    TLN_SetLastError(TLN_ERR_IDX_SPRITE);
+    return 0;
+  }
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return engine->layer_hits.layers[nsprite];
 }
 
 /*!
@@ -541,16 +658,22 @@ bool TLN_GetSpriteCollision(int nsprite) {
  */
 bool TLN_DisableSprite(int nsprite) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
-  sprite->ok = false;
+  sprite = &engine->sprite_info[nsprite];
   sprite->collision = false;
-  sprite->do_collision = false;
+  if (sprite->do_collision) {
+    sprite->do_collision = false;
+    engine->broadphase.dirty = true;
+  }
+  sprite->layer_mask = 0;
+  engine->layer_hits.layers[nsprite] = 0;
+  engine->sprites[nsprite].collide = 0;
+  DeactivateSprite(nsprite);
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -558,18 +681,104 @@ bool TLN_DisableSprite(int nsprite) {
 
 bool TLN_EnableSprite(int nsprite) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
-  sprite->ok = true;
+  sprite = &engine->sprite_info[nsprite];
+  ActivateSprite(nsprite);
+  UpdateSpriteBuckets(nsprite);
+  if (sprite->dirty) {
+    engine->sprites_dirty = true;
+  }
 
   return true;
 }
 
+/*!
+ * \brief
+ * Draws an enabled sprite before all the others, so it's behind them
+ *
+ * \param nsprite
+ * Id of the sprite [0, num_sprites - 1]
+ *
+ * \see
+ * TLN_SetNextSprite(), TLN_SetLastSprite()
+ */
+bool TLN_SetFirstSprite(int nsprite) {
+#pragma EXPORT_FUNC
+  if (!CheckDrawnSprite(nsprite)) {
+    return false;
+  }
+
+  if (engine->sprite_order.first != nsprite) {
+    MoveSprite(nsprite, -1);
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Draws an enabled sprite right after another one, so it's over it
+ *
+ * \param nsprite
+ * Id of the sprite to draw first [0, num_sprites - 1]
+ *
+ * \param next
+ * Id of the sprite to draw next [0, num_sprites - 1]
+ *
+ * \remarks
+ * Moving a sprite to the start or the end of the drawing order takes constant time. Anywhere else the
+ * order is renumbered once before the next frame is drawn when there's no room between the ranks of its
+ * neighbours
+ *
+ * \see
+ * TLN_SetFirstSprite(), TLN_SetLastSprite()
+ */
+bool TLN_SetNextSprite(int nsprite, int next) {
+#pragma EXPORT_FUNC
+  if (!CheckDrawnSprite(nsprite) || !CheckDrawnSprite(next) || nsprite == next) {
+    TLN_SetLastError(TLN_ERR_IDX_SPRITE);
+    return false;
+  }
+
+  if (engine->sprite_info[nsprite].next != next) {
+    MoveSprite(next, nsprite);
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Draws an enabled sprite after all the others, so it's over them
+ *
+ * \param nsprite
+ * Id of the sprite [0, num_sprites - 1]
+ *
+ * \remarks
+ * Sprites are drawn in index order unless moved. An enabled sprite goes right after the enabled sprite with the
+ * next lower index
+ *
+ * \see
+ * TLN_SetFirstSprite(), TLN_SetNextSprite()
+ */
+bool TLN_SetLastSprite(int nsprite) {
+#pragma EXPORT_FUNC
+  if (!CheckDrawnSprite(nsprite)) {
+    return false;
+  }
+
+  if (engine->sprite_order.last != nsprite) {
+    MoveSprite(nsprite, engine->sprite_order.last);
+  }
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
 /*!
  * \brief
  * Returns runtime info about a given sprite
@@ -582,7 +791,8 @@ bool TLN_EnableSprite(int nsprite) {
  */
 bool TLNAPI TLN_GetSpriteState(int nsprite, TLN_SpriteState *state) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  const Sprite *sprite;
+  const SpriteInfo *info;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
@@ -594,18 +804,97 @@ bool TLNAPI TLN_GetSpriteState(int nsprite, TLN_SpriteState *state) {
   }
 
   sprite = &engine->sprites[nsprite];
-  state->x = sprite->x;
-  state->y = sprite->y;
-  state->w = sprite->info.w;
-  state->h = sprite->info.h;
-  if (sprite->mode == MODE_SCALING) {
-    state->w = (int) (state->w * sprite->sx);
-    state->h = (int) (state->h * sprite->sy);
-  }
-  state->collision = sprite->do_collision;
+  info = &engine->sprite_info[nsprite];
+  state->x = info->x;
+  state->y = info->y;
+  state->w = info->size.w;
+  state->h = info->size.h;
+  if (info->mode == MODE_SCALING) {
+    state->w = (int) (state->w * info->sx);
+    state->h = (int) (state->h * info->sy);
+  }
+  state->collision = info->do_collision;
   state->flags = sprite->flags;
   state->index = sprite->tileset_entry;
-  state->enabled = sprite->ok;
+  state->enabled = info->ok;
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Updates several sprites at once from arrays of properties
+ *
+ * \param sprites
+ * Ids of the sprites to update [0, num_sprites - 1]
+ *
+ * \param count
+ * Number of sprites, and of entries in each array of the batch
+ *
+ * \param batch
+ * Pointer to a TLN_SpriteBatch with the new properties. Arrays set to NULL aren't changed
+ *
+ * \returns
+ * true if success, or false if error. Nothing is changed on error
+ *
+ * \remarks
+ * Equivalent to calling TLN_SetSpritePosition(), TLN_SetSpritePicture(), TLN_EnableSpriteFlag() and
+ * TLN_SetSpritePalette() for each sprite, but the screen rectangles of the changed sprites are computed once
+ * when the next frame is drawn instead of on every call
+ */
+bool TLN_UpdateSprites(const int *sprites, int count, const TLN_SpriteBatch *batch) {
+#pragma EXPORT_FUNC
+  int c;
+
+  if ((sprites == NULL && count > 0) || batch == NULL) {
+    TLN_SetLastError(TLN_ERR_NULL_POINTER);
+    return false;
+  }
+  if (batch->tileset != NULL && !CheckBaseObject(batch->tileset, OT_TILESET)) {
+    return false;
+  }
+
+  /* validate everything first, so a bad entry doesn't leave the batch half applied */
+  for (c = 0; c < count; c++) {
+    if (sprites[c] < 0 || sprites[c] >= engine->numsprites) {
+      TLN_SetLastError(TLN_ERR_IDX_SPRITE);
+      return false;
+    }
+    if (batch->picture != NULL && batch->tileset == NULL && engine->sprites[sprites[c]].tileset == NULL) {
+      TLN_SetLastError(TLN_ERR_REF_TILESET);
+      return false;
+    }
+  }
+
+  for (c = 0; c < count; c++) {
+    Sprite *sprite = &engine->sprites[sprites[c]];
+    SpriteInfo *info = &engine->sprite_info[sprites[c]];
+
+    if (batch->x != NULL) {
+      info->x = batch->x[c];
+    }
+    if (batch->y != NULL) {
+      info->y = batch->y[c];
+    }
+    if (batch->picture != NULL) {
+      if (batch->tileset != NULL) {
+        sprite->tileset = batch->tileset;
+      }
+      sprite->tileset_entry = (uint16_t) batch->picture[c];
+      info->size.w = sprite->tileset->width;
+      info->size.h = sprite->tileset->height;
+    }
+    if (batch->flags != NULL) {
+      sprite->flags = batch->flags[c];
+    }
+    if (batch->palette != NULL) {
+      sprite->palette_id = batch->palette[c];
+      ActivateSprite(sprites[c]);
+    }
+    info->dirty = true;
+  }
+  engine->sprites_dirty = true;
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -630,13 +919,13 @@ static void nclamp(float *v) {
 */
 bool TLN_SetSpritePivot(int nsprite, float px, float py) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
+  sprite = &engine->sprite_info[nsprite];
   nclamp(&px);
   nclamp(&py);
   sprite->ptx = px;
@@ -657,109 +946,426 @@ void TLN_SetSpritesMaskRegion(int top_line, int bottom_line) {
 }
 
 /* actualiza datos internos */
-void UpdateSprite(Sprite *sprite) {
+void UpdateSprite(int nsprite) {
+  Sprite *sprite = &engine->sprites[nsprite];
+  SpriteInfo *info = &engine->sprite_info[nsprite];
+  rect_t srcrect;
   int w, h;
 
-  if (!sprite->ok) {
+  if (!info->ok) {
     return;
   }
 
   /* rectangulo origen (sprite) */
-  MakeRect(&sprite->srcrect, 0, 0, sprite->info.w, sprite->info.h);
+  MakeRect(&srcrect, 0, 0, info->size.w, info->size.h);
 
   /* clipping normal */
-  if (sprite->mode == MODE_NORMAL) {
-    w = sprite->info.w;
-    h = sprite->info.h;
+  if (info->mode == MODE_NORMAL) {
+    w = info->size.w;
+    h = info->size.h;
 
-    int x = sprite->x - (int) (w * sprite->ptx);
-    int y = sprite->y - (int) (h * sprite->pty);
+    int x = info->x - (int) (w * info->ptx);
+    int y = info->y - (int) (h * info->pty);
 
     /* rectangulo destino (pantalla) */
     MakeRect(&sprite->dstrect, x, y, w, h);
 
     /* clipping vertical */
     if (sprite->dstrect.y1 < 0) {
-      sprite->srcrect.y1 -= sprite->dstrect.y1;
+      srcrect.y1 -= sprite->dstrect.y1;
       sprite->dstrect.y1 = 0;
     }
     if (sprite->dstrect.y2 > engine->framebuffer.height) {
-      sprite->srcrect.y2 -= (sprite->dstrect.y2 - engine->framebuffer.height);
+      srcrect.y2 -= (sprite->dstrect.y2 - engine->framebuffer.height);
       sprite->dstrect.y2 = engine->framebuffer.height;
     }
 
     /* clipping horizontal */
     if (sprite->dstrect.x1 < 0) {
-      sprite->srcrect.x1 -= sprite->dstrect.x1;
+      srcrect.x1 -= sprite->dstrect.x1;
       sprite->dstrect.x1 = 0;
     }
     if (sprite->dstrect.x2 > engine->framebuffer.width) {
-      sprite->srcrect.x2 -= (sprite->dstrect.x2 - engine->framebuffer.width);
+      srcrect.x2 -= (sprite->dstrect.x2 - engine->framebuffer.width);
       sprite->dstrect.x2 = engine->framebuffer.width;
     }
   }
 
     /* clipping scaling */
-  else if (sprite->mode == MODE_SCALING) {
-    w = (int) (sprite->info.w * sprite->sx);
-    h = (int) (sprite->info.h * sprite->sy);
+  else if (info->mode == MODE_SCALING) {
+    w = (int) (info->size.w * info->sx);
+    h = (int) (info->size.h * info->sy);
 
     /* rectangulo destino (pantalla) */
-    sprite->dstrect.x1 = sprite->x - (int) (w * sprite->ptx);
-    sprite->dstrect.y1 = sprite->y - (int) (h * sprite->pty);
+    sprite->dstrect.x1 = info->x - (int) (w * info->ptx);
+    sprite->dstrect.y1 = info->y - (int) (h * info->pty);
     sprite->dstrect.x2 = sprite->dstrect.x1 + w;
     sprite->dstrect.y2 = sprite->dstrect.y1 + h;
 
     /* coordenadas origen son fix */
-    sprite->srcrect.x1 = int2fix (sprite->srcrect.x1);
-    sprite->srcrect.y1 = int2fix (sprite->srcrect.y1);
-    sprite->srcrect.x2 = int2fix (sprite->srcrect.x2);
-    sprite->srcrect.y2 = int2fix (sprite->srcrect.y2);
+    srcrect.x1 = int2fix (srcrect.x1);
+    srcrect.y1 = int2fix (srcrect.y1);
+    srcrect.x2 = int2fix (srcrect.x2);
+    srcrect.y2 = int2fix (srcrect.y2);
 
-    int srcw = sprite->srcrect.x2 - sprite->srcrect.x1;
-    int srch = sprite->srcrect.y2 - sprite->srcrect.y1;
+    int srcw = srcrect.x2 - srcrect.x1;
+    int srch = srcrect.y2 - srcrect.y1;
     int dstw = sprite->dstrect.x2 - sprite->dstrect.x1;
     int dsth = sprite->dstrect.y2 - sprite->dstrect.y1;
 
-    sprite->dx = srcw / dstw;
-    sprite->dy = srch / dsth;
+    info->dx = srcw / dstw;
+    info->dy = srch / dsth;
 
     /* TODO */
 
     /* clipping vertical */
     if (sprite->dstrect.y1 < 0) {
-      sprite->srcrect.y1 -= (sprite->dstrect.y1 * sprite->dy);
+      srcrect.y1 -= (sprite->dstrect.y1 * info->dy);
       sprite->dstrect.y1 = 0;
     }
     if (sprite->dstrect.y2 > engine->framebuffer.height) {
-      sprite->srcrect.y2 -= (sprite->dstrect.y2 - engine->framebuffer.height) * sprite->dy;
+      srcrect.y2 -= (sprite->dstrect.y2 - engine->framebuffer.height) * info->dy;
       sprite->dstrect.y2 = engine->framebuffer.height;
     }
 
     /* clipping horizontal */
     if (sprite->dstrect.x1 < 0) {
-      sprite->srcrect.x1 -= (sprite->dstrect.x1 * sprite->dx);
+      srcrect.x1 -= (sprite->dstrect.x1 * info->dx);
       sprite->dstrect.x1 = 0;
     }
     if (sprite->dstrect.x2 > engine->framebuffer.width) {
-      sprite->srcrect.x2 -= (sprite->dstrect.x2 - engine->framebuffer.width) * sprite->dx;
+      srcrect.x2 -= (sprite->dstrect.x2 - engine->framebuffer.width) * info->dx;
       sprite->dstrect.x2 = engine->framebuffer.width;
     }
   }
 
   /*
   debugmsg ("Sprite %02d scale=%.02f,%.02f src=[%d,%d,%d,%d] dst=[%d,%d,%d,%d]\n",
-    sprite->num, sprite->sx, sprite->sy,
-    fix2int(sprite->srcrect.x1), fix2int(sprite->srcrect.y1), fix2int(sprite->srcrect.x2), fix2int(sprite->srcrect.y2),
+    sprite->num, info->sx, info->sy,
+    fix2int(srcrect.x1), fix2int(srcrect.y1), fix2int(srcrect.x2), fix2int(srcrect.y2),
     sprite->dstrect.x1, sprite->dstrect.y1, sprite->dstrect.x2, sprite->dstrect.y2);
   */
+
+  sprite->srcx = srcrect.x1;
+  sprite->srcy = srcrect.y1;
+  UpdateSpriteBuckets(nsprite);
+}
+
+/* position of the sprite inside the bucket, or where it has to be inserted */
+static int FindBucketItem(const SpriteBucket *bucket, uint16_t index) {
+  const SpriteInfo *info = engine->sprite_info;
+  const int rank = info[index].rank;
+  int lo = 0;
+  int hi = bucket->count;
+
+  while (lo < hi) {
+    const int mid = (lo + hi) >> 1;
+    if (info[bucket->items[mid]].rank < rank) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void LinkSprite(SpriteBucket *bucket, uint16_t index) {
+  const int pos = FindBucketItem(bucket, index);
+  memmove(&bucket->items[pos + 1], &bucket->items[pos], (bucket->count - pos) * sizeof(uint16_t));
+  bucket->items[pos] = index;
+  bucket->count += 1;
+}
+
+static void UnlinkSprite(SpriteBucket *bucket, uint16_t index) {
+  const int pos = FindBucketItem(bucket, index);
+  bucket->count -= 1;
+  memmove(&bucket->items[pos], &bucket->items[pos + 1], (bucket->count - pos) * sizeof(uint16_t));
+}
+
+/* moves the sprite to the given range of buckets. With the order pending, SortSpriteBuckets() will do it */
+static void SetSpriteBuckets(int nsprite, int bucket1, int bucket2) {
+  const uint16_t index = (uint16_t) nsprite;
+  SpriteInfo *sprite = &engine->sprite_info[nsprite];
+  int c;
+
+  if (!engine->sprite_order_dirty) {
+    for (c = sprite->bucket1; c <= sprite->bucket2; c++) {
+      if (c < bucket1 || c > bucket2) {
+        UnlinkSprite(&engine->buckets[c], index);
+      }
+    }
+    for (c = bucket1; c <= bucket2; c++) {
+      if (c < sprite->bucket1 || c > sprite->bucket2) {
+        LinkSprite(&engine->buckets[c], index);
+      }
+    }
+  }
+  sprite->bucket1 = bucket1;
+  sprite->bucket2 = bucket2;
+}
+
+/* moves the sprite to the buckets overlapped by its current screen rectangle */
+void UpdateSpriteBuckets(int nsprite) {
+  const rect_t *rect = &engine->sprites[nsprite].dstrect;
+  const SpriteInfo *sprite = &engine->sprite_info[nsprite];
+  int bucket1 = 0;
+  int bucket2 = -1;
+
+  /* sprites clipped out horizontally aren't linked either, so the scanline loop only checks lines */
+  if (sprite->ok && rect->y1 < rect->y2 && rect->y2 > 0 && rect->y1 < engine->framebuffer.height &&
+      rect->x1 < rect->x2) {
+    bucket1 = rect->y1 > 0 ? rect->y1 >> SPRITE_BUCKET_SHIFT : 0;
+    bucket2 = (rect->y2 - 1) >> SPRITE_BUCKET_SHIFT;
+    if (bucket2 >= engine->numbuckets) {
+      bucket2 = engine->numbuckets - 1;
+    }
+  }
+
+  if (bucket1 != sprite->bucket1 || bucket2 != sprite->bucket2) {
+    SetSpriteBuckets(nsprite, bucket1, bucket2);
+  }
+  if (sprite->do_collision) {
+    engine->broadphase.dirty = true;
+  }
+}
+
+/*
+ * refills the buckets in drawing order after a sprite was placed where the ranks had no room for it, renumbering
+ * the ranks with SPRITE_RANK_GAP between neighbours
+ */
+void SortSpriteBuckets(Engine *context) {
+  SpriteInfo *info = context->sprite_info;
+  int rank = 0;
+  int c, n;
+
+  for (c = 0; c < context->numbuckets; c++) {
+    context->buckets[c].count = 0;
+  }
+  for (n = context->sprite_order.first; n != -1; n = info[n].next) {
+    info[n].rank = rank;
+    rank += SPRITE_RANK_GAP;
+    for (c = info[n].bucket1; c <= info[n].bucket2; c++) {
+      SpriteBucket *bucket = &context->buckets[c];
+      bucket->items[bucket->count++] = (uint16_t) n;
+    }
+  }
+  context->rank_first = 0;
+  context->rank_last = rank - SPRITE_RANK_GAP;
+  context->sprite_order_dirty = false;
+}
+
+static void RemoveSprite(SpriteList *list, int nsprite) {
+  SpriteInfo *info = engine->sprite_info;
+  const int prev = info[nsprite].prev;
+  const int next = info[nsprite].next;
+
+  if (prev != -1) {
+    info[prev].next = next;
+  }
+  else {
+    list->first = next;
+  }
+  if (next != -1) {
+    info[next].prev = prev;
+  }
+  else {
+    list->last = prev;
+  }
 }
 
-static void SelectBlitter(Sprite *sprite) {
-  const bool scaling = sprite->mode == MODE_SCALING;
-  const bool blend = sprite->blend != NULL;
+/* inserts the sprite after prev, or at the start of the list if prev is -1 */
+static void InsertSprite(SpriteList *list, int nsprite, int prev) {
+  SpriteInfo *info = engine->sprite_info;
+  const int next = prev != -1 ? info[prev].next : list->first;
+
+  info[nsprite].prev = prev;
+  info[nsprite].next = next;
+  if (prev != -1) {
+    info[prev].next = nsprite;
+  }
+  else {
+    list->first = nsprite;
+  }
+  if (next != -1) {
+    info[next].prev = nsprite;
+  }
+  else {
+    list->last = nsprite;
+  }
+}
+
+/*
+ * ranks a sprite just placed in the drawing order. Ranks only have to grow along the order, so the ends take
+ * a rank further outwards and the middle the one halfway between its neighbours, keeping the buckets sorted.
+ * Without room the whole order is renumbered
+ */
+static void RankSprite(int nsprite) {
+  SpriteInfo *info = engine->sprite_info;
+  const int prev = info[nsprite].prev;
+  const int next = info[nsprite].next;
+
+  if (engine->sprite_order_dirty) {
+    return;
+  }
+  if (prev == -1 && next == -1) {
+    info[nsprite].rank = engine->rank_first = engine->rank_last = 0;
+  }
+  else if (next == -1 && engine->rank_last <= INT_MAX - SPRITE_RANK_GAP) {
+    engine->rank_last += SPRITE_RANK_GAP;
+    info[nsprite].rank = engine->rank_last;
+  }
+  else if (prev == -1 && engine->rank_first >= INT_MIN + SPRITE_RANK_GAP) {
+    engine->rank_first -= SPRITE_RANK_GAP;
+    info[nsprite].rank = engine->rank_first;
+  }
+  else if (prev != -1 && next != -1 && (int64_t) info[next].rank - info[prev].rank > 1) {
+    info[nsprite].rank = (int) (((int64_t) info[prev].rank + info[next].rank) >> 1);
+  }
+  else {
+    engine->sprite_order_dirty = true;
+  }
+}
+
+/* index of the highest set bit of a non-zero word */
+static inline int HighestBit(uint32_t word) {
+#if defined _MSC_VER
+  unsigned long index;
+  _BitScanReverse(&index, word);
+  return (int) index;
+#elif defined __GNUC__
+  return 31 - __builtin_clz(word);
+#else
+  int index = 31;
+  while (!(word & 0x80000000u)) {
+    word <<= 1;
+    index--;
+  }
+  return index;
+#endif
+}
+
+/* enabled sprite with the highest index below nsprite, or -1 if none */
+static int FindEnabledBelow(int nsprite) {
+  const uint32_t *enabled = engine->sprite_enabled;
+  int word = nsprite >> 5;
+  uint32_t bits = enabled[word] & ((1u << (nsprite & 31)) - 1);
+
+  while (bits == 0) {
+    if (--word < 0) {
+      return -1;
+    }
+    bits = enabled[word];
+  }
+  return (word << 5) + HighestBit(bits);
+}
+
+/*
+ * takes a disabled sprite out of the free list and places it in the drawing order by index: after the enabled
+ * sprite with the highest index below it. Without explicit reordering, sprites are drawn in index order
+ */
+static void ActivateSprite(int nsprite) {
+  SpriteInfo *info = &engine->sprite_info[nsprite];
+
+  if (!info->ok) {
+    RemoveSprite(&engine->sprite_free, nsprite);
+    InsertSprite(&engine->sprite_order, nsprite, FindEnabledBelow(nsprite));
+    RankSprite(nsprite);
+    engine->sprite_enabled[nsprite >> 5] |= 1u << (nsprite & 31);
+    info->ok = true;
+  }
+}
+
+/* takes an enabled sprite out of the drawing order and the buckets, and makes it the next available one */
+static void DeactivateSprite(int nsprite) {
+  SpriteInfo *info = &engine->sprite_info[nsprite];
+
+  if (info->ok) {
+    info->ok = false;
+    UpdateSpriteBuckets(nsprite);
+    RemoveSprite(&engine->sprite_order, nsprite);
+    InsertSprite(&engine->sprite_free, nsprite, -1);
+    engine->sprite_enabled[nsprite >> 5] &= ~(1u << (nsprite & 31));
+  }
+}
+
+/* moves an enabled sprite after prev in the drawing order, or to the start if prev is -1 */
+static void MoveSprite(int nsprite, int prev) {
+  const SpriteInfo *info = &engine->sprite_info[nsprite];
+  const int bucket1 = info->bucket1;
+  const int bucket2 = info->bucket2;
+
+  /* leaves the buckets with its old rank, and comes back with the new one */
+  SetSpriteBuckets(nsprite, 0, -1);
+  RemoveSprite(&engine->sprite_order, nsprite);
+  InsertSprite(&engine->sprite_order, nsprite, prev);
+  RankSprite(nsprite);
+  SetSpriteBuckets(nsprite, bucket1, bucket2);
+}
+
+static bool CheckDrawnSprite(int nsprite) {
+  if (nsprite < 0 || nsprite >= engine->numsprites || !engine->sprite_info[nsprite].ok) {
+    TLN_SetLastError(TLN_ERR_IDX_SPRITE);
+    return false;
+  }
+  return true;
+}
+
+/* allocates empty sprite buckets for the whole framebuffer height */
+bool CreateSpriteBuckets(Engine *context) {
+  int c;
+
+  context->numbuckets = (context->framebuffer.height + (1 << SPRITE_BUCKET_SHIFT) - 1) >> SPRITE_BUCKET_SHIFT;
+  context->buckets = (SpriteBucket *) calloc(context->numbuckets, sizeof(SpriteBucket));
+  if (context->buckets == NULL) {
+    return false;
+  }
+
+  for (c = 0; c < context->numbuckets; c++) {
+    context->buckets[c].items = (uint16_t *) malloc((context->numsprites + 1) * sizeof(uint16_t));
+    if (context->buckets[c].items == NULL) {
+      return false;
+    }
+  }
+  context->sprite_enabled = (uint32_t *) calloc((context->numsprites >> 5) + 1, sizeof(uint32_t));
+  if (context->sprite_enabled == NULL) {
+    return false;
+  }
+  /* no sprite drawn, all of them available in index order */
+  for (c = 0; c < context->numsprites; c++) {
+    context->sprite_info[c].bucket1 = 0;
+    context->sprite_info[c].bucket2 = -1;
+    context->sprite_info[c].prev = c - 1;
+    context->sprite_info[c].next = c + 1 < context->numsprites ? c + 1 : -1;
+  }
+  context->sprite_free.first = context->numsprites > 0 ? 0 : -1;
+  context->sprite_free.last = context->numsprites - 1;
+  context->sprite_order.first = context->sprite_order.last = -1;
+  context->rank_first = context->rank_last = 0;
+  context->sprite_order_dirty = false;
+  return true;
+}
+
+void DeleteSpriteBuckets(Engine *context) {
+  int c;
+
+  free(context->sprite_enabled);
+  context->sprite_enabled = NULL;
+  if (context->buckets == NULL) {
+    return;
+  }
+
+  for (c = 0; c < context->numbuckets; c++) {
+    free(context->buckets[c].items);
+  }
+  free(context->buckets);
+  context->buckets = NULL;
+}
 
-  sprite->blitter = GetBlitter(32, true, scaling, blend);
+static void SelectBlitter(int nsprite) {
+  const SpriteInfo *info = &engine->sprite_info[nsprite];
+  const bool scaling = info->mode == MODE_SCALING;
+  engine->sprites[nsprite].blitter = GetBlitter(32, true, scaling, info->blend_mode);
 }
 
 void MakeRect(rect_t *rect, int x, int y, int w, int h) {
@@ -27,31 +27,74 @@ typedef struct {
     int w, h;
 } SpriteEntry;
 
-/* sprite */
+/* sprite buckets span 1 << SPRITE_BUCKET_SHIFT scanlines */
+#define SPRITE_BUCKET_SHIFT  4
+
+/* sprites overlapping a band of scanlines, sorted by sprite index */
+typedef struct {
+    int count;
+    uint16_t *items;
+} SpriteBucket;
+
+/* doubly linked list of sprites through SpriteInfo prev and next, -1 = none */
+typedef struct {
+    int first, last;
+} SpriteList;
+
+/* checks done while drawing a sprite, Sprite.collide */
+#define COLLIDE_SPRITES  1  /* writes the collision buffer, set by SweepSpriteCollisions() */
+#define COLLIDE_LAYERS   2  /* tests the layers in SpriteInfo.layer_mask */
+
+/* bytes per sprite draw record, a cache line */
+#define SPRITE_RECORD_SIZE  64
+
+/*
+ * sprite draw record, all that DrawScanline() and the regular sprite drawer read. Records are aligned to
+ * SPRITE_RECORD_SIZE and fill it on 64-bit targets, so each sprite drawn on a scanline touches a single cache
+ * line. See SpriteInfo for the rest
+ */
 typedef struct Sprite {
+    rect_t dstrect;    /* screen rectangle, clipped to the framebuffer */
+    int srcx, srcy;    /* picture pixel at the top left of dstrect, fixed point when scaling */
+    uint32_t flags;
+    uint16_t tileset_entry;
     TLN_PaletteId palette_id;
-    SpriteEntry info;
+    uint8_t collide;  /* COLLIDE_ flags */
     TLN_Tileset tileset;
-    int tileset_entry;
+    ScanDrawPtr draw;
+    ScanBlitPtr blitter;
+    uint8_t *blend;
+} Sprite;
+
+/* sprite state only used when it changes, kept apart from the draw records */
+typedef struct {
+    SpriteEntry size;  /* picture size */
     int x, y;      /* screen space location (TLN_SetSpritePosition) */
-    int dx, dy;
+    int dx, dy;      /* picture pixels per screen pixel when scaling, fixed point */
     int xworld, yworld;  /* world space location (TLN_SetSpriteWorldPosition) */
     float sx, sy;
     float ptx, pty;    /* normalized pivot position inside sprite (default = 0,0) */
-    rect_t srcrect;
-    rect_t dstrect;
     draw_t mode;
-    uint8_t *blend;
-    uint32_t flags;
-    ScanDrawPtr draw;
-    ScanBlitPtr blitter;
+    TLN_Blend blend_mode;
     bool ok;  /* draw if true */
-    bool do_collision;
     bool collision;
+    bool do_collision;  /* enabled with TLN_EnableSpriteCollision() */
+    uint32_t layer_mask;  /* layers tested with TLN_EnableSpriteLayerCollision() */
     bool world_space;  /* valid position is world space, false = screen space */
-    bool dirty;      /* requires call to UpdatePosition() before drawing */
-} Sprite;
+    bool dirty;      /* requires call to UpdateSprite() before drawing, done by PrepareFrame() */
+    int bucket1, bucket2;  /* range of buckets holding the sprite, empty if bucket1 > bucket2 */
+    int prev, next;    /* neighbours in the drawing order if enabled, or in the free list */
+    int rank;      /* increases along the drawing order, sorts the buckets */
+} SpriteInfo;
+
+extern void UpdateSprite(int nsprite);
+
+extern void UpdateSpriteBuckets(int nsprite);
+
+extern bool CreateSpriteBuckets(struct Engine *context);
+
+extern void DeleteSpriteBuckets(struct Engine *context);
 
-extern void UpdateSprite(Sprite *sprite);
+extern void SortSpriteBuckets(struct Engine *context);
 
 #endif
\ No newline at end of file
@@ -12,25 +12,18 @@
 #include <stdlib.h>
 #include "tiledjinn.h"
 #include "Tables.h"
+#include "Engine.h"
 
 #define BLEND_SIZE  (1 << 16)
 
-static uint8_t *_blend_tables[MAX_BLEND];
-static int instances = 0;
-
-bool CreateBlendTables(void) {
+/* builds the lookup tables of a context. BLEND_CUSTOM is rewritten by TLN_SetCustomBlendFunction() */
+bool CreateBlendTables(uint8_t *tables[MAX_BLEND]) {
   int a, b, c;
 
-  /* increase reference count */
-  instances += 1;
-  if (instances > 1) {
-    return true;
-  }
-
   /* get memory */
   for (c = BLEND_MIX25; c < MAX_BLEND; c++) {
-    _blend_tables[c] = (uint8_t *) malloc(BLEND_SIZE);
-    if (_blend_tables[c] == NULL) {
+    tables[c] = (uint8_t *) malloc(BLEND_SIZE);
+    if (tables[c] == NULL) {
       return false;
     }
   }
@@ -39,37 +32,28 @@ bool CreateBlendTables(void) {
   for (a = 0; a < 256; a++) {
     for (b = 0; b < 256; b++) {
       const int offset = (a << 8) + b;
-      _blend_tables[BLEND_MIX25][offset] = (a + b + b) / 3;
-      _blend_tables[BLEND_MIX50][offset] = (a + b) >> 1;
-      _blend_tables[BLEND_MIX75][offset] = (a + a + b) / 3;
-      _blend_tables[BLEND_ADD][offset] = (a + b) > 255 ? 255 : (a + b);
-      _blend_tables[BLEND_SUB][offset] = (a - b) < 0 ? 0 : (a - b);
-      _blend_tables[BLEND_MOD][offset] = (a * b) / 255;
-      _blend_tables[BLEND_CUSTOM][offset] = a;
+      tables[BLEND_MIX25][offset] = (a + b + b) / 3;
+      tables[BLEND_MIX50][offset] = (a + b) >> 1;
+      tables[BLEND_MIX75][offset] = (a + a + b) / 3;
+      tables[BLEND_ADD][offset] = (a + b) > 255 ? 255 : (a + b);
+      tables[BLEND_SUB][offset] = (a - b) < 0 ? 0 : (a - b);
+      tables[BLEND_MOD][offset] = (a * b) / 255;
+      tables[BLEND_CUSTOM][offset] = a;
     }
   }
   return true;
 }
 
-void DeleteBlendTables(void) {
+void DeleteBlendTables(uint8_t *tables[MAX_BLEND]) {
   int c;
 
-  /* decrease reference count */
-  if (instances > 0) {
-    instances -= 1;
-  }
-  if (instances != 0) {
-    return;
-  }
-
   for (c = BLEND_MIX25; c < MAX_BLEND; c++) {
-    if (_blend_tables[c] != NULL) {
-      free(_blend_tables[c]);
-    }
+    free(tables[c]);
+    tables[c] = NULL;
   }
 }
 
-/* returns blend table according to selected blend mode */
+/* returns blend table of the current context according to selected blend mode */
 uint8_t *SelectBlendTable(TLN_Blend mode) {
-  return _blend_tables[mode];
+  return engine->blend_tables[mode];
 }
@@ -16,9 +16,9 @@
 extern "C" {
 #endif
 
-bool CreateBlendTables(void);
+bool CreateBlendTables(uint8_t *tables[MAX_BLEND]);
 
-void DeleteBlendTables(void);
+void DeleteBlendTables(uint8_t *tables[MAX_BLEND]);
 
 uint8_t *SelectBlendTable(TLN_Blend mode);
 
@@ -28,4 +28,30 @@ uint8_t *SelectBlendTable(TLN_Blend mode);
 
 #define blendfunc(t, a, b) *((t)  + ((a)<<8) + (b))
 
+/* arithmetic equivalent of the built-in blend tables for a single color component */
+static inline int BlendComponent(TLN_Blend mode, int a, int b) {
+  switch (mode) {
+    case BLEND_MIX25:
+      return (a + b + b) / 3;
+    case BLEND_MIX50:
+      return (a + b) >> 1;
+    case BLEND_MIX75:
+      return (a + a + b) / 3;
+    case BLEND_ADD:
+      return (a + b) > 255 ? 255 : (a + b);
+    case BLEND_SUB:
+      return (a - b) < 0 ? 0 : (a - b);
+    default:
+      return (a * b) / 255;
+  }
+}
+
+/* blends the RGB components of two 32-bit pixels, keeping destination alpha */
+static inline uint32_t BlendPixel(TLN_Blend mode, uint32_t src, uint32_t dst) {
+  return (dst & 0xFF000000) |
+         (BlendComponent(mode, (src >> 16) & 0xFF, (dst >> 16) & 0xFF) << 16) |
+         (BlendComponent(mode, (src >> 8) & 0xFF, (dst >> 8) & 0xFF) << 8) |
+         BlendComponent(mode, src & 0xFF, dst & 0xFF);
+}
+
 #endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#include <stdlib.h>
+#include "Threads.h"
+
+/* thread entry point and its argument, passed through the native start routine */
+typedef struct {
+    ThreadFunc func;
+    void *data;
+} ThreadStart;
+
+#if defined _WIN32
+
+static DWORD WINAPI ThreadEntry(LPVOID param) {
+  ThreadStart start = *(ThreadStart *) param;
+  free(param);
+  start.func(start.data);
+  return 0;
+}
+
+bool ThreadCreate(thread_t *thread, ThreadFunc func, void *data) {
+  ThreadStart *start = (ThreadStart *) malloc(sizeof(ThreadStart));
+  if (start == NULL) {
+    return false;
+  }
+
+  start->func = func;
+  start->data = data;
+  *thread = CreateThread(NULL, 0, ThreadEntry, start, 0, NULL);
+  if (*thread == NULL) {
+    free(start);
+    return false;
+  }
+  return true;
+}
+
+void ThreadJoin(thread_t thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+void MutexInit(mutex_t *mutex) {
+  InitializeCriticalSection(mutex);
+}
+
+void MutexDelete(mutex_t *mutex) {
+  DeleteCriticalSection(mutex);
+}
+
+void MutexLock(mutex_t *mutex) {
+  EnterCriticalSection(mutex);
+}
+
+void MutexUnlock(mutex_t *mutex) {
+  LeaveCriticalSection(mutex);
+}
+
+void CondInit(cond_t *cond) {
+  InitializeConditionVariable(cond);
+}
+
+void CondDelete(cond_t *cond) {
+}
+
+void CondWait(cond_t *cond, mutex_t *mutex) {
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void CondSignal(cond_t *cond) {
+  WakeConditionVariable(cond);
+}
+
+void CondBroadcast(cond_t *cond) {
+  WakeAllConditionVariable(cond);
+}
+
+static BOOL CALLBACK OnceEntry(PINIT_ONCE once, PVOID param, PVOID *context) {
+  ((void (*)(void)) param)();
+  return TRUE;
+}
+
+/* runs func exactly once among all the callers sharing once */
+void CallOnce(once_t *once, void (*func)(void)) {
+  InitOnceExecuteOnce(once, OnceEntry, (PVOID) func, NULL);
+}
+
+/* adds delta to value without locking, returns the new value */
+uint32_t AtomicAdd(volatile uint32_t *value, int delta) {
+  return (uint32_t) InterlockedExchangeAdd((volatile LONG *) value, delta) + delta;
+}
+
+#else
+
+static void *ThreadEntry(void *param) {
+  ThreadStart start = *(ThreadStart *) param;
+  free(param);
+  start.func(start.data);
+  return NULL;
+}
+
+bool ThreadCreate(thread_t *thread, ThreadFunc func, void *data) {
+  ThreadStart *start = (ThreadStart *) malloc(sizeof(ThreadStart));
+  if (start == NULL) {
+    return false;
+  }
+
+  start->func = func;
+  start->data = data;
+  if (pthread_create(thread, NULL, ThreadEntry, start) != 0) {
+    free(start);
+    return false;
+  }
+  return true;
+}
+
+void ThreadJoin(thread_t thread) {
+  pthread_join(thread, NULL);
+}
+
+void MutexInit(mutex_t *mutex) {
+  pthread_mutex_init(mutex, NULL);
+}
+
+void MutexDelete(mutex_t *mutex) {
+  pthread_mutex_destroy(mutex);
+}
+
+void MutexLock(mutex_t *mutex) {
+  pthread_mutex_lock(mutex);
+}
+
+void MutexUnlock(mutex_t *mutex) {
+  pthread_mutex_unlock(mutex);
+}
+
+void CondInit(cond_t *cond) {
+  pthread_cond_init(cond, NULL);
+}
+
+void CondDelete(cond_t *cond) {
+  pthread_cond_destroy(cond);
+}
+
+void CondWait(cond_t *cond, mutex_t *mutex) {
+  pthread_cond_wait(cond, mutex);
+}
+
+void CondSignal(cond_t *cond) {
+  pthread_cond_signal(cond);
+}
+
+void CondBroadcast(cond_t *cond) {
+  pthread_cond_broadcast(cond);
+}
+
+void CallOnce(once_t *once, void (*func)(void)) {
+  pthread_once(once, func);
+}
+
+uint32_t AtomicAdd(volatile uint32_t *value, int delta) {
+  return __atomic_add_fetch(value, delta, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+#include "tiledjinn.h"
+
+#if defined _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef INIT_ONCE once_t;
+#define ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_once_t once_t;
+#define ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+/* variables with a separate instance in each thread */
+#if defined _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef void (*ThreadFunc)(void *);
+
+bool ThreadCreate(thread_t *thread, ThreadFunc func, void *data);
+
+void ThreadJoin(thread_t thread);
+
+void MutexInit(mutex_t *mutex);
+
+void MutexDelete(mutex_t *mutex);
+
+void MutexLock(mutex_t *mutex);
+
+void MutexUnlock(mutex_t *mutex);
+
+void CondInit(cond_t *cond);
+
+void CondDelete(cond_t *cond);
+
+void CondWait(cond_t *cond, mutex_t *mutex);
+
+void CondSignal(cond_t *cond);
+
+void CondBroadcast(cond_t *cond);
+
+void CallOnce(once_t *once, void (*func)(void));
+
+uint32_t AtomicAdd(volatile uint32_t *value, int delta);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+/*
+ * Cache of tiles pre-expanded to 32 bpp, so normal layers copy tile rows instead of resolving each
+ * pixel through the palette. Entries are keyed by tileset, tile, palette and horizontal flip, and hold
+ * the versions of the tileset pixels and palette colors they were built from: any edit bumps the
+ * version and the stale entry is rebuilt on its next lookup. Tiles that can't be expanded are cached as
+ * failed entries too, so they are only tried once per version.
+ */
+
+#include <stdlib.h>
+#include "TileCache.h"
+#include "Tileset.h"
+#include "Palette.h"
+
+#define TILE_CACHE_ENTRY_SIZE  (16 * 16 * 4)  /* expected bytes per entry, used to size the table */
+
+/* sets up an empty cache that will allocate at most max_memory bytes of pixels */
+bool CreateTileCache(TileCache *cache, int max_memory) {
+  int numentries = 64;
+
+  while (numentries * 2 * TILE_CACHE_ENTRY_SIZE <= max_memory) {
+    numentries *= 2;
+  }
+
+  cache->entries = (TileCacheEntry *) calloc(numentries, sizeof(TileCacheEntry));
+  cache->numentries = cache->entries != NULL ? numentries : 0;
+  cache->memory = 0;
+  cache->max_memory = max_memory;
+  cache->hits = cache->misses = 0;
+  return cache->entries != NULL;
+}
+
+void DeleteTileCache(TileCache *cache) {
+  int c;
+
+  for (c = 0; c < cache->numentries; c++) {
+    free(cache->entries[c].pixels);
+  }
+  free(cache->entries);
+  cache->entries = NULL;
+  cache->numentries = 0;
+  cache->memory = 0;
+}
+
+/* fills entry with the tile resolved through the palette. Fails if an opaque pixel resolves to 0 */
+static bool ExpandTile(TileCacheEntry *entry, const struct Tileset *tileset, int tile,
+                       const struct Palette *palette, bool flipx) {
+  const uint32_t *color = (const uint32_t *) palette->data;
+  const uint8_t *srcpixel = &GetTilesetPixel(tileset, tile, 0, 0);
+  uint32_t *dstpixel = entry->pixels;
+  int x, y;
+
+  for (y = 0; y < tileset->height; y++) {
+    for (x = 0; x < tileset->width; x++) {
+      const uint8_t index = srcpixel[flipx ? tileset->width - 1 - x : x];
+      if (index == 0) {
+        *dstpixel++ = 0;
+      }
+      else if (color[index] != 0) {
+        *dstpixel++ = color[index];
+      }
+      else {
+        return false;
+      }
+    }
+    srcpixel += tileset->width;
+  }
+  return true;
+}
+
+/*
+ * returns the tile expanded to 32 bpp, with transparent pixels as 0, or NULL if it can't be cached or expanded.
+ * The pixels stay valid until the next lookup in the same cache
+ */
+const uint32_t *GetCachedTile(TileCache *cache, const struct Tileset *tileset, int tile,
+                              const struct Palette *palette, bool flipx) {
+  const int size = tileset->width * tileset->height * sizeof(uint32_t);
+  uintptr_t hash;
+  TileCacheEntry *entry;
+
+  if (palette == NULL) {
+    return NULL;
+  }
+
+  hash = ((uintptr_t) tileset >> 4) ^ ((uintptr_t) tile * 2654435761u) ^ (((uintptr_t) palette >> 4) * 40503u) ^
+         flipx;
+  entry = &cache->entries[hash & (cache->numentries - 1)];
+  if (entry->tileset == tileset && entry->tile == tile && entry->palette == palette && entry->flipx == flipx &&
+      entry->tileset_version == tileset->version && entry->palette_version == palette->version) {
+    if (entry->failed) {
+      cache->misses += 1;
+      return NULL;
+    }
+    cache->hits += 1;
+    return entry->pixels;
+  }
+
+  /* evict the previous occupant, reusing its memory when sizes match */
+  cache->misses += 1;
+  entry->tileset = NULL;
+  if (entry->size != size) {
+    free(entry->pixels);
+    cache->memory -= entry->size;
+    entry->pixels = NULL;
+    entry->size = 0;
+    if (cache->memory + size > cache->max_memory) {
+      return NULL;
+    }
+    entry->pixels = (uint32_t *) malloc(size);
+    if (entry->pixels == NULL) {
+      return NULL;
+    }
+    entry->size = size;
+    cache->memory += size;
+  }
+
+  entry->failed = !ExpandTile(entry, tileset, tile, palette, flipx);
+  entry->tileset = tileset;
+  entry->tileset_version = tileset->version;
+  entry->palette = palette;
+  entry->palette_version = palette->version;
+  entry->tile = tile;
+  entry->flipx = flipx;
+  return entry->failed ? NULL : entry->pixels;
+}
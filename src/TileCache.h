@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include "tiledjinn.h"
+
+/* tile expanded to 32 bpp with one palette, optionally flipped horizontally */
+typedef struct {
+    const struct Tileset *tileset;  /* source tileset */
+    uint32_t tileset_version;  /* tileset pixels version when expanded */
+    const struct Palette *palette;  /* source palette */
+    uint32_t palette_version;  /* palette colors version when expanded */
+    int tile;        /* tileset entry */
+    bool flipx;        /* pixels stored mirrored */
+    bool failed;      /* can't be expanded, an opaque pixel resolves to 0: drawn through the palette */
+    int size;        /* bytes allocated in pixels */
+    uint32_t *pixels;    /* width * height colors, 0 = transparent */
+} TileCacheEntry;
+
+/* direct mapped cache of expanded tiles, one per render thread */
+typedef struct {
+    int numentries;    /* power of two */
+    TileCacheEntry *entries;
+    int memory;      /* bytes used by pixels */
+    int max_memory;    /* cap for memory */
+    uint32_t hits;
+    uint32_t misses;
+} TileCache;
+
+bool CreateTileCache(TileCache *cache, int max_memory);
+
+void DeleteTileCache(TileCache *cache);
+
+const uint32_t *GetCachedTile(TileCache *cache, const struct Tileset *tileset, int tile,
+                              const struct Palette *palette, bool flipx);
+
+#endif
@@ -15,6 +15,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "tiledjinn.h"
 #include "Tilemap.h"
 
@@ -22,6 +23,24 @@ typedef struct {
     int x, y, w, h;
 } Rect;
 
+#define MAX_RUN  0xFFFF  /* longer runs are stored short, and skipped in several steps */
+
+/*
+ * rebuilds the empty runs of a row after changing its tiles in [col1, col2). Each run depends on the
+ * tiles to its right, so the update goes leftwards and stops at the first tile that isn't empty
+ */
+static void UpdateTilemapRuns(TLN_Tilemap tilemap, int row, int col1, int col2) {
+  const Tile *tiles = &tilemap->tiles[row * tilemap->cols];
+  uint16_t *runs = &tilemap->runs[row * tilemap->cols];
+  int run = col2 < tilemap->cols ? runs[col2] : 0;
+  int c;
+
+  for (c = col2 - 1; c >= 0 && (c >= col1 || tiles[c].index == 0); c--) {
+    run = tiles[c].index == 0 ? run + 1 : 0;
+    runs[c] = (uint16_t) (run < MAX_RUN ? run : MAX_RUN);
+  }
+}
+
 /*!
  * \brief
  * Creates a new tilemap
@@ -54,12 +73,20 @@ TLN_Tilemap TLN_CreateTilemap(int rows, int cols, TLN_Tile tiles, uint32_t bgcol
 #pragma EXPORT_FUNC
   TLN_Tilemap tilemap = NULL;
   int size = sizeof(struct Tilemap) + (rows * cols * sizeof(Tile));
+  int c;
 
   tilemap = (TLN_Tilemap) CreateBaseObject(OT_TILEMAP, size);
   if (!tilemap) {
     return NULL;
   }
 
+  tilemap->runs = (uint16_t *) malloc(rows * cols * sizeof(uint16_t));
+  if (!tilemap->runs) {
+    DeleteBaseObject(tilemap);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
+  }
+
   tilemap->rows = rows;
   tilemap->cols = cols;
   tilemap->bgcolor = bgcolor;
@@ -67,7 +94,10 @@ TLN_Tilemap TLN_CreateTilemap(int rows, int cols, TLN_Tile tiles, uint32_t bgcol
   tilemap->visible = true;
 
   if (tiles) {
-    memcpy(tilemap->tiles, tiles, tilemap->size - sizeof(struct Tilemap));
+    memcpy(tilemap->tiles, tiles, rows * cols * sizeof(Tile));
+  }
+  for (c = 0; c < rows; c++) {
+    UpdateTilemapRuns(tilemap, c, 0, cols);
   }
 
   TLN_SetLastError(TLN_ERR_OK);
@@ -97,6 +127,15 @@ TLN_Tilemap TLN_CloneTilemap(TLN_Tilemap src) {
 
   tilemap = (TLN_Tilemap) CloneBaseObject(src);
   if (tilemap) {
+    const int size_runs = src->rows * src->cols * sizeof(uint16_t);
+
+    tilemap->runs = (uint16_t *) malloc(size_runs);
+    if (!tilemap->runs) {
+      DeleteBaseObject(tilemap);
+      TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+      return NULL;
+    }
+    memcpy(tilemap->runs, src->runs, size_runs);
     TLN_SetLastError(TLN_ERR_OK);
     return tilemap;
   }
@@ -241,6 +280,7 @@ bool TLN_SetTilemapTile(TLN_Tilemap tilemap, int row, int col, TLN_Tile tile) {
       if (tilemap->maxindex < tile->index) {
         tilemap->maxindex = tile->index;
       }
+      UpdateTilemapRuns(tilemap, row, col, col + 1);
 
       TLN_SetLastError(TLN_ERR_OK);
       return true;
@@ -271,6 +311,7 @@ bool TLN_SetTilemapTile(TLN_Tilemap tilemap, int row, int col, TLN_Tile tile) {
 bool TLN_DeleteTilemap(TLN_Tilemap tilemap) {
 #pragma EXPORT_FUNC
   if (CheckBaseObject(tilemap, OT_TILEMAP)) {
+    free(tilemap->runs);
     DeleteBaseObject(tilemap);
     TLN_SetLastError(TLN_ERR_OK);
     return true;
@@ -332,12 +373,19 @@ TLN_CopyTiles(TLN_Tilemap src, int srcrow, int srccol, int rows, int cols, TLN_T
   /* setup rects */
   {
     Rect tgtrect = {srccol, srcrow, cols, rows};  /* area a copiar */
-    Rect srcrect = {0, 0, src->rows, src->cols};  /* tilemap de origen */
-    Rect dstrect = {0, 0, dst->rows, dst->cols};  /* tilemap de destino */
+    Rect srcrect = {0, 0, src->cols, src->rows};  /* tilemap de origen */
+    Rect dstrect = {0, 0, dst->cols, dst->rows};  /* tilemap de destino */
+    Rect cliprect;
 
-    /* clipping */
+    /* clipping, rows must not spill into the next one */
     ClipRect(&tgtrect, &srcrect);
-    ClipRect(&tgtrect, &dstrect);
+    cliprect.x = dstcol;
+    cliprect.y = dstrow;
+    cliprect.w = tgtrect.w;
+    cliprect.h = tgtrect.h;
+    ClipRect(&cliprect, &dstrect);
+    tgtrect.w = cliprect.w;
+    tgtrect.h = cliprect.h;
 
     size = tgtrect.w * sizeof(Tile);
     for (y = 0; y < tgtrect.h; y++) {
@@ -345,6 +393,7 @@ TLN_CopyTiles(TLN_Tilemap src, int srcrow, int srccol, int rows, int cols, TLN_T
       Tile *dsttile = GetTilemapPtr(dst, y + dstrow, dstcol);
       if (srctile && dsttile) {
         memcpy(dsttile, srctile, size);
+        UpdateTilemapRuns(dst, y + dstrow, dstcol, dstcol + tgtrect.w);
       }
       else {
         TLN_SetLastError(TLN_ERR_WRONG_SIZE);
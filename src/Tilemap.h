@@ -25,7 +25,16 @@ struct Tilemap {
     int id;      /* id property */
     bool visible;  /* visible property */
     struct Tileset *tileset; /* attached tileset (if any) */
+    uint16_t *runs;  /* empty tiles from each tile to the end of its row, see UpdateTilemapRuns() */
     Tile tiles[];
 };
 
+/* number of empty tiles starting at a tile, without wrapping to the next row. 0 for tiles that aren't empty */
+#define GetTilemapRun(tilemap, row, col) \
+  (tilemap)->runs[(row) * (tilemap)->cols + (col)]
+
+/* true if the whole row is empty */
+#define IsTilemapRowEmpty(tilemap, row) \
+  (GetTilemapRun(tilemap, row, 0) == (tilemap)->cols)
+
 #endif
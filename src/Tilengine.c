@@ -23,9 +23,7 @@
 /* magic number to recognize context object */
 #define ID_CONTEXT  0x7E5D0AB1
 
-TLN_Engine engine;  /* current context */
-
-extern struct Palette **indexed_palettes;  // Palette.c
+THREAD_LOCAL TLN_Engine engine;  /* current context, selected independently by each thread */
 
 /*!
  * \brief
@@ -47,24 +45,22 @@ extern struct Palette **indexed_palettes;  // Palette.c
  * number of palette animation slots
  * 
  * Performs initialisation of the main engine, creates the viewport with the specified dimensions
- * and allocates the number of layers, sprites and animation slots
+ * and allocates the number of layers, sprites and animation slots. The new context becomes the
+ * current one of the calling thread if that thread didn't have any. The version banner is printed
+ * to stderr, like the log messages, so stdout is left to the application
  */
 TLN_Engine TLN_Init(int hres, int vres, int numlayers, int numsprites) {
 #pragma EXPORT_FUNC
-  printf("TileDjinn v%d.%d.%d %d-bit built %s %s\n", TILENGINE_VER_MAJ, TILENGINE_VER_MIN, TILENGINE_VER_REV,
-         (int) (sizeof(UINTPTR_MAX) << 3), __DATE__, __TIME__); // NOLINT(bugprone-sizeof-expression)
+  fprintf(stderr, "TileDjinn v%d.%d.%d %d-bit built %s %s\n", TILENGINE_VER_MAJ, TILENGINE_VER_MIN, TILENGINE_VER_REV,
+          (int) (sizeof(UINTPTR_MAX) << 3), __DATE__, __TIME__); // NOLINT(bugprone-sizeof-expression)
 
   int c;
   TLN_Engine context;
 
-  indexed_palettes = malloc(sizeof(struct Palette *) * 256);
-
-  for (int i = 0; i < 256; ++i) {
-    indexed_palettes[i] = 0;
-  }
-
   TLN_SetLastError(TLN_ERR_OK);
 
+  InitBlitters();
+
   int bpp = 32;
 
   /* create framebuffer */
@@ -73,16 +69,6 @@ TLN_Engine TLN_Init(int hres, int vres, int numlayers, int numsprites) {
   context->framebuffer.width = hres;
   context->framebuffer.height = vres;
   context->framebuffer.pitch = (((hres * bpp) >> 3) + 3) & ~0x03;
-  context->priority = (uint8_t *) malloc(context->framebuffer.pitch);
-  if (!context->priority) {
-    TLN_DeleteContext(context);
-    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
-    return NULL;
-  }
-
-  /* sprite collision buffer */
-  context->collision = (uint16_t *) calloc(hres * sizeof(uint16_t), 1);
-  context->tmpindex = (uint8_t *) calloc(hres, 1);
 
   /* create static items */
   context->numlayers = numlayers;
@@ -92,40 +78,77 @@ TLN_Engine TLN_Init(int hres, int vres, int numlayers, int numsprites) {
     TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
     return NULL;
   }
-  for (c = 0; c < context->numlayers; c++) {
-    context->layers[c].mosaic.buffer = (uint8_t *) malloc(hres);
-  }
 
   context->numsprites = numsprites;
-  context->sprites = (Sprite *) calloc(numsprites, sizeof(Sprite));
-  if (!context->sprites) {
+  context->sprite_memory = calloc(numsprites * sizeof(Sprite) + SPRITE_RECORD_SIZE, 1);
+  context->sprite_info = (SpriteInfo *) calloc(numsprites + 1, sizeof(SpriteInfo));
+  if (!context->sprite_memory || !context->sprite_info) {
     TLN_DeleteContext(context);
     TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
     return NULL;
   }
+  context->sprites = (Sprite *) (((uintptr_t) context->sprite_memory + SPRITE_RECORD_SIZE - 1) &
+                                 ~(uintptr_t) (SPRITE_RECORD_SIZE - 1));
   for (c = 0; c < context->numsprites; c++) {
     Sprite *sprite = &context->sprites[c];
     sprite->draw = GetSpriteDraw(MODE_NORMAL);
-    sprite->blitter = GetBlitter(bpp, true, false, false);
-    sprite->sx = sprite->sy = 1.0f;
+    sprite->blitter = GetBlitter(bpp, true, false, BLEND_NONE);
+    context->sprite_info[c].sx = context->sprite_info[c].sy = 1.0f;
   }
 
-  context->bgcolor = PackRGB32(0, 0, 0);
-  context->blit_fast = GetBlitter(bpp, false, false, false);
-  if (!CreateBlendTables()) {
+  /* per-frame list of layers */
+  if (!CreateDrawList(context)) {
     TLN_DeleteContext(context);
     TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
     return NULL;
   }
-  context->blend_table = SelectBlendTable(BLEND_MOD);
 
-  /* set as default context if it's the first one */
-  if (engine == NULL) {
-    engine = context;
+  /* per-scanline sprite index */
+  if (!CreateSpriteBuckets(context)) {
+    TLN_DeleteContext(context);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
   }
 
+  /* sprite pairs checked for collision, sized before the workers that count them */
+  if (!CreateBroadphase(&context->broadphase, numsprites)) {
+    TLN_DeleteContext(context);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
+  }
+
+  /* scanline buffers, single render thread by default */
+  if (!CreateWorkers(context, 1)) {
+    TLN_DeleteContext(context);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
+  }
+
+  /* colliding sprite pairs and layers under sprites of the last frame */
+  if (!CreateCollisionList(&context->collisions) || !CreateLayerHits(&context->layer_hits, numsprites)) {
+    TLN_DeleteContext(context);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
+  }
+
+  context->bgcolor = PackRGB32(0, 0, 0);
+  context->blit_fast = GetBlitter(bpp, false, false, BLEND_NONE);
+  if (!CreateBlendTables(context->blend_tables)) {
+    TLN_DeleteContext(context);
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return NULL;
+  }
+  context->blend_table = context->blend_tables[BLEND_MOD];
+
   for (c = 0; c < context->numlayers; c++) {
-    TLN_DisableLayerClip(c);
+    Layer *layer = &context->layers[c];
+    layer->clip.x2 = context->framebuffer.width;
+    layer->clip.y2 = context->framebuffer.height;
+  }
+
+  /* set as default context if it's the first one of this thread */
+  if (engine == NULL) {
+    engine = context;
   }
 
 #ifdef _DEBUG
@@ -151,6 +174,9 @@ static bool check_context(TLN_Engine context) {
 * \param context
 * TLN_Engine object to set as current context, returned by TLN_Init()
 *
+* The current context is kept per thread: contexts selected in different threads can be set up and
+* rendered at the same time, as long as each context is only used by one thread at a time.
+*
 * \returns
 * true if success or false if wrong context is supplied
 */
@@ -169,7 +195,7 @@ bool TLN_SetContext(TLN_Engine context) {
 
 /*!
 * \brief
-* Returns the current engine context
+* Returns the current engine context of the calling thread
 */
 TLN_Engine TLN_GetContext(void) {
 #pragma EXPORT_FUNC
@@ -204,36 +230,32 @@ bool TLN_DeleteContext(TLN_Engine context) {
     return false;
   }
 
-  if (indexed_palettes) {
-    free(indexed_palettes);
+  for (c = 0; c < 256; c++) {
+    DeleteBaseObject(context->palettes[c]);
   }
 
-  DeleteBlendTables();
+  DeleteBlendTables(context->blend_tables);
 
-  for (c = 0; c < context->numlayers; c++) {
-    free(context->layers[c].mosaic.buffer);
-  }
+  DeleteWorkers(context);
+  DeleteCollisionList(&context->collisions);
+  DeleteLayerHits(&context->layer_hits);
+  DeleteBroadphase(&context->broadphase);
+  DeleteSpriteBuckets(context);
+  DeleteDrawList(context);
 
-  if (context->sprites) {
-    free(context->sprites);
-  }
+  free(context->sprite_memory);
+  free(context->sprite_info);
 
   if (context->layers) {
+    for (c = 0; c < context->numlayers; c++) {
+      free(context->layers[c].column_offset);
+    }
     free(context->layers);
   }
 
-  if (context->priority) {
-    free(context->priority);
-  }
-
-  if (context->collision) {
-    free(context->collision);
-  }
-
-  if (context->tmpindex) {
-    free(context->tmpindex);
+  if (engine == context) {
+    engine = NULL;
   }
-
   free(context);
   return true;
 }
@@ -244,6 +266,8 @@ bool TLN_DeleteContext(TLN_Engine context) {
  *
  * \param log_level
  * value to set, member of the TLN_LogLevel enumeration
+ *
+ * Messages are written to stderr
  */
 void TLN_SetLogLevel(TLN_LogLevel log_level) {
 #pragma EXPORT_FUNC
@@ -351,24 +375,23 @@ int TLN_GetRenderTargetPitch(void) {
   return engine->framebuffer.pitch;
 }
 
-/* Starts active rendering of the current frame */
-static void BeginFrame(int frame) {
-  /* update active animations */
-  int index;
-
+/* Starts active rendering of the frame of a context */
+static void BeginFrame(Engine *context, int frame) {
   /* autoincrement if 0 */
   if (frame != 0) {
-    engine->frame = frame;
+    context->frame = frame;
   }
   else {
-    engine->frame += 1;
+    context->frame += 1;
   }
 
   /* frame callback */
-  engine->line = 0;
-  if (engine->cb_frame) {
-    engine->cb_frame(engine->frame);
+  if (context->cb_frame) {
+    context->cb_frame(context->frame);
   }
+
+  /* resolve state changed since the previous frame */
+  PrepareFrame(context);
 }
 
 /*!
@@ -378,12 +401,185 @@ static void BeginFrame(int frame) {
  * \param frame Optional frame number. Set to 0 to autoincrement from previous value
  *
  * \see
- * TLN_SetRenderTarget()
+ * TLN_SetRenderTarget(), TLN_UpdateFrameContext()
  */
 void TLN_UpdateFrame(int frame) {
 #pragma EXPORT_FUNC
-  BeginFrame(frame);
-  while (DrawScanline()) {}
+  TLN_UpdateFrameContext(engine, frame);
+}
+
+/*!
+ * \brief
+ * Draws the frame of an explicit context to its render target
+ *
+ * \param context
+ * context to draw, returned by TLN_Init()
+ *
+ * \param frame
+ * Optional frame number. Set to 0 to autoincrement from previous value
+ *
+ * All the render state is owned by the context, so different contexts can be drawn at the same time
+ * from different threads without locking. The context is made current on the calling thread while the
+ * frame and raster callbacks run, so they can use the regular TLN_xxx functions, and the previous current
+ * context is restored afterwards.
+ *
+ * \returns
+ * true if success or false if wrong context is supplied
+ *
+ * \see
+ * TLN_UpdateFrame(), TLN_SetContext()
+ */
+bool TLN_UpdateFrameContext(TLN_Engine context, int frame) {
+#pragma EXPORT_FUNC
+  TLN_Engine current = engine;
+
+  if (!check_context(context)) {
+    TLN_SetLastError(TLN_ERR_NULL_POINTER);
+    return false;
+  }
+
+  engine = context;
+  BeginFrame(context, frame);
+  DrawFrame(context);
+  TLN_SetLastError(TLN_ERR_OK);
+  engine = current;
+  return true;
+}
+
+/*!
+ * \brief
+ * Sets the number of threads used to render each frame
+ *
+ * \param count
+ * number of render threads, 1 to render on the calling thread only (default)
+ *
+ * The frame is split in horizontal bands of consecutive scanlines, each one drawn by its own
+ * thread with private scanline buffers. TLN_UpdateFrame() returns once all the bands are done,
+ * and the output is identical to single threaded rendering.
+ *
+ * \remarks
+ * Raster effects require the callback to run between scanlines in strict order, so frames
+ * rendered with a raster callback set are drawn on the calling thread regardless of this setting.
+ * The count is clamped to the framebuffer height. If the new threads can't be created the function
+ * fails, and rendering goes on with the previous number of threads, or with a single one if the
+ * threads themselves couldn't be started.
+ *
+ * \see
+ * TLN_UpdateFrame(), TLN_SetRasterCallback()
+ */
+bool TLN_SetRenderThreads(int count) {
+#pragma EXPORT_FUNC
+  if (count < 1) {
+    TLN_SetLastError(TLN_ERR_WRONG_SIZE);
+    return false;
+  }
+  if (count > engine->framebuffer.height) {
+    count = engine->framebuffer.height;
+  }
+
+  /* on failure the previous threads are kept, or a single one if the new threads couldn't be started */
+  if (count != engine->numworkers && !CreateWorkers(engine, count)) {
+    TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+    return false;
+  }
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Enables the cache of tiles expanded to 32 bpp
+ *
+ * \param size
+ * maximum bytes of expanded tiles held by each render thread, 0 to disable the cache (default)
+ *
+ * Normal layers without blending copy cached tile rows to the framebuffer instead of resolving each
+ * pixel through the palette. Tiles are cached for each palette and horizontal flip they're drawn with,
+ * and rebuilt when their tileset pixels or palette colors change. Tiles that don't fit in the cache are
+ * drawn as usual.
+ *
+ * \remarks
+ * Changing palette colors through the pointer returned by TLN_GetPaletteData() isn't tracked by the
+ * cache, use TLN_SetPaletteColor() or the other palette functions instead.
+ *
+ * \see
+ * TLN_GetTileCacheStats(), TLN_SetRenderThreads()
+ */
+bool TLN_SetTileCache(int size) {
+#pragma EXPORT_FUNC
+  int c;
+
+  if (size < 0) {
+    TLN_SetLastError(TLN_ERR_WRONG_SIZE);
+    return false;
+  }
+
+  engine->tilecache_size = size;
+  for (c = 0; c < engine->numworkers; c++) {
+    TileCache *cache = &engine->workers[c].tilecache;
+    DeleteTileCache(cache);
+    if (size > 0 && !CreateTileCache(cache, size)) {
+      TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+      return false;
+    }
+  }
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Returns the tile cache statistics of all the render threads and resets the hit and miss counters
+ *
+ * \param stats
+ * pointer to a TLN_TileCacheStats struct that receives the statistics
+ *
+ * \see
+ * TLN_SetTileCache()
+ */
+bool TLN_GetTileCacheStats(TLN_TileCacheStats *stats) {
+#pragma EXPORT_FUNC
+  int c;
+
+  if (stats == NULL) {
+    TLN_SetLastError(TLN_ERR_NULL_POINTER);
+    return false;
+  }
+
+  stats->hits = stats->misses = 0;
+  stats->memory = 0;
+  for (c = 0; c < engine->numworkers; c++) {
+    TileCache *cache = &engine->workers[c].tilecache;
+    stats->hits += cache->hits;
+    stats->misses += cache->misses;
+    stats->memory += cache->memory;
+    cache->hits = cache->misses = 0;
+  }
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
+/*!
+ * \brief
+ * Enables occlusion culling of layers
+ *
+ * \param enable
+ * true to skip the pixels hidden by opaque layers, false to draw every layer completely (default)
+ *
+ * Before drawing each scanline the layers are walked front to back, marking the pixels covered by tile rows
+ * without transparent pixels in unblended normal layers. Layers behind only draw the parts of their tiles that
+ * remain visible, and the background color only fills the holes. The output is the same, with less overdraw
+ * in scenes with several opaque layers.
+ *
+ * \see
+ * TLN_SetLayerTilemap()
+ */
+void TLN_EnableOcclusionCulling(bool enable) {
+#pragma EXPORT_FUNC
+  engine->occlusion = enable;
   TLN_SetLastError(TLN_ERR_OK);
 }
 
@@ -491,6 +687,26 @@ bool TLN_SetBGColorFromTilemap(TLN_Tilemap tilemap) {
   }
 }
 
+/*!
+ * \brief
+ * Sets a background color for each scanline
+ * 
+ * \param colors
+ * Array with one 0xRRGGBB color per line of the framebuffer, or NULL to use the color set with
+ * TLN_SetBGColor() again
+ * 
+ * Draws background gradients without a raster callback. The array isn't copied, so it can be
+ * updated between frames.
+ * 
+ * \see
+ * TLN_SetBGColor(), TLN_SetLayerLineTables()
+ */
+void TLN_SetBGColorTable(const uint32_t *colors) {
+#pragma EXPORT_FUNC
+  engine->bgcolor_table = colors;
+  TLN_SetLastError(TLN_ERR_OK);
+}
+
 /*!
  * \brief
  * Disales background color rendering. If you know that the last background layer will always
@@ -653,6 +869,6 @@ void tln_trace(TLN_LogLevel log_level, const char *format, ...) {
     vsprintf(line, format, ap);
             va_end(ap);
 
-    printf("Tilengine: %s\n", line);
+    fprintf(stderr, "Tilengine: %s\n", line);
   }
 }
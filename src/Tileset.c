@@ -19,8 +19,12 @@
 #include "tiledjinn.h"
 #include "Tileset.h"
 #include "Palette.h"
+#include "Threads.h"
 
-static bool HasTransparentPixels(uint8_t *src, int width);
+static volatile uint32_t tileset_version;  /* last version given to a tileset */
+
+static void GetTileLine(TileLine *line, const uint8_t *src, int width);
+static void MirrorTile(TLN_Tileset tileset, int entry);
 
 /*!
  * \brief
@@ -92,7 +96,15 @@ TLN_Tileset TLN_CreateTileset(int numtiles, int width, int height, TLN_TileAttri
   tileset->hmask = width - 1;
   tileset->vmask = height - 1;
   tileset->numtiles = numtiles;
-  tileset->color_key = (bool *) calloc(numtiles, height);
+  tileset->version = AtomicAdd(&tileset_version, 1);
+  tileset->lines = (TileLine *) malloc(numtiles * height * sizeof(TileLine));
+  if (tileset->lines != NULL) {
+    for (c = 0; c < numtiles * height; c++) {
+      tileset->lines[c].left = tileset->lines[c].right = (uint16_t) width;
+      tileset->lines[c].runs = 0;
+      tileset->lines[c].color_key = true;
+    }
+  }
   tileset->attributes = (TLN_TileAttributes *) malloc(size_attributes);
   if (attributes != NULL) {
     memcpy(tileset->attributes, attributes, size_attributes);
@@ -163,10 +175,14 @@ bool TLN_SetTilesetPixels(TLN_Tileset tileset, int entry, uint8_t *srcdata, int
   dstdata = tileset->data + (entry * tileset->width * tileset->height);
   for (c = 0; c < tileset->height; c++) {
     memcpy(dstdata, srcdata, tileset->width);
-    tileset->color_key[line++] = HasTransparentPixels(srcdata, tileset->width);
+    GetTileLine(&tileset->lines[line++], srcdata, tileset->width);
     srcdata += srcpitch;
     dstdata += tileset->width;
   }
+  if (tileset->mirror != NULL) {
+    MirrorTile(tileset, entry);
+  }
+  tileset->version = AtomicAdd(&tileset_version, 1);
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;
@@ -197,16 +213,24 @@ TLN_Tileset TLN_CloneTileset(TLN_Tileset src) {
   tileset = (TLN_Tileset) CloneBaseObject(src);
   if (tileset) {
     const int size_tiles = src->numtiles * sizeof(uint16_t);
-    const int size_color = src->numtiles * src->height;
+    const int size_lines = src->numtiles * src->height * sizeof(TileLine);
     const int size_attributes = src->numtiles * sizeof(TLN_TileAttributes);
 
     TLN_SetLastError(TLN_ERR_OK);
+    tileset->version = AtomicAdd(&tileset_version, 1);
     tileset->tiles = (uint16_t *) malloc(size_tiles);
     memcpy(tileset->tiles, src->tiles, size_tiles);
-    tileset->color_key = (bool *) malloc(size_color);
-    memcpy(tileset->color_key, src->color_key, size_color);
+    tileset->lines = (TileLine *) malloc(size_lines);
+    memcpy(tileset->lines, src->lines, size_lines);
     tileset->attributes = (TLN_TileAttributes *) malloc(size_attributes);
     memcpy(tileset->attributes, src->attributes, size_attributes);
+    if (src->mirror != NULL) {
+      const int size_pixels = src->numtiles * src->width * src->height;
+      tileset->mirror = (uint8_t *) malloc(size_pixels);
+      if (tileset->mirror != NULL) {
+        memcpy(tileset->mirror, src->mirror, size_pixels);
+      }
+    }
     return tileset;
   }
   else {
@@ -233,8 +257,9 @@ bool TLN_DeleteTileset(TLN_Tileset tileset) {
 
   if (CheckBaseObject(tileset, OT_TILESET)) {
     free(tileset->tiles);
-    free(tileset->color_key);
+    free(tileset->lines);
     free(tileset->attributes);
+    free(tileset->mirror);
 
     DeleteBaseObject(tileset);
     TLN_SetLastError(TLN_ERR_OK);
@@ -245,6 +270,51 @@ bool TLN_DeleteTileset(TLN_Tileset tileset) {
   }
 }
 
+/*!
+ * \brief
+ * Keeps a horizontally mirrored copy of the tileset pixels
+ *
+ * \param tileset
+ * Reference to the tileset
+ *
+ * \param enable
+ * true to build and keep the mirrored copy, false to release it
+ *
+ * \returns
+ * true if success, or false if error
+ *
+ * \remarks
+ * Tiles and sprites with FLAG_FLIPX are drawn from the mirrored copy walking forwards, as fast as
+ * unflipped ones, at the cost of doubling the pixel memory of the tileset. The copy is updated by
+ * TLN_SetTilesetPixels()
+ */
+bool TLN_SetTilesetMirror(TLN_Tileset tileset, bool enable) {
+#pragma EXPORT_FUNC
+  int c;
+
+  if (!CheckBaseObject(tileset, OT_TILESET)) {
+    return false;
+  }
+
+  if (!enable) {
+    free(tileset->mirror);
+    tileset->mirror = NULL;
+  }
+  else if (tileset->mirror == NULL) {
+    tileset->mirror = (uint8_t *) malloc(tileset->numtiles * tileset->width * tileset->height);
+    if (tileset->mirror == NULL) {
+      TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+      return false;
+    }
+    for (c = 0; c < tileset->numtiles; c++) {
+      MirrorTile(tileset, c);
+    }
+  }
+
+  TLN_SetLastError(TLN_ERR_OK);
+  return true;
+}
+
 /*!
  * \brief
  * Returns the width in pixels of each individual tile in the tileset
@@ -305,11 +375,42 @@ int TLN_GetTilesetNumTiles(TLN_Tileset tileset) {
   }
 }
 
-static bool HasTransparentPixels(uint8_t *src, int width) {
-  register uint8_t *end = src + width;
-  do {
-    if (*src++ == 0) { return true; }
-  } while (src < end);
+/* finds the transparent edges and the opaque runs of a tile row */
+static void GetTileLine(TileLine *line, const uint8_t *src, int width) {
+  int x = 0;
 
-  return false;
+  line->runs = 0;
+  line->left = line->right = (uint16_t) width;
+  while (x < width) {
+    while (x < width && src[x] == 0) {
+      x++;
+    }
+    if (x == width) {
+      break;
+    }
+    if (line->runs == 0) {
+      line->left = (uint16_t) x;
+    }
+    line->runs++;
+    while (x < width && src[x] != 0) {
+      x++;
+    }
+    line->right = (uint16_t) (width - x);
+  }
+  line->color_key = line->runs != 1 || line->left != 0 || line->right != 0;
+}
+
+/* rebuilds the mirrored rows of a tile */
+static void MirrorTile(TLN_Tileset tileset, int entry) {
+  const uint8_t *src = &GetTilesetPixel(tileset, entry, 0, 0);
+  uint8_t *dst = &GetTilesetMirrorPixel(tileset, entry, 0, 0);
+  int x, y;
+
+  for (y = 0; y < tileset->height; y++) {
+    for (x = 0; x < tileset->width; x++) {
+      dst[x] = src[tileset->width - 1 - x];
+    }
+    src += tileset->width;
+    dst += tileset->width;
+  }
 }
@@ -21,6 +21,14 @@ typedef enum {
     TILESET_TILES,
 } TilesetType;
 
+/* transparency of a tile row, see TLN_SetTilesetPixels() */
+typedef struct {
+    uint16_t left;    /* transparent pixels before the first opaque one, the tile width if there are none */
+    uint16_t right;    /* transparent pixels after the last opaque one, the tile width if there are none */
+    uint16_t runs;    /* runs of opaque pixels, more than one means holes between left and right */
+    bool color_key;    /* has any transparent pixel */
+} TileLine;
+
 /* Tileset definition */
 struct Tileset {
     DEFINE_OBJECT;
@@ -33,9 +41,11 @@ struct Tileset {
     int hmask;       /* horizontal bitmask */
     int vmask;       /* vertical bitmask */
     TLN_TileAttributes *attributes;  /* attribute array */
-    bool *color_key;     /* array telling if each line has color key or is solid */
+    TileLine *lines;     /* transparency of each line, by GetTilesetLine() */
     uint16_t *tiles;    /* tile indexes for animation */
-    uint8_t data[];       /* variable size data for images[], attributes[], color_key[] and pixels */
+    uint8_t *mirror;    /* pixels with each row mirrored, see TLN_SetTilesetMirror(), or NULL */
+    uint32_t version;    /* changes on every pixel edit, checked by the tile cache */
+    uint8_t data[];       /* variable size data for images[], attributes[], lines[] and pixels */
 };
 
 #define GetTilesetLine(tileset, index, y) \
@@ -44,4 +54,7 @@ struct Tileset {
 #define GetTilesetPixel(tileset, index, x, y) \
   tileset->data[((((index) << (tileset)->vshift) + (y)) << (tileset)->hshift) + (x)]
 
+#define GetTilesetMirrorPixel(tileset, index, x, y) \
+  tileset->mirror[((((index) << (tileset)->vshift) + (y)) << (tileset)->hshift) + (x)]
+
 #endif
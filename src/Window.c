@@ -93,6 +93,7 @@ typedef struct {
     int height;
     int flags;
     char file_overlay[MAX_PATH];
+    TLN_Engine context;  /* context drawn by the window thread */
     volatile int retval;
 }
         WndParams;
@@ -344,6 +345,8 @@ void TLN_SetWindowTitle(const char *title) {
 static int WindowThread(void *data) {
   bool ok;
 
+  /* the current context is per thread */
+  TLN_SetContext(wnd_params.context);
   ok = s_CreateWindow();
   if (ok == true) {
     wnd_params.retval = 1;
@@ -463,6 +466,7 @@ bool TLN_CreateWindowThread(const char *overlay, int flags) {
 
   /* fill parameters for window creation */
   wnd_params.retval = 0;
+  wnd_params.context = TLN_GetContext();
   wnd_params.width = TLN_GetWidth();
   wnd_params.height = TLN_GetHeight();
   wnd_params.flags = flags | CWF_VSYNC;
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#include <stdlib.h>
+#include "tiledjinn.h"
+#include "Engine.h"
+#include "Draw.h"
+#include "Worker.h"
+
+/* allocates scanline buffers of a single worker */
+static bool InitWorker(Engine *context, Worker *worker) {
+  const int width = context->framebuffer.width;
+  const int numlayers = context->numlayers;
+
+  worker->context = context;
+  worker->priority = (uint8_t *) malloc(width * sizeof(uint32_t));
+  worker->collision = (uint16_t *) calloc(width, sizeof(uint16_t));
+  worker->sample_x = (int *) malloc(width * sizeof(int));
+  worker->sample_y = (int *) malloc(width * sizeof(int));
+  worker->mosaic = (uint32_t *) malloc((numlayers * width + 1) * sizeof(uint32_t));
+  worker->mosaic_line = (int *) malloc((numlayers + 1) * sizeof(int));
+  worker->priority_sprites = (uint16_t *) malloc((context->numsprites + 1) * sizeof(uint16_t));
+  worker->overlap.pixels = (int *) calloc(context->numsprites + 1, sizeof(int));
+  worker->overlap.sprites = (int *) malloc((context->numsprites + 1) * sizeof(int));
+  worker->pair_counts = (CollisionCount *) calloc(context->broadphase.capacity, sizeof(CollisionCount));
+  worker->touched_pairs = (int *) malloc(context->broadphase.capacity * sizeof(int));
+  worker->num_pair_counts = context->broadphase.capacity;
+  worker->coverage = (uint32_t *) calloc((numlayers + 1) * ((width + 31) >> 5), sizeof(uint32_t));
+  worker->layers = (Layer **) calloc(numlayers + 1, sizeof(Layer *));
+  worker->line_layers = (Layer *) calloc(numlayers + 1, sizeof(Layer));
+  worker->palettes = context->palettes;
+  if (!CreateCollisionList(&worker->collisions) || !CreateLayerHits(&worker->layer_hits, context->numsprites)) {
+    return false;
+  }
+  if (context->tilecache_size > 0 && !CreateTileCache(&worker->tilecache, context->tilecache_size)) {
+    return false;
+  }
+  return worker->priority && worker->collision && worker->sample_x && worker->sample_y && worker->mosaic &&
+         worker->mosaic_line && worker->priority_sprites && worker->overlap.pixels && worker->overlap.sprites &&
+         worker->pair_counts && worker->touched_pairs && worker->coverage && worker->layers &&
+         worker->line_layers;
+}
+
+static void FreeWorker(Worker *worker) {
+  free(worker->priority);
+  free(worker->collision);
+  free(worker->sample_x);
+  free(worker->sample_y);
+  free(worker->mosaic);
+  free(worker->mosaic_line);
+  free(worker->priority_sprites);
+  free(worker->overlap.pixels);
+  free(worker->overlap.sprites);
+  free(worker->pair_counts);
+  free(worker->touched_pairs);
+  free(worker->coverage);
+  free(worker->layers);
+  free(worker->line_layers);
+  DeleteCollisionList(&worker->collisions);
+  DeleteLayerHits(&worker->layer_hits);
+  DeleteTileCache(&worker->tilecache);
+}
+
+/* draws the band of scanlines [line, end) assigned to the worker */
+static void DrawBand(Worker *worker) {
+  int c;
+
+  /* mosaic lines sampled in another band or frame aren't valid here */
+  for (c = 0; c < worker->context->numlayers; c++) {
+    worker->mosaic_line[c] = -1;
+  }
+
+  while (worker->line < worker->end) {
+    DrawScanline(worker);
+  }
+  FlushCollisions(worker);
+}
+
+/* transfers the collisions detected by the workers to the sprites, and their pairs and layers to the context */
+static void MergeCollisions(Engine *context, int numworkers) {
+  const CollisionList *list = &context->collisions;
+  int c;
+
+  ClearCollisionList(&context->collisions);
+  ClearLayerHits(&context->layer_hits);
+  for (c = 0; c < numworkers; c++) {
+    CollisionList *collisions = &context->workers[c].collisions;
+    if (collisions->count > 0 && list->count == 0) {
+      /* the first list with pairs is taken as is, leaving the empty one to the worker */
+      const CollisionList swap = context->collisions;
+      context->collisions = *collisions;
+      *collisions = swap;
+    }
+    else if (collisions->count > 0) {
+      MergeCollisionList(&context->collisions, collisions);
+      ClearCollisionList(collisions);
+    }
+    MergeLayerHits(&context->layer_hits, &context->workers[c].layer_hits);
+  }
+  SortCollisionList(&context->collisions);
+  for (c = 0; c < list->count; c++) {
+    context->sprite_info[list->items[c].sprite1].collision = true;
+    context->sprite_info[list->items[c].sprite2].collision = true;
+  }
+}
+
+/* render thread: waits for a new frame, draws its band and signals completion */
+static void WorkerThread(void *data) {
+  Worker *worker = (Worker *) data;
+  Engine *context = worker->context;
+  int generation = 0;
+
+  while (true) {
+    MutexLock(&context->pool.lock);
+    while (context->pool.generation == generation && !context->pool.quit) {
+      CondWait(&context->pool.start, &context->pool.lock);
+    }
+    if (context->pool.quit) {
+      MutexUnlock(&context->pool.lock);
+      return;
+    }
+    generation = context->pool.generation;
+    MutexUnlock(&context->pool.lock);
+
+    DrawBand(worker);
+
+    MutexLock(&context->pool.lock);
+    context->pool.pending -= 1;
+    if (context->pool.pending == 0) {
+      CondSignal(&context->pool.done);
+    }
+    MutexUnlock(&context->pool.lock);
+  }
+}
+
+/* allocates count workers with their scanline buffers, without threads. Returns NULL if any fails */
+static Worker *AllocWorkers(Engine *context, int count) {
+  Worker *workers = (Worker *) calloc(count, sizeof(Worker));
+  int c;
+
+  if (workers == NULL) {
+    return NULL;
+  }
+  for (c = 0; c < count; c++) {
+    if (!InitWorker(context, &workers[c])) {
+      break;
+    }
+  }
+  if (c < count) {
+    for (; c >= 0; c--) {
+      FreeWorker(&workers[c]);
+    }
+    free(workers);
+    return NULL;
+  }
+  return workers;
+}
+
+/* stops and joins the render threads of the context */
+static void StopThreads(Engine *context) {
+  int c;
+
+  if (!context->pool.active) {
+    return;
+  }
+  MutexLock(&context->pool.lock);
+  context->pool.quit = true;
+  CondBroadcast(&context->pool.start);
+  MutexUnlock(&context->pool.lock);
+  for (c = 1; c < context->numworkers; c++) {
+    ThreadJoin(context->workers[c].thread);
+  }
+  CondDelete(&context->pool.start);
+  CondDelete(&context->pool.done);
+  MutexDelete(&context->pool.lock);
+  context->pool.active = false;
+}
+
+/*
+ * starts a render thread for each worker but the first. If one can't be started, the ones that did are stopped
+ * and only worker 0 is kept, drawing on the caller's thread
+ */
+static bool StartThreads(Engine *context) {
+  const int count = context->numworkers;
+  int c;
+
+  context->pool.generation = 0;
+  context->pool.pending = 0;
+  context->pool.quit = false;
+  context->pool.active = count > 1;
+  if (!context->pool.active) {
+    return true;
+  }
+
+  MutexInit(&context->pool.lock);
+  CondInit(&context->pool.start);
+  CondInit(&context->pool.done);
+  for (c = 1; c < count; c++) {
+    if (!ThreadCreate(&context->workers[c].thread, WorkerThread, &context->workers[c])) {
+      break;
+    }
+  }
+  if (c == count) {
+    return true;
+  }
+
+  context->numworkers = c;
+  StopThreads(context);
+  for (c = 1; c < count; c++) {
+    FreeWorker(&context->workers[c]);
+  }
+  context->numworkers = 1;
+  return false;
+}
+
+/*
+ * replaces the scanline workers of a context with count new ones. Worker 0 runs on the caller's thread, the
+ * others get their own. The new workers are allocated before the current ones are deleted, so these are kept
+ * if there's no memory; if a thread can't be started, a single worker is left
+ */
+bool CreateWorkers(Engine *context, int count) {
+  Worker *workers = AllocWorkers(context, count);
+
+  if (workers == NULL) {
+    return false;
+  }
+  DeleteWorkers(context);
+  context->workers = workers;
+  context->numworkers = count;
+  return StartThreads(context);
+}
+
+/* stops render threads and frees scanline workers */
+void DeleteWorkers(Engine *context) {
+  int c;
+
+  if (context->workers == NULL) {
+    return;
+  }
+
+  StopThreads(context);
+  for (c = 0; c < context->numworkers; c++) {
+    FreeWorker(&context->workers[c]);
+  }
+  free(context->workers);
+  context->workers = NULL;
+  context->numworkers = 0;
+}
+
+/*
+ * Draws all the scanlines of the current frame, prepared by PrepareFrame(). With more than one worker, the frame is split in
+ * horizontal bands drawn in parallel. Raster callbacks must run in strict scanline order between lines,
+ * so when a raster callback is set the whole frame is drawn on the caller's thread.
+ */
+void DrawFrame(Engine *context) {
+  const int height = context->framebuffer.height;
+  int numworkers = context->numworkers;
+  int band;
+  int c;
+
+  if (context->cb_raster != NULL || numworkers > height) {
+    numworkers = 1;
+  }
+
+  if (numworkers == 1) {
+    Worker *worker = &context->workers[0];
+    worker->line = 0;
+    worker->end = height;
+    DrawBand(worker);
+    MergeCollisions(context, 1);
+    return;
+  }
+
+  band = (height + numworkers - 1) / numworkers;
+  for (c = 0; c < numworkers; c++) {
+    Worker *worker = &context->workers[c];
+    worker->line = c * band;
+    worker->end = worker->line + band;
+    if (worker->end > height) {
+      worker->end = height;
+    }
+  }
+
+  MutexLock(&context->pool.lock);
+  context->pool.pending = numworkers - 1;
+  context->pool.generation += 1;
+  CondBroadcast(&context->pool.start);
+  MutexUnlock(&context->pool.lock);
+
+  DrawBand(&context->workers[0]);
+
+  MutexLock(&context->pool.lock);
+  while (context->pool.pending != 0) {
+    CondWait(&context->pool.done, &context->pool.lock);
+  }
+  MutexUnlock(&context->pool.lock);
+
+  MergeCollisions(context, numworkers);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 TileDjinn Contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ * */
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "tiledjinn.h"
+#include "Threads.h"
+#include "TileCache.h"
+#include "Collision.h"
+
+/* scanline render state, one per render thread */
+typedef struct Worker {
+    struct Engine *context;  /* owner engine context */
+    uint8_t *priority;    /* buffer receiving tiles with priority */
+    uint16_t *collision;    /* buffer with sprite coverage IDs for per-pixel collision */
+    int *sample_x;    /* layer positions sampled by the pixel mapping scanline */
+    int *sample_y;
+    uint8_t *scan;    /* line the layer being drawn writes to: the framebuffer or a mosaic span */
+    uint32_t *mosaic;    /* sampled mosaic lines at 32 bpp, pixelated, one per layer (numlayers * width) */
+    int *mosaic_line;    /* scanline sampled into each mosaic line, -1 = none */
+    CollisionList collisions;  /* sprite pairs that collided within the band, merged after the frame */
+    OverlapCounts overlap;  /* pixels of the sprite being drawn over each other sprite, empty between sprites */
+    CollisionCount *pair_counts;  /* pixels of each pair of the broadphase, moved to collisions by FlushCollisions() */
+    int *touched_pairs;  /* pairs with pixels in pair_counts, in the order they first touched */
+    int num_touched_pairs;
+    int num_pair_counts;
+    bool collision_clear;  /* collision buffer cleared for the current scanline */
+    LayerHits layer_hits;  /* layers found under sprites within the band, merged after the frame */
+    uint16_t *priority_sprites;  /* sprites with FLAG_PRIORITY found on the current scanline */
+    uint32_t *coverage;    /* occlusion bitmasks, one per layer plus the whole scanline */
+    const uint32_t *cull;  /* coverage of the layer being drawn, NULL if not culling */
+    struct Layer **layers;  /* layers as drawn on the current scanline, by index */
+    struct Layer *line_layers;  /* copies of the layers with line tables, set up for the current scanline */
+    struct Palette **palettes;  /* palettes as drawn on the current scanline, by TLN_PaletteId */
+    struct Palette *line_palettes[256];  /* copy of the palettes with line tables applied */
+    TileCache tilecache;    /* tiles expanded to 32 bpp, empty unless enabled with TLN_SetTileCache() */
+    int line;          /* current scanline */
+    int end;          /* first scanline past the assigned band */
+    thread_t thread;      /* render thread (unused by worker 0, the caller's thread) */
+} Worker;
+
+bool CreateWorkers(struct Engine *context, int count);
+
+void DeleteWorkers(struct Engine *context);
+
+void DrawFrame(struct Engine *context);
+
+#endif
@@ -55,17 +55,18 @@ void TLN_SetWorldPosition(int x, int y) {
  */
 bool TLN_SetSpriteWorldPosition(int nsprite, int x, int y) {
 #pragma EXPORT_FUNC
-  Sprite *sprite;
+  SpriteInfo *sprite;
   if (nsprite >= engine->numsprites) {
     TLN_SetLastError(TLN_ERR_IDX_SPRITE);
     return false;
   }
 
-  sprite = &engine->sprites[nsprite];
+  sprite = &engine->sprite_info[nsprite];
   sprite->xworld = x;
   sprite->yworld = y;
   sprite->world_space = true;
   sprite->dirty = true;
+  engine->sprites_dirty = true;
 
   TLN_SetLastError(TLN_ERR_OK);
   return true;